@@ -0,0 +1,99 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <cstdint>
+
+#include <gsl/gsl>
+
+/// Mapped File
+///
+/// Maps a file read-only into memory for as long as the object exists,
+/// instead of reading the whole file into a buffer. Pages of the file are
+/// only read from disk when they are touched.
+///
+class mapped_file
+{
+public:
+
+    /// Constructor
+    ///
+    /// @expects filename is not empty
+    /// @ensures none
+    ///
+    /// @param filename the file to map
+    ///
+    mapped_file(const std::string &filename);
+
+    /// Destructor
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    ~mapped_file();
+
+    /// Data
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the contents of the file
+    ///
+    gsl::span<const char> data() const
+    { return gsl::span<const char>(m_data, gsl::narrow_cast<std::ptrdiff_t>(m_size)); }
+
+    /// Map At
+    ///
+    /// Maps part of the file read-only at a fixed address, replacing
+    /// whatever was mapped there. The pages are the file's own pages, so
+    /// nothing is copied. Note that a writable private mapping would not
+    /// work here, as locking it copies every page.
+    ///
+    /// @expects addr, offset and size are 4k aligned
+    /// @expects offset + size <= the size of the file, rounded up to 4k
+    /// @ensures none
+    ///
+    /// @param addr the address to map the file at
+    /// @param offset the offset into the file to map from
+    /// @param size the number of bytes to map
+    ///
+    void map_at(char *addr, uint64_t offset, uint64_t size) const;
+
+private:
+
+    int m_fd;
+    const char *m_data;
+    uint64_t m_size;
+
+public:
+
+    mapped_file(mapped_file &&) = delete;
+    mapped_file &operator=(mapped_file &&) = delete;
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+};
+
+#endif
@@ -0,0 +1,179 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#ifndef PRELINKED_IMAGE_H
+#define PRELINKED_IMAGE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include <program.h>
+#include <bfelf_loader.h>
+
+/// Prelinked Image
+///
+/// A program that has been laid out at the virtual addresses it is mapped
+/// at, and relocated. Everything needed to start a process is in here:
+/// the segments to map, the section info for crt_info, the program break
+/// and the entry point.
+///
+/// An image can be saved to a file, and loaded from it the next time the
+/// same program is run, which skips reading the ELF files, and relocating
+/// them. The file records the ID of every ELF file it was built from, and
+/// is only used if none of them have changed.
+///
+class prelinked_image
+{
+public:
+
+    using image_type = std::unique_ptr<char, loaded_elf::image_deleter>;
+
+    struct segment
+    {
+        uintptr_t addr;
+        uintptr_t virt;
+        uint64_t size;
+        uint64_t perm;
+        uint64_t file_id;
+        uint64_t file_offset;
+        bool cached;
+    };
+
+    /// Constructor
+    ///
+    /// Lays out and relocates a program that has just been loaded.
+    ///
+    /// @expects !prog.empty()
+    /// @ensures none
+    ///
+    /// @param prog the program to prelink
+    ///
+    prelinked_image(program prog);
+
+    /// Constructor
+    ///
+    /// Loads an image that was previously saved.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param filename the program the image was saved for
+    /// @param cache the file the image was saved to
+    ///
+    /// @throws std::runtime_error if the file is not a valid image, or if
+    ///     any of the ELF files it was built from have changed
+    ///
+    prelinked_image(const std::string &filename, const std::string &cache);
+
+    /// Save
+    ///
+    /// Writes the image to a temporary file, and renames it, so that an
+    /// image that is being loaded is never partially written.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param cache the file to save the image to
+    ///
+    void save(const std::string &cache) const;
+
+    /// Filename
+    ///
+    /// @return the application the image was built from
+    ///
+    const std::string &filename() const
+    { return m_filename; }
+
+    /// Segments
+    ///
+    /// @return the segments to map, in the order they are mapped
+    ///
+    const std::vector<segment> &segments() const
+    { return m_segments; }
+
+    /// Section Info
+    ///
+    /// @return the section info of each ELF file, for crt_info
+    ///
+    const std::vector<section_info_t> &info() const
+    { return m_info; }
+
+    /// Program Break
+    ///
+    /// @return the first address after the last ELF file
+    ///
+    uintptr_t program_break() const
+    { return m_program_break; }
+
+    /// Entry
+    ///
+    /// @return the application's entry point
+    ///
+    uintptr_t entry() const
+    { return m_entry; }
+
+private:
+
+    void add_elf(bfelf_loader_t *loader, loaded_elf &ef);
+
+private:
+
+    std::string m_filename;
+
+    uintptr_t m_entry;
+    uintptr_t m_program_break;
+
+    std::vector<std::pair<std::string, uint64_t>> m_files;
+    std::vector<std::pair<char *, std::size_t>> m_images;
+
+    std::vector<segment> m_segments;
+    std::vector<section_info_t> m_info;
+
+    program m_program;
+    std::vector<image_type> m_cached_images;
+
+public:
+
+    prelinked_image(prelinked_image &&) = default;
+    prelinked_image &operator=(prelinked_image &&) = default;
+
+    prelinked_image(const prelinked_image &) = delete;
+    prelinked_image &operator=(const prelinked_image &) = delete;
+};
+
+/// Prelink
+///
+/// Returns the prelinked image of an application. A saved image is used if
+/// there is one, and it is up to date. Otherwise the application and its
+/// libraries are loaded and relocated, and the result is saved for next
+/// time. Failing to save the image is not an error.
+///
+/// @expects none
+/// @ensures ret != nullptr
+///
+/// @param filename the application to prelink
+/// @return the prelinked image
+///
+std::unique_ptr<prelinked_image> prelink(const std::string &filename);
+
+#endif
@@ -25,39 +25,39 @@
 #include <vector>
 #include <memory>
 
+#include <gsl/gsl>
+
 #include <processid.h>
 #include <processlistid.h>
 
 #include <crt_info.h>
-#include <bfelf_loader.h>
+#include <prelinked_image.h>
+
+#include <process_list.h>
 
 class process
 {
 public:
 
-    process(const std::string &filename, processlistid::type procltid);
+    process(const std::string &filename, gsl::not_null<process_list *> proclt);
+    process(std::unique_ptr<prelinked_image> image, gsl::not_null<process_list *> proclt);
     ~process();
 
-    gsl::not_null<bfelf_file_t *> load_elf(const std::string &filename);
-
 private:
 
     processid::type m_id;
     processlistid::type m_procltid;
 
+    vmcall_batch *m_batch;
+
     uintptr_t m_info_addr;
-    uintptr_t m_virt_addr;
 
     std::string m_filename;
     std::string m_basename;
 
-    bfelf_loader_t m_loader;
-
-    std::unique_ptr<char> m_stack;
     std::unique_ptr<crt_info> m_crt_info;
 
-    std::vector<std::unique_ptr<char>> m_segments;
-    std::vector<std::unique_ptr<bfelf_file_t>> m_elfs;
+    std::unique_ptr<prelinked_image> m_image;
 
 public:
 
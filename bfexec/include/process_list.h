@@ -23,6 +23,7 @@
 #define PROCESS_LIST_H
 
 #include <processlistid.h>
+#include <vmcall_batch.h>
 
 class process_list
 {
@@ -34,9 +35,13 @@ public:
     processlistid::type id() const
     { return m_id; }
 
+    vmcall_batch &batch()
+    { return m_batch; }
+
 private:
 
     processlistid::type m_id;
+    vmcall_batch m_batch;
 
 public:
 
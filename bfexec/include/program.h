@@ -0,0 +1,114 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include <bfelf_loader.h>
+#include <mapped_file.h>
+
+/// Loaded ELF
+///
+/// An ELF file that has been read, with its segments laid out in memory
+/// the way they are mapped into a process, but that has not been given a
+/// virtual address or relocated yet.
+///
+struct loaded_elf
+{
+    struct image_deleter
+    {
+        std::size_t size;
+        void operator()(char *mem) const;
+    };
+
+    std::string filename;
+    uint64_t file_id;
+
+    std::unique_ptr<mapped_file> file;
+    std::unique_ptr<bfelf_file_t> elf;
+    std::unique_ptr<char, image_deleter> image;
+    std::size_t size;
+
+    std::vector<std::string> needed;
+};
+
+/// Program
+///
+/// A VM application, followed by every shared library that it needs,
+/// directly or indirectly, each listed once.
+///
+using program = std::vector<loaded_elf>;
+
+/// Load Program
+///
+/// Reads an application and its full dependency graph. Each level of the
+/// graph is read in parallel, one thread per file, so that the I/O (and
+/// copying) of independent libraries overlaps.
+///
+/// @expects none
+/// @ensures !ret.empty()
+///
+/// @param filename the VM application to load
+/// @return the application and its libraries
+///
+program load_program(const std::string &filename);
+
+/// Cacheable
+///
+/// @expects none
+/// @ensures none
+///
+/// @param elf the ELF file the segment belongs to
+/// @param instr the segment
+/// @return true if the segment is read-only, and is the only segment on
+///     each of its pages, in which case it is mapped from the domain's
+///     segment cache
+///
+bool cacheable(bfelf_file_t *elf, const bfelf_load_instr *instr);
+
+/// File ID
+///
+/// @expects none
+/// @ensures none
+///
+/// @param filename the file to identify
+/// @return a hash of the file's device, inode, size and modification time,
+///     which changes whenever the file is replaced or modified
+///
+uint64_t file_id(const std::string &filename);
+
+/// Map Image
+///
+/// @expects size is 4k aligned
+/// @ensures ret != nullptr
+///
+/// @param size the size of the image
+/// @return zero filled, writable memory to lay out an image in, which is
+///     released using loaded_elf::image_deleter
+///
+char *map_image(std::size_t size);
+
+#endif
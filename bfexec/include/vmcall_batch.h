@@ -0,0 +1,89 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#ifndef VMCALL_BATCH_H
+#define VMCALL_BATCH_H
+
+#include <memory>
+#include <cstdlib>
+
+#include <sys/mman.h>
+
+#include <threadid.h>
+#include <processid.h>
+#include <processlistid.h>
+
+#include <vmcall_hyperkernel_interface.h>
+
+class vmcall_batch
+{
+public:
+
+    vmcall_batch(processlistid::type procltid);
+    ~vmcall_batch() = default;
+
+    void vm_map_foreign_lookup(
+        processid::type processid, uintptr_t virt, uintptr_t addr, uintptr_t size, uintptr_t perm);
+
+    void vm_reserve_foreign(
+        processid::type processid, uintptr_t virt, uintptr_t addr, uintptr_t size, uintptr_t perm);
+
+    void vm_map_foreign_segment(
+        processid::type processid, uintptr_t virt, uintptr_t addr, uintptr_t size,
+        uint64_t file_id, uint64_t file_offset);
+
+    void set_thread_foreign_info(
+        processid::type processid, threadid::type threadid,
+        uintptr_t entry, uintptr_t stack, uintptr_t arg1, uintptr_t arg2);
+
+    void push(const vmcall_registers_t &regs);
+    void flush();
+    void clear();
+
+private:
+
+    struct ring_deleter
+    {
+        void operator()(vmcall_ring_t *ring)
+        {
+            munlock(ring, 0x1000);
+            free(ring);
+        }
+    };
+
+    processlistid::type m_procltid;
+    std::unique_ptr<vmcall_ring_t, ring_deleter> m_ring;
+
+    bool m_is_registered;
+
+public:
+
+    friend class hyperkernel_ut;
+
+    vmcall_batch(vmcall_batch &&) = default;
+    vmcall_batch &operator=(vmcall_batch &&) = default;
+
+    vmcall_batch(const vmcall_batch &) = delete;
+    vmcall_batch &operator=(const vmcall_batch &) = delete;
+};
+
+#endif
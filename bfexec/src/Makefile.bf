@@ -56,7 +56,11 @@ NATIVE_OUTDIR+=%BUILD_REL%/../bin
 SOURCES+=main.cpp
 SOURCES+=vcpu.cpp
 SOURCES+=process.cpp
+SOURCES+=program.cpp
+SOURCES+=prelinked_image.cpp
+SOURCES+=mapped_file.cpp
 SOURCES+=process_list.cpp
+SOURCES+=vmcall_batch.cpp
 SOURCES+=set_affinity.c
 SOURCES+=%HYPER_ABS%/common/vmcall_intel_x64.asm
 
@@ -83,7 +87,7 @@ WINDOWS_LIBRARY_PATHS+=
 
 LINUX_SOURCES+=
 LINUX_INCLUDE_PATHS+=
-LINUX_LIBS+=
+LINUX_LIBS+=pthread
 LINUX_LIBRARY_PATHS+=
 
 ################################################################################
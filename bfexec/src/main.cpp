@@ -21,21 +21,107 @@
 
 #include <gsl/gsl>
 
+#include <string>
 #include <vector>
 #include <memory>
+#include <future>
+#include <algorithm>
 
 #include <vcpu.h>
 #include <process.h>
+#include <prelinked_image.h>
 #include <process_list.h>
 #include <vmcall_hyperkernel_interface.h>
 
 using arg_list_type = std::vector<std::string>;
 
-std::unique_ptr<process_list> g_proclt;
+std::vector<std::unique_ptr<process_list>> g_proclts;
 std::vector<std::unique_ptr<vcpu>> g_vcpus;
 std::vector<std::unique_ptr<process>> g_processes;
 
-extern "C" int set_affinity(void);
+extern "C" int set_affinity(uint64_t core);
+extern "C" uint64_t num_online_cores(void);
+
+// The number of vCPUs a process list can have in the hyperkernel
+// (process_list::max_vcpus).
+
+constexpr const auto max_vcpus_per_proclt = 64UL;
+
+struct options
+{
+    uint64_t cores;
+    bool per_core;
+    bool exit_stats;
+
+    arg_list_type filenames;
+};
+
+static options
+parse_args(const arg_list_type &args)
+{
+    auto &&opts = options{1, false, false, {}};
+
+    for (auto i = 0UL; i < args.size(); i++)
+    {
+        const auto &arg = args.at(i);
+
+        if (arg == "--cores")
+        {
+            if (++i == args.size())
+                throw std::invalid_argument("--cores needs a number of cores, or \"all\"");
+
+            if (args.at(i) == "all")
+                opts.cores = num_online_cores();
+            else
+                opts.cores = std::stoull(args.at(i));
+
+            continue;
+        }
+
+        if (arg == "--per-core")
+        {
+            opts.per_core = true;
+            continue;
+        }
+
+        if (arg == "--exit-stats")
+        {
+            opts.exit_stats = true;
+            continue;
+        }
+
+        opts.filenames.push_back(arg);
+    }
+
+    if (opts.cores == 0 || opts.cores > num_online_cores())
+        throw std::invalid_argument("--cores must be between 1 and " + std::to_string(num_online_cores()));
+
+    if (!opts.per_core && opts.cores > max_vcpus_per_proclt)
+        throw std::invalid_argument("--cores must be at most " + std::to_string(max_vcpus_per_proclt));
+
+    return opts;
+}
+
+template<class F>
+void
+on_each_core(uint64_t cores, F func)
+{
+    auto &&work = std::vector<std::future<void>>();
+
+    for (auto core = 0UL; core < cores; core++)
+    {
+        work.push_back(std::async(std::launch::async, [&func, core]
+        {
+            if (set_affinity(core) != 0)
+                throw std::runtime_error("failed to set cpu affinity");
+
+            func(core);
+        }));
+    }
+
+    for (auto &&w : work)
+        w.get();
+}
 
 int
 protected_main(const arg_list_type &args)
@@ -43,23 +129,90 @@ protected_main(const arg_list_type &args)
     auto ___ = gsl::finally([&]
     {
         g_processes.clear();
+
+        // Like on success, each vCPU has to be deleted from the core it was
+        // created on. If that fails, they are deleted from this core
+        // instead, so that they are at least not leaked.
+
+        try
+        {
+            auto &&remaining = std::any_of(g_vcpus.begin(), g_vcpus.end(), [](const auto &vc)
+            { return vc != nullptr; });
+
+            if (remaining)
+            {
+                on_each_core(g_vcpus.size(), [&](uint64_t core)
+                { g_vcpus.at(core).reset(); });
+            }
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "failed to delete vcpus: " << e.what() << '\n';
+        }
+
         g_vcpus.clear();
-        g_proclt.reset();
+        g_proclts.clear();
     });
 
-    if (set_affinity() != 0)
+    auto &&opts = parse_args(args);
+
+    if (set_affinity(0) != 0)
         throw std::runtime_error("failed to set cpu affinity");
 
-    g_proclt = std::make_unique<process_list>();
+    // By default, every vCPU shares one process list, and processes move
+    // to whichever vCPU is free. With --per-core, each core gets its own
+    // process list, and processes are spread across cores in the order
+    // they are given, and stay there.
+
+    auto &&num_proclts = opts.per_core ? opts.cores : 1UL;
+
+    for (auto i = 0UL; i < num_proclts; i++)
+        g_proclts.push_back(std::make_unique<process_list>());
+
+    g_vcpus.resize(opts.cores);
+
+    // A vCPU is created on the core that asks for it, so each one is
+    // created from a thread running on its core.
+
+    on_each_core(opts.cores, [&](uint64_t core)
+    {
+        auto &&proclt = g_proclts.at(core % num_proclts).get();
+        g_vcpus.at(core) = std::make_unique<vcpu>(proclt->id());
+    });
+
+    // Every application (and its libraries) is prelinked at the same time,
+    // and the processes are then created one at a time, in the order given.
+
+    auto &&images = std::vector<std::future<std::unique_ptr<prelinked_image>>>();
+
+    for (const auto &filename : opts.filenames)
+        images.push_back(std::async(std::launch::async, prelink, filename));
+
+    for (auto i = 0UL; i < images.size(); i++)
+    {
+        auto &&proclt = g_proclts.at(i % num_proclts).get();
+        g_processes.push_back(std::make_unique<process>(images.at(i).get(), proclt));
+    }
+
+    on_each_core(opts.cores, [&](uint64_t)
+    {
+        if (!vmcall__sched_yield())
+            throw std::runtime_error("vmcall__sched_yield failed");
+    });
+
+    // The stats are dumped before the vCPUs are deleted, as a vCPU's stats
+    // are deleted along with it.
+
+    if (opts.exit_stats && !vmcall__dump_exit_stats(REG_INVALID))
+        throw std::runtime_error("vmcall__dump_exit_stats failed");
 
-    for (auto i = 0; i < 1; i++)
-        g_vcpus.push_back(std::make_unique<vcpu>(g_proclt->id()));
+    // vCPUs are deleted from the core they were created on, once there are
+    // no processes left for them to run.
 
-    for (const auto &arg : args)
-        g_processes.push_back(std::make_unique<process>(arg, g_proclt->id()));
+    g_processes.clear();
 
-    if (!vmcall__sched_yield())
-        throw std::runtime_error("vmcall__sched_yield failed");
+    on_each_core(opts.cores, [&](uint64_t core)
+    { g_vcpus.at(core).reset(); });
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,78 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#include <debug.h>
+#include <upper_lower.h>
+
+#include <mapped_file.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+mapped_file::mapped_file(const std::string &filename) :
+    m_fd(-1),
+    m_data(nullptr),
+    m_size(0)
+{
+    expects(!filename.empty());
+
+    m_fd = open(filename.c_str(), O_RDONLY);
+    if (m_fd == -1)
+        throw std::runtime_error("invalid file name: " + filename);
+
+    auto ___ = gsl::on_failure([&]
+    { close(m_fd); });
+
+    struct stat buffer = {};
+
+    if (fstat(m_fd, &buffer) != 0 || buffer.st_size <= 0)
+        throw std::runtime_error("unable to stat: " + filename);
+
+    m_size = static_cast<uint64_t>(buffer.st_size);
+
+    auto &&data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if (data == MAP_FAILED)
+        throw std::runtime_error("unable to map: " + filename);
+
+    m_data = static_cast<const char *>(data);
+}
+
+mapped_file::~mapped_file()
+{
+    munmap(const_cast<char *>(m_data), m_size);
+    close(m_fd);
+}
+
+void
+mapped_file::map_at(char *addr, uint64_t offset, uint64_t size) const
+{
+    expects(bfn::lower(reinterpret_cast<uintptr_t>(addr)) == 0);
+    expects(bfn::lower(offset) == 0);
+    expects(bfn::lower(size) == 0);
+    expects(offset + size <= bfn::upper(m_size + 0xFFF));
+
+    auto &&ret = mmap(addr, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, m_fd, static_cast<off_t>(offset));
+    if (ret == MAP_FAILED)
+        throw std::runtime_error("unable to map file at a fixed address");
+}
@@ -0,0 +1,447 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#include <gsl/gsl>
+
+#include <debug.h>
+#include <constants.h>
+#include <upper_lower.h>
+
+#include <mapped_file.h>
+#include <prelinked_image.h>
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// -----------------------------------------------------------------------------
+// File Format
+// -----------------------------------------------------------------------------
+
+// The file starts with a header, followed by a record for each ELF file,
+// image and segment, followed by the section info. The images themselves
+// start at the next 4k boundary, each 4k aligned, so that whole pages of
+// cached segments can be mapped straight from the file.
+
+constexpr const auto prelinked_image_magic = 0x4B4E494C4552504CUL;
+constexpr const auto prelinked_image_version = 1UL;
+
+struct image_header
+{
+    uint64_t magic;
+    uint64_t version;
+    uint64_t entry;
+    uint64_t program_break;
+    uint64_t num_files;
+    uint64_t num_images;
+    uint64_t num_segments;
+    uint64_t num_info;
+};
+
+struct file_record
+{
+    uint64_t file_id;
+    char filename[256];
+};
+
+struct image_record
+{
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct segment_record
+{
+    uint64_t image;
+    uint64_t mem_offset;
+    uint64_t virt;
+    uint64_t size;
+    uint64_t perm;
+    uint64_t file_id;
+    uint64_t file_offset;
+    uint64_t cached;
+};
+
+// -----------------------------------------------------------------------------
+// Helpers
+// -----------------------------------------------------------------------------
+
+static const std::string g_cache_path = "./.bfexec_cache/";
+
+template<class T>
+const T *
+read_records(gsl::span<const char> view, uint64_t &offset, uint64_t num)
+{
+    if (num > static_cast<uint64_t>(view.size()) / sizeof(T) ||
+        offset + (num * sizeof(T)) > static_cast<uint64_t>(view.size()))
+    {
+        throw std::runtime_error("prelinked image is truncated");
+    }
+
+    auto &&records = reinterpret_cast<const T *>(view.data() + offset);
+    offset += num * sizeof(T);
+
+    return records;
+}
+
+static bool
+in_bounds(uint64_t offset, uint64_t size, uint64_t limit)
+{ return offset <= limit && size <= limit - offset; }
+
+template<class T>
+void
+write_records(std::ofstream &file, const T *records, uint64_t num)
+{
+    file.write(reinterpret_cast<const char *>(records), static_cast<std::streamsize>(num * sizeof(T)));
+}
+
+static std::string
+cache_filename(const std::string &filename)
+{
+    auto id = 0xCBF29CE484222325UL;
+
+    for (auto ch : filename)
+    {
+        id ^= static_cast<uint8_t>(ch);
+        id *= 0x100000001B3UL;
+    }
+
+    std::stringstream ss;
+    ss << g_cache_path << std::hex << id << ".img";
+
+    return ss.str();
+}
+
+// -----------------------------------------------------------------------------
+// Implementation
+// -----------------------------------------------------------------------------
+
+prelinked_image::prelinked_image(program prog) :
+    m_filename(prog.front().filename),
+    m_entry(0),
+    m_program_break(0x00600000UL),
+    m_program(std::move(prog))
+{
+    auto ret = 0L;
+    auto loader = std::make_unique<bfelf_loader_t>();
+
+    memset(loader.get(), 0, sizeof(bfelf_loader_t));
+
+    // The files were read (in parallel) before they were prelinked. All
+    // that is left is to give each one its place in the process, which has
+    // to be done in order, as each file is placed after the last.
+
+    for (auto &&ef : m_program)
+        add_elf(loader.get(), ef);
+
+    ret = bfelf_loader_relocate(loader.get());
+    if (ret != BFELF_SUCCESS)
+        throw std::runtime_error("bfelf_loader_relocate failed");
+
+    for (const auto &ef : m_program)
+    {
+        section_info_t info = {};
+
+        ret = bfelf_file_get_section_info(ef.elf.get(), &info);
+        if (ret != BFELF_SUCCESS)
+            throw std::runtime_error("bfelf_file_get_section_info failed");
+
+        m_info.push_back(info);
+    }
+
+    ret = bfelf_file_get_entry(m_program.front().elf.get(), reinterpret_cast<void **>(&m_entry));
+    if (ret != BFELF_SUCCESS)
+        throw std::runtime_error("bfelf_file_get_entry failed");
+}
+
+prelinked_image::prelinked_image(const std::string &filename, const std::string &cache) :
+    m_filename(filename),
+    m_entry(0),
+    m_program_break(0)
+{
+    auto &&file = mapped_file(cache);
+    auto &&view = file.data();
+    auto &&offset = 0UL;
+
+    auto &&hdr = read_records<image_header>(view, offset, 1);
+
+    if (hdr->magic != prelinked_image_magic || hdr->version != prelinked_image_version)
+        throw std::runtime_error("invalid prelinked image: " + cache);
+
+    if (hdr->num_info > MAX_NUM_MODULES)
+        throw std::runtime_error("invalid prelinked image: " + cache);
+
+    auto &&files = read_records<file_record>(view, offset, hdr->num_files);
+    auto &&images = read_records<image_record>(view, offset, hdr->num_images);
+    auto &&segments = read_records<segment_record>(view, offset, hdr->num_segments);
+    auto &&info = read_records<section_info_t>(view, offset, hdr->num_info);
+
+    for (auto i = 0UL; i < hdr->num_files; i++)
+    {
+        if (memchr(files[i].filename, '\0', sizeof(file_record::filename)) == nullptr)
+            throw std::runtime_error("invalid prelinked image: " + cache);
+    }
+
+    // The image is only good as long as every file it was built from is
+    // the same as it was. Checking this is a stat per file, which is all
+    // that is left of loading the program.
+
+    if (hdr->num_files == 0 || std::string(files[0].filename) != filename)
+        throw std::runtime_error("prelinked image is for a different program: " + cache);
+
+    for (auto i = 0UL; i < hdr->num_files; i++)
+    {
+        if (file_id(files[i].filename) != files[i].file_id)
+            throw std::runtime_error("prelinked image is out of date: " + cache);
+
+        m_files.push_back({files[i].filename, files[i].file_id});
+    }
+
+    for (auto i = 0UL; i < hdr->num_images; i++)
+    {
+        const auto &rec = images[i];
+
+        if (bfn::lower(rec.offset) != 0 || bfn::lower(rec.size) != 0 ||
+            !in_bounds(rec.offset, rec.size, static_cast<uint64_t>(view.size())))
+        {
+            throw std::runtime_error("invalid prelinked image: " + cache);
+        }
+
+        auto &&image = image_type(map_image(rec.size), {rec.size});
+        auto &&mem = image.get();
+        auto &&copied = 0UL;
+
+        // Cached segments are mapped straight from the file, as they are
+        // read-only, and are never mapped into the process from bfexec's
+        // copy. The rest of the image is copied, as the process maps it
+        // directly, and must not be able to write to the file's pages.
+
+        for (auto j = 0UL; j < hdr->num_segments; j++)
+        {
+            const auto &seg = segments[j];
+
+            if (seg.image != i || seg.cached == 0)
+                continue;
+
+            auto &&direct = bfn::upper(seg.size);
+
+            if (seg.mem_offset < copied || !in_bounds(seg.mem_offset, seg.size, rec.size))
+                throw std::runtime_error("invalid prelinked image: " + cache);
+
+            memcpy(mem + copied, view.data() + rec.offset + copied, seg.mem_offset - copied);
+
+            if (direct != 0)
+                file.map_at(mem + seg.mem_offset, rec.offset + seg.mem_offset, direct);
+
+            copied = seg.mem_offset + direct;
+        }
+
+        memcpy(mem + copied, view.data() + rec.offset + copied, rec.size - copied);
+
+        if (mlock(mem, rec.size) != 0)
+            throw std::runtime_error("mlock failed: " + cache);
+
+        m_images.push_back({mem, rec.size});
+        m_cached_images.push_back(std::move(image));
+    }
+
+    for (auto i = 0UL; i < hdr->num_segments; i++)
+    {
+        const auto &seg = segments[i];
+
+        if (seg.image >= hdr->num_images || !in_bounds(seg.mem_offset, seg.size, images[seg.image].size))
+            throw std::runtime_error("invalid prelinked image: " + cache);
+
+        auto &&addr = reinterpret_cast<uintptr_t>(m_images.at(seg.image).first) + seg.mem_offset;
+        m_segments.push_back({addr, seg.virt, seg.size, seg.perm, seg.file_id, seg.file_offset, seg.cached != 0});
+    }
+
+    m_info.assign(info, info + hdr->num_info);
+
+    m_entry = hdr->entry;
+    m_program_break = hdr->program_break;
+}
+
+void
+prelinked_image::save(const std::string &cache) const
+{
+    auto &&hdr = image_header{};
+    auto &&files = std::vector<file_record>(m_files.size());
+    auto &&images = std::vector<image_record>();
+    auto &&segments = std::vector<segment_record>();
+
+    hdr.magic = prelinked_image_magic;
+    hdr.version = prelinked_image_version;
+    hdr.entry = m_entry;
+    hdr.program_break = m_program_break;
+    hdr.num_files = m_files.size();
+    hdr.num_images = m_images.size();
+    hdr.num_segments = m_segments.size();
+    hdr.num_info = m_info.size();
+
+    for (auto i = 0UL; i < m_files.size(); i++)
+    {
+        const auto &name = m_files.at(i).first;
+
+        if (name.size() >= sizeof(file_record::filename))
+            throw std::runtime_error("filename too long for a prelinked image: " + name);
+
+        files.at(i).file_id = m_files.at(i).second;
+        name.copy(static_cast<char *>(files.at(i).filename), name.size());
+    }
+
+    auto &&offset = sizeof(image_header) +
+                    (hdr.num_files * sizeof(file_record)) +
+                    (hdr.num_images * sizeof(image_record)) +
+                    (hdr.num_segments * sizeof(segment_record)) +
+                    (hdr.num_info * sizeof(section_info_t));
+
+    offset = bfn::upper(offset + 0xFFF);
+
+    for (const auto &image : m_images)
+    {
+        images.push_back({offset, image.second});
+        offset += image.second;
+    }
+
+    for (const auto &seg : m_segments)
+    {
+        auto &&i = 0UL;
+
+        for (; i < m_images.size(); i++)
+        {
+            auto &&mem = reinterpret_cast<uintptr_t>(m_images.at(i).first);
+            if (seg.addr >= mem && seg.addr < mem + m_images.at(i).second)
+                break;
+        }
+
+        auto &&mem_offset = seg.addr - reinterpret_cast<uintptr_t>(m_images.at(i).first);
+        segments.push_back({i, mem_offset, seg.virt, seg.size, seg.perm, seg.file_id, seg.file_offset, seg.cached ? 1UL : 0UL});
+    }
+
+    mkdir(g_cache_path.c_str(), 0755);
+
+    auto &&tmp = cache + "." + std::to_string(getpid());
+    auto ___ = gsl::on_failure([&]
+    { unlink(tmp.c_str()); });
+
+    {
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+
+        write_records(file, &hdr, 1);
+        write_records(file, files.data(), files.size());
+        write_records(file, images.data(), images.size());
+        write_records(file, segments.data(), segments.size());
+        write_records(file, m_info.data(), m_info.size());
+
+        for (auto i = 0UL; i < m_images.size(); i++)
+        {
+            file.seekp(static_cast<std::streamoff>(images.at(i).offset));
+            write_records(file, m_images.at(i).first, m_images.at(i).second);
+        }
+
+        if (!file)
+            throw std::runtime_error("failed to write: " + tmp);
+    }
+
+    if (rename(tmp.c_str(), cache.c_str()) != 0)
+        throw std::runtime_error("failed to rename: " + tmp);
+}
+
+void
+prelinked_image::add_elf(bfelf_loader_t *loader, loaded_elf &ef)
+{
+    auto &&ret = 0L;
+    auto &&elf_ptr = ef.elf.get();
+
+    auto &&pic = bfelf_file_get_pic_pie(elf_ptr);
+    auto &&mem = ef.image.get();
+    auto &&mem_view = gsl::span<char>(mem, static_cast<std::ptrdiff_t>(ef.size));
+
+    for (auto i = 0; i < bfelf_file_get_num_load_instrs(elf_ptr); i++)
+    {
+        struct bfelf_load_instr *instr = nullptr;
+
+        ret = bfelf_file_get_load_instr(elf_ptr, static_cast<uint64_t>(i), &instr);
+        if (ret != BFELF_SUCCESS)
+            throw std::runtime_error("bfelf_file_get_load_instr failed");
+
+        auto &&virt_int = pic == 1 ? m_program_break + instr->mem_offset : instr->virt_addr;
+        auto &&addr_int = reinterpret_cast<uintptr_t>(&mem_view.at(instr->mem_offset));
+
+        m_segments.push_back({
+            addr_int,
+            virt_int,
+            instr->memsz,
+            instr->perm,
+            ef.file_id,
+            instr->file_offset,
+            cacheable(elf_ptr, instr)
+        });
+    }
+
+    auto &&virt = pic == 1 ? reinterpret_cast<char *>(m_program_break) : nullptr;
+
+    ret = bfelf_loader_add(loader, elf_ptr, mem, virt);
+    if (ret != BFELF_SUCCESS)
+        throw std::runtime_error("bfelf_loader_add failed");
+
+    m_files.push_back({ef.filename, ef.file_id});
+    m_images.push_back({mem, ef.size});
+
+    m_program_break += static_cast<uintptr_t>(ef.size);
+    if (bfn::lower(m_program_break) != 0)
+        m_program_break = bfn::upper(m_program_break + 0x1000);
+}
+
+std::unique_ptr<prelinked_image>
+prelink(const std::string &filename)
+{
+    auto &&cache = cache_filename(filename);
+
+    try
+    {
+        return std::make_unique<prelinked_image>(filename, cache);
+    }
+    catch (std::exception &)
+    { }
+
+    // There is no saved image, or it is out of date, so the program is
+    // loaded, and the result saved for the next time it is run.
+
+    auto &&image = std::make_unique<prelinked_image>(load_program(filename));
+
+    try
+    {
+        image->save(cache);
+    }
+    catch (std::exception &e)
+    {
+        bfwarning << "unable to save prelinked image: " << e.what() << '\n';
+    }
+
+    return std::move(image);
+}
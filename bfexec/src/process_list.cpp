@@ -26,7 +26,8 @@
 #include <vmcall_hyperkernel_interface.h>
 
 process_list::process_list() :
-    m_id(vmcall__create_process_list())
+    m_id(vmcall__create_process_list()),
+    m_batch(m_id)
 {
     if (m_id == processlistid::invalid)
         throw std::runtime_error("vmcall__create_process_list failed");
@@ -0,0 +1,284 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#include <gsl/gsl>
+
+#include <debug.h>
+#include <upper_lower.h>
+
+#include <program.h>
+
+#include <map>
+#include <set>
+#include <mutex>
+#include <future>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// -----------------------------------------------------------------------------
+// Helpers
+// -----------------------------------------------------------------------------
+
+static const std::vector<std::string> g_ld_library_path =
+{
+    "./sysroot_vmapp/x86_64-vmapp-elf/lib/",
+    "./sysroot_vmapp/x86_64-vmapp-elf/lib/cross/"
+};
+
+static std::mutex g_library_mutex;
+static std::map<std::string, std::string> g_library_paths;
+
+static bool
+exists(const std::string &name)
+{
+    struct stat buffer = {};
+    return stat(name.c_str(), &buffer) == 0;
+}
+
+static std::string
+find_library(const std::string &name)
+{
+    // Most applications need the same few libraries, so the search is only
+    // done once per library, no matter how many processes are loaded.
+
+    std::lock_guard<std::mutex> guard(g_library_mutex);
+
+    auto &&iter = g_library_paths.find(name);
+    if (iter != g_library_paths.end())
+        return iter->second;
+
+    for (const auto &path : g_ld_library_path)
+    {
+        auto &&fullpath = path + name;
+        if (exists(fullpath))
+            return g_library_paths[name] = fullpath;
+    }
+
+    throw std::runtime_error("unable to find: " + name);
+}
+
+static bool
+shares_page(bfelf_file_t *elf, const bfelf_load_instr *instr)
+{
+    auto &&start = bfn::upper(instr->mem_offset);
+    auto &&end = bfn::upper(instr->mem_offset + instr->memsz + 0xFFF);
+
+    for (auto i = 0; i < bfelf_file_get_num_load_instrs(elf); i++)
+    {
+        struct bfelf_load_instr *other = nullptr;
+
+        if (bfelf_file_get_load_instr(elf, static_cast<uint64_t>(i), &other) != BFELF_SUCCESS)
+            throw std::runtime_error("bfelf_file_get_load_instr failed");
+
+        if (other == instr)
+            continue;
+
+        if (other->mem_offset < end && other->mem_offset + other->memsz > start)
+            return true;
+    }
+
+    return false;
+}
+
+static loaded_elf
+load_elf(const std::string &filename)
+{
+    auto &&ret = 0L;
+    auto ef = loaded_elf{};
+
+    ef.filename = filename;
+    ef.file_id = file_id(filename);
+    ef.file = std::make_unique<mapped_file>(filename);
+    ef.elf = std::make_unique<bfelf_file_t>();
+
+    auto &&bin_view = ef.file->data();
+    auto &&elf_ptr = ef.elf.get();
+
+    ret = bfelf_file_init(bin_view.data(), static_cast<uint64_t>(bin_view.size()), elf_ptr);
+    if (ret != BFELF_SUCCESS)
+        throw std::runtime_error("bfelf_file_init failed");
+
+    auto &&tsz = bfelf_file_get_total_size(elf_ptr);
+    if (tsz < BFELF_SUCCESS)
+        throw std::runtime_error("bfelf_file_get_total_size failed");
+
+    if (bfn::lower(static_cast<uintptr_t>(tsz)) != 0)
+        tsz = static_cast<std::ptrdiff_t>(bfn::upper(static_cast<uintptr_t>(tsz)) + 0x1000);
+
+    ef.size = static_cast<std::size_t>(tsz);
+    ef.image = std::unique_ptr<char, loaded_elf::image_deleter>(map_image(ef.size), {ef.size});
+
+    auto &&mem_view = gsl::span<char>(ef.image.get(), tsz);
+
+    for (auto i = 0; i < bfelf_file_get_num_load_instrs(elf_ptr); i++)
+    {
+        struct bfelf_load_instr *instr = nullptr;
+
+        ret = bfelf_file_get_load_instr(elf_ptr, static_cast<uint64_t>(i), &instr);
+        if (ret != BFELF_SUCCESS)
+            throw std::runtime_error("bfelf_file_get_load_instr failed");
+
+        // The VMM never maps bfexec's copy of a cached segment into the
+        // process, so its whole pages can be mapped straight from the file
+        // instead of being copied. Only a partial last page is copied.
+        // Everything else is copied, as the process maps bfexec's memory
+        // directly, and must not be able to write to the file's pages.
+
+        auto &&direct = 0UL;
+
+        if (cacheable(elf_ptr, instr) && bfn::lower(instr->file_offset) == 0)
+        {
+            direct = bfn::upper(instr->filesz);
+
+            if (direct != 0)
+                ef.file->map_at(&mem_view.at(instr->mem_offset), instr->file_offset, direct);
+        }
+
+        if (instr->filesz != direct)
+        {
+            memcpy(&mem_view.at(instr->mem_offset + direct),
+                   &bin_view.at(instr->file_offset + direct),
+                   instr->filesz - direct);
+        }
+    }
+
+    // The VMM looks up the physical address of every page when the batch
+    // is flushed, and maps them into the process, so the pages have to be
+    // present, and stay where they are.
+
+    if (mlock(ef.image.get(), ef.size) != 0)
+        throw std::runtime_error("mlock failed: " + filename);
+
+    for (auto i = 0; i < bfelf_file_get_num_needed(elf_ptr); i++)
+    {
+        const char *needed;
+
+        ret = bfelf_file_get_needed(elf_ptr, static_cast<uint64_t>(i), &needed);
+        if (ret != BFELF_SUCCESS)
+            throw std::runtime_error("bfelf_file_get_needed failed");
+
+        ef.needed.push_back(find_library(needed));
+    }
+
+    return ef;
+}
+
+// -----------------------------------------------------------------------------
+// Implementation
+// -----------------------------------------------------------------------------
+
+void
+loaded_elf::image_deleter::operator()(char *mem) const
+{
+    munmap(mem, size);
+}
+
+program
+load_program(const std::string &filename)
+{
+    auto prog = program{};
+    auto &&seen = std::set<std::string>{filename};
+    auto &&level = std::vector<std::string>{filename};
+
+    // The graph is walked one level at a time. Every file in a level is
+    // read by its own thread, and the libraries they need, that have not
+    // been seen yet, make up the next level.
+
+    while (!level.empty())
+    {
+        auto &&loads = std::vector<std::future<loaded_elf>>();
+
+        for (const auto &name : level)
+            loads.push_back(std::async(std::launch::async, load_elf, name));
+
+        level.clear();
+
+        for (auto &&load : loads)
+        {
+            prog.push_back(load.get());
+
+            for (const auto &needed : prog.back().needed)
+            {
+                if (seen.insert(needed).second)
+                    level.push_back(needed);
+            }
+        }
+    }
+
+    return prog;
+}
+
+bool
+cacheable(bfelf_file_t *elf, const bfelf_load_instr *instr)
+{
+    if ((instr->perm & bfelf_pf_w) != 0)
+        return false;
+
+    if (bfn::lower(instr->mem_offset) != 0 || bfn::lower(instr->virt_addr) != 0)
+        return false;
+
+    return !shares_page(elf, instr);
+}
+
+uint64_t
+file_id(const std::string &filename)
+{
+    struct stat buffer = {};
+
+    if (stat(filename.c_str(), &buffer) != 0)
+        throw std::runtime_error("unable to stat: " + filename);
+
+    // FNV-1a of the fields that identify a file, and that change when the
+    // file is replaced or modified.
+
+    auto fields = {
+        static_cast<uint64_t>(buffer.st_dev),
+        static_cast<uint64_t>(buffer.st_ino),
+        static_cast<uint64_t>(buffer.st_size),
+        static_cast<uint64_t>(buffer.st_mtime)
+    };
+
+    auto id = 0xCBF29CE484222325UL;
+
+    for (auto field : fields)
+    {
+        for (auto i = 0; i < 8; i++)
+        {
+            id ^= (field >> (i * 8)) & 0xFF;
+            id *= 0x100000001B3UL;
+        }
+    }
+
+    return id;
+}
+
+char *
+map_image(std::size_t size)
+{
+    auto &&mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        throw std::bad_alloc();
+
+    return static_cast<char *>(mem);
+}
@@ -23,28 +23,40 @@
 #ifdef OS_WINDOWS
 
 #include <windows.h>
+#include <stdint.h>
 
 int
-set_affinity(void)
+set_affinity(uint64_t core)
 {
-    if (SetProcessAffinityMask(GetCurrentProcess(), 1) == 0)
+    if (SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << core) == 0)
         return -1;
 
     return 0;
 }
 
+uint64_t
+num_online_cores(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    return info.dwNumberOfProcessors;
+}
+
 #else
 
 #define _GNU_SOURCE
 #include <sched.h>
+#include <stdint.h>
+#include <unistd.h>
 
 int
-set_affinity(void)
+set_affinity(uint64_t core)
 {
     cpu_set_t  mask;
 
     CPU_ZERO(&mask);
-    CPU_SET(0, &mask);
+    CPU_SET(core, &mask);
 
     if (sched_setaffinity(0, sizeof(mask), &mask) != 0)
         return -1;
@@ -52,4 +64,15 @@ set_affinity(void)
     return 0;
 }
 
+uint64_t
+num_online_cores(void)
+{
+    long num = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (num <= 0)
+        return 1;
+
+    return (uint64_t)num;
+}
+
 #endif
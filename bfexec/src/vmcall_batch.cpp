@@ -0,0 +1,173 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#include <gsl/gsl>
+
+#include <debug.h>
+#include <vmcall_batch.h>
+
+#include <cstring>
+
+#include <sys/mman.h>
+
+vmcall_batch::vmcall_batch(processlistid::type procltid) :
+    m_procltid(procltid),
+    m_is_registered(false)
+{
+    static_assert(sizeof(vmcall_ring_t) <= 0x1000, "vmcall ring must fit in a page");
+
+    auto &&ring = aligned_alloc(0x1000, 0x1000);
+    if (ring == nullptr)
+        throw std::bad_alloc();
+
+    // The ring is registered by physical address, so it has to stay
+    // resident for as long as the VMM might access it.
+
+    if (mlock(ring, 0x1000) != 0)
+    {
+        free(ring);
+        throw std::runtime_error("mlock failed: vmcall ring");
+    }
+
+    m_ring.reset(static_cast<vmcall_ring_t *>(memset(ring, 0, 0x1000)));
+}
+
+void
+vmcall_batch::vm_map_foreign_lookup(
+    processid::type processid, uintptr_t virt, uintptr_t addr, uintptr_t size, uintptr_t perm)
+{
+    vmcall_registers_t regs = {};
+
+    regs.r02 = hyperkernel_vmcall__vm_map_lookup;
+    regs.r03 = m_procltid;
+    regs.r04 = processid;
+    regs.r05 = virt;
+    regs.r06 = addr;
+    regs.r07 = size;
+    regs.r08 = perm;
+
+    this->push(regs);
+}
+
+void
+vmcall_batch::vm_reserve_foreign(
+    processid::type processid, uintptr_t virt, uintptr_t addr, uintptr_t size, uintptr_t perm)
+{
+    vmcall_registers_t regs = {};
+
+    regs.r02 = hyperkernel_vmcall__vm_reserve;
+    regs.r03 = m_procltid;
+    regs.r04 = processid;
+    regs.r05 = virt;
+    regs.r06 = addr;
+    regs.r07 = size;
+    regs.r08 = perm;
+
+    this->push(regs);
+}
+
+void
+vmcall_batch::vm_map_foreign_segment(
+    processid::type processid, uintptr_t virt, uintptr_t addr, uintptr_t size,
+    uint64_t file_id, uint64_t file_offset)
+{
+    vmcall_registers_t regs = {};
+
+    regs.r02 = hyperkernel_vmcall__vm_map_segment;
+    regs.r03 = m_procltid;
+    regs.r04 = processid;
+    regs.r05 = virt;
+    regs.r06 = addr;
+    regs.r07 = size;
+    regs.r08 = file_id;
+    regs.r09 = file_offset;
+
+    this->push(regs);
+}
+
+void
+vmcall_batch::set_thread_foreign_info(
+    processid::type processid, threadid::type threadid,
+    uintptr_t entry, uintptr_t stack, uintptr_t arg1, uintptr_t arg2)
+{
+    vmcall_registers_t regs = {};
+
+    regs.r02 = hyperkernel_vmcall__set_thread_info;
+    regs.r03 = m_procltid;
+    regs.r04 = processid;
+    regs.r05 = threadid;
+    regs.r06 = entry;
+    regs.r07 = stack;
+    regs.r08 = arg1;
+    regs.r09 = arg2;
+
+    this->push(regs);
+}
+
+void
+vmcall_batch::push(const vmcall_registers_t &regs)
+{
+    if (m_ring->head - m_ring->tail == VMCALL_RING_ENTRIES)
+        this->flush();
+
+    auto &&index = gsl::narrow_cast<std::ptrdiff_t>(m_ring->head % VMCALL_RING_ENTRIES);
+
+    gsl::at(m_ring->entries, index) = regs;
+    m_ring->head++;
+}
+
+void
+vmcall_batch::flush()
+{
+    // The VMM advances the tail as it executes each request, so the range
+    // of requests to check has to be copied before ringing the doorbell.
+
+    auto tail = m_ring->tail;
+    auto head = m_ring->head;
+
+    if (head == tail)
+        return;
+
+    if (!m_is_registered)
+    {
+        if (!vmcall__register_vmcall_ring(m_procltid, reinterpret_cast<uintptr_t>(m_ring.get())))
+            throw std::runtime_error("vmcall__register_vmcall_ring failed");
+
+        m_is_registered = true;
+    }
+
+    if (!vmcall__vmcall_ring_doorbell(m_procltid))
+        throw std::runtime_error("vmcall__vmcall_ring_doorbell failed");
+
+    for (auto i = tail; i != head; i++)
+    {
+        auto &&index = gsl::narrow_cast<std::ptrdiff_t>(i % VMCALL_RING_ENTRIES);
+        const auto &entry = gsl::at(m_ring->entries, index);
+
+        if (entry.r01 != REG_SUCCESS)
+            throw std::runtime_error("batched vmcall failed: " + std::to_string(entry.r02));
+    }
+}
+
+void
+vmcall_batch::clear()
+{ m_ring->head = m_ring->tail; }
@@ -38,7 +38,7 @@ CROSS_CXXFLAGS+=-fno-threadsafe-statics
 CROSS_ASMFLAGS+=
 CROSS_LDFLAGS+=
 CROSS_ARFLAGS+=
-CROSS_DEFINES+=
+CROSS_DEFINES+=LOOKUP_TLS_DATA
 
 ################################################################################
 # Output
@@ -56,6 +56,8 @@ POST_COMMAND:=if [[ -d %BUILD_ABS%/sysroot_vmapp/x86_64-vmapp-elf/include/ ]]; t
 SOURCES+=pthread.cpp
 
 INCLUDE_PATHS+=../include/
+INCLUDE_PATHS+=../../include/
+INCLUDE_PATHS+=%HYPER_ABS%/include/
 
 LIBS+=
 
@@ -22,12 +22,29 @@
 #include <pthread.h>
 
 #include <errno.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdint.h>
 
+#include <constants.h>
+#include <vmcall_hyperkernel_interface.h>
+
 #define MAX_THREAD_SPECIFIC_DATA 512
 
+#define TCB_JOINABLE 0
+#define TCB_DETACHED 1
+#define TCB_EXITED 2
+
+#define MUTEX_UNLOCKED 0
+#define MUTEX_LOCKED 1
+#define MUTEX_CONTENDED 2
+
+#define RWLOCK_WRITER (1LL << 62)
+#define RWLOCK_WAITERS (1LL << 61)
+
+#define SPIN_COUNT 128
+
 extern "C" uint64_t thread_context_cpuid(void);
 extern "C" uint64_t thread_context_tlsptr(void);
 
@@ -55,6 +72,165 @@ extern "C" uint64_t thread_context_tlsptr(void);
 void *threadSpecificData[MAX_THREAD_SPECIFIC_DATA] = {0};
 #endif
 
+// -----------------------------------------------------------------------------
+// Thread Control Blocks
+// -----------------------------------------------------------------------------
+
+//
+// Each thread owns a STACK_SIZE aligned stack, with a thread context stored
+// at the top of the stack (just like the VMM). This allows any thread to
+// find its TCB (and TLS) from its stack pointer. The main thread's stack is
+// set up by bfexec, which zeros the stack, so the main thread's context is
+// filled in the first time it is needed.
+//
+
+struct pthread_tcb
+{
+    void *(*start_routine)(void *);
+    void *arg;
+    void *retval;
+
+    uint64_t threadid;
+    int64_t state;
+    char *stack;
+
+    pthread_tcb *next;
+    void *tls[MAX_THREAD_SPECIFIC_DATA];
+};
+
+struct thread_context
+{
+    uint64_t cpuid;
+    uint64_t tlsptr;
+    pthread_tcb *tcb;
+};
+
+static pthread_tcb g_main_tcb = {};
+static pthread_tcb *g_zombies = nullptr;
+
+// The number of threads, other than the main thread, that have been
+// created and have not exited yet (see pthread_exit).
+
+static int64_t g_num_threads = 0;
+
+static thread_context *
+get_thread_context()
+{
+    uintptr_t rsp = 0;
+    __asm__ volatile("mov %%rsp, %0" : "=r"(rsp));
+
+    auto &&top = (rsp & ~(STACK_SIZE - 1)) + STACK_SIZE;
+    return reinterpret_cast<thread_context *>(top - sizeof(thread_context));
+}
+
+static pthread_tcb *
+get_tcb()
+{
+    auto &&tc = get_thread_context();
+
+    if (tc->tcb == nullptr)
+    {
+        tc->tcb = &g_main_tcb;
+        tc->tlsptr = reinterpret_cast<uint64_t>(g_main_tcb.tls);
+    }
+
+    return tc->tcb;
+}
+
+static void
+free_tcb(pthread_tcb *tcb)
+{
+    free(tcb->stack);
+    free(tcb);
+}
+
+static void
+push_zombie(pthread_tcb *tcb)
+{
+    do
+        tcb->next = g_zombies;
+    while (!__sync_bool_compare_and_swap(&g_zombies, tcb->next, tcb));
+}
+
+static void
+reap_zombies()
+{
+    auto &&tcb = __sync_lock_test_and_set(&g_zombies, nullptr);
+
+    while (tcb != nullptr)
+    {
+        auto &&next = tcb->next;
+
+        // A detached thread places itself on the zombie list before it
+        // exits, so its stack cannot be freed until the VMM says the thread
+        // is gone. The creator might also still be storing the thread's id.
+
+        while (__atomic_load_n(&tcb->threadid, __ATOMIC_ACQUIRE) == REG_INVALID)
+            vmcall__sched_yield();
+
+        vmcall__thread_join(tcb->threadid, nullptr);
+        free_tcb(tcb);
+
+        tcb = next;
+    }
+}
+
+extern "C" void
+pthread_start(pthread_tcb *tcb)
+{ pthread_exit(tcb->start_routine(tcb->arg)); }
+
+// -----------------------------------------------------------------------------
+// Futex Helpers
+// -----------------------------------------------------------------------------
+
+//
+// The mutex, condition variable and rwlock spin for a short time (as most
+// critical sections are short), and then block in the VMM using the futex
+// vmcalls, which deschedules the thread until another thread wakes it.
+//
+
+static void
+cpu_relax()
+{ __asm__ volatile("pause"); }
+
+static void
+futex_wait(int64_t *addr, int64_t expected)
+{ vmcall__futex_wait(reinterpret_cast<uint64_t>(addr), static_cast<uint64_t>(expected)); }
+
+static void
+futex_wake(int64_t *addr, uint64_t num)
+{ vmcall__futex_wake(reinterpret_cast<uint64_t>(addr), num); }
+
+static void
+mutex_lock_contended(pthread_mutex_t *mutex)
+{
+    while (__sync_lock_test_and_set(mutex, MUTEX_CONTENDED) != MUTEX_UNLOCKED)
+        futex_wait(mutex, MUTEX_CONTENDED);
+}
+
+static void
+rwlock_wait(pthread_rwlock_t *rwlock, int64_t value)
+{
+    if ((value & RWLOCK_WAITERS) == 0)
+    {
+        if (!__sync_bool_compare_and_swap(rwlock, value, value | RWLOCK_WAITERS))
+            return;
+    }
+
+    futex_wait(rwlock, value | RWLOCK_WAITERS);
+}
+
+extern "C" uint64_t
+thread_context_tlsptr(void)
+{
+    get_tcb();
+    return get_thread_context()->tlsptr;
+}
+
+// -----------------------------------------------------------------------------
+// Implementation
+// -----------------------------------------------------------------------------
+
 extern "C" int
 pthread_attr_destroy(pthread_attr_t *)
 {
@@ -206,16 +382,19 @@ pthread_cond_broadcast(pthread_cond_t *cond)
     if (!cond)
         return -EINVAL;
 
-    __sync_lock_release(cond);
+    __sync_fetch_and_add(cond, 1);
+    futex_wake(cond, UINT64_MAX);
 
     return 0;
 }
 
 extern "C" int
-pthread_cond_destroy(pthread_cond_t *)
+pthread_cond_destroy(pthread_cond_t *cond)
 {
-    UNHANDLED();
-    return -ENOSYS;
+    if (!cond)
+        return -EINVAL;
+
+    return 0;
 }
 
 extern "C" int
@@ -232,10 +411,15 @@ pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr)
 }
 
 extern "C" int
-pthread_cond_signal(pthread_cond_t *)
+pthread_cond_signal(pthread_cond_t *cond)
 {
-    UNHANDLED();
-    return -ENOSYS;
+    if (!cond)
+        return -EINVAL;
+
+    __sync_fetch_and_add(cond, 1);
+    futex_wake(cond, 1);
+
+    return 0;
 }
 
 extern "C" int
@@ -251,12 +435,24 @@ pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
     if (!cond || !mutex)
         return -EINVAL;
 
-    *cond = 1;
+    auto &&seq = __atomic_load_n(cond, __ATOMIC_ACQUIRE);
 
     pthread_mutex_unlock(mutex);
-    while (__sync_lock_test_and_set(cond, 1)) { while (*cond); };
-    pthread_mutex_lock(mutex);
 
+    for (auto i = 0; i < SPIN_COUNT && __atomic_load_n(cond, __ATOMIC_ACQUIRE) == seq; i++)
+        cpu_relax();
+
+    // If the sequence changed after it was read, the futex does not block,
+    // which is what prevents a signal from being lost between unlocking the
+    // mutex and blocking. Spurious wakeups are allowed by POSIX.
+
+    if (__atomic_load_n(cond, __ATOMIC_ACQUIRE) == seq)
+        futex_wait(cond, seq);
+
+    // Other waiters might have been woken at the same time, so the mutex is
+    // taken as contended to make sure they are woken when it is released.
+
+    mutex_lock_contended(mutex);
     return 0;
 }
 
@@ -289,30 +485,126 @@ pthread_condattr_setpshared(pthread_condattr_t *, int)
 }
 
 extern "C" int
-pthread_create(pthread_t *, const pthread_attr_t *, void *(*)(void *), void *)
+pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*start_routine)(void *), void *arg)
 {
-    UNHANDLED();
-    return -ENOSYS;
+    if (attr)
+        ARG_UNSUPPORTED("attr");
+
+    if (!thread || !start_routine)
+        return -EINVAL;
+
+    reap_zombies();
+
+    auto &&tcb = static_cast<pthread_tcb *>(calloc(1, sizeof(pthread_tcb)));
+    if (!tcb)
+        return -EAGAIN;
+
+    tcb->stack = static_cast<char *>(malloc(STACK_SIZE * 2));
+    if (!tcb->stack)
+    {
+        free(tcb);
+        return -EAGAIN;
+    }
+
+    auto &&stack_int = reinterpret_cast<uintptr_t>(tcb->stack);
+    auto &&top = ((stack_int + STACK_SIZE - 1) & ~(STACK_SIZE - 1)) + STACK_SIZE;
+
+    auto &&tc = reinterpret_cast<thread_context *>(top - sizeof(thread_context));
+    tc->cpuid = 0;
+    tc->tlsptr = reinterpret_cast<uint64_t>(tcb->tls);
+    tc->tcb = tcb;
+
+    tcb->start_routine = start_routine;
+    tcb->arg = arg;
+    tcb->threadid = REG_INVALID;
+
+    *thread = reinterpret_cast<pthread_t>(tcb);
+
+    __sync_fetch_and_add(&g_num_threads, 1);
+
+    // The stack pointer starts below the page that holds the thread
+    // context (just like the main thread), and is offset so that the
+    // entry point sees the same alignment as a function that was called.
+
+    auto &&threadid = vmcall__create_thread(
+                          reinterpret_cast<uint64_t>(pthread_start),
+                          top - 0x1000 - sizeof(uint64_t),
+                          reinterpret_cast<uint64_t>(tcb),
+                          0);
+
+    if (threadid == REG_INVALID)
+    {
+        __sync_fetch_and_sub(&g_num_threads, 1);
+
+        free_tcb(tcb);
+        return -EAGAIN;
+    }
+
+    __atomic_store_n(&tcb->threadid, threadid, __ATOMIC_RELEASE);
+    return 0;
 }
 
 extern "C" int
-pthread_detach(pthread_t)
+pthread_detach(pthread_t thread)
 {
-    UNHANDLED();
-    return -ENOSYS;
+    auto &&tcb = reinterpret_cast<pthread_tcb *>(thread);
+
+    if (!tcb || tcb == &g_main_tcb)
+        return -EINVAL;
+
+    switch (__sync_val_compare_and_swap(&tcb->state, TCB_JOINABLE, TCB_DETACHED))
+    {
+        case TCB_JOINABLE:
+            return 0;
+
+        case TCB_EXITED:
+            push_zombie(tcb);
+            return 0;
+
+        default:
+            return -EINVAL;
+    }
 }
 
 extern "C" int
-pthread_equal(pthread_t, pthread_t)
+pthread_equal(pthread_t t1, pthread_t t2)
 {
-    UNHANDLED();
-    return -ENOSYS;
+    return t1 == t2 ? 1 : 0;
 }
 
 extern "C" void
-pthread_exit(void *)
+pthread_exit(void *retval)
 {
-    UNHANDLED();
+    auto &&tcb = get_tcb();
+
+    // The process keeps running until its last thread exits, so the main
+    // thread waits for the others, and then exits the process with a
+    // status of 0. The main thread cannot be joined, so its retval is
+    // never seen.
+
+    if (tcb == &g_main_tcb)
+    {
+        auto num = __atomic_load_n(&g_num_threads, __ATOMIC_ACQUIRE);
+
+        while (num != 0)
+        {
+            futex_wait(&g_num_threads, num);
+            num = __atomic_load_n(&g_num_threads, __ATOMIC_ACQUIRE);
+        }
+
+        exit(0);
+    }
+
+    tcb->retval = retval;
+
+    if (!__sync_bool_compare_and_swap(&tcb->state, TCB_JOINABLE, TCB_EXITED))
+        push_zombie(tcb);
+
+    if (__sync_sub_and_fetch(&g_num_threads, 1) == 0)
+        futex_wake(&g_num_threads, 1);
+
+    vmcall__thread_exit(reinterpret_cast<uint64_t>(retval));
+    while (1);
 }
 
 extern "C" int
@@ -343,10 +635,24 @@ pthread_getspecific(pthread_key_t key)
 }
 
 extern "C" int
-pthread_join(pthread_t, void **)
+pthread_join(pthread_t thread, void **retval)
 {
-    UNHANDLED();
-    return -ENOSYS;
+    auto &&tcb = reinterpret_cast<pthread_tcb *>(thread);
+
+    if (!tcb || tcb == &g_main_tcb)
+        return -EINVAL;
+
+    if (tcb == get_tcb())
+        return -EDEADLK;
+
+    if (!vmcall__thread_join(tcb->threadid, nullptr))
+        return -EINVAL;
+
+    if (retval)
+        *retval = tcb->retval;
+
+    free_tcb(tcb);
+    return 0;
 }
 
 extern "C" int
@@ -379,10 +685,15 @@ pthread_key_delete(pthread_key_t)
 }
 
 extern "C" int
-pthread_mutex_destroy(pthread_mutex_t *)
+pthread_mutex_destroy(pthread_mutex_t *mutex)
 {
-    UNHANDLED();
-    return -ENOSYS;
+    if (!mutex)
+        return -EINVAL;
+
+    if (__atomic_load_n(mutex, __ATOMIC_ACQUIRE) != MUTEX_UNLOCKED)
+        return -EBUSY;
+
+    return 0;
 }
 
 extern "C" int
@@ -411,8 +722,25 @@ pthread_mutex_lock(pthread_mutex_t *mutex)
     if (!mutex)
         return -EINVAL;
 
-    while (__sync_lock_test_and_set(mutex, 1)) { while (*mutex); };
+    for (auto i = 0; i < SPIN_COUNT; i++)
+    {
+        auto &&value = __atomic_load_n(mutex, __ATOMIC_RELAXED);
+
+        if (value == MUTEX_UNLOCKED)
+        {
+            if (__sync_bool_compare_and_swap(mutex, MUTEX_UNLOCKED, MUTEX_LOCKED))
+                return 0;
+
+            continue;
+        }
 
+        if (value == MUTEX_CONTENDED)
+            break;
+
+        cpu_relax();
+    }
+
+    mutex_lock_contended(mutex);
     return 0;
 }
 
@@ -424,10 +752,15 @@ pthread_mutex_setprioceiling(pthread_mutex_t *, int, int *)
 }
 
 extern "C" int
-pthread_mutex_trylock(pthread_mutex_t *)
+pthread_mutex_trylock(pthread_mutex_t *mutex)
 {
-    UNHANDLED();
-    return -ENOSYS;
+    if (!mutex)
+        return -EINVAL;
+
+    if (!__sync_bool_compare_and_swap(mutex, MUTEX_UNLOCKED, MUTEX_LOCKED))
+        return -EBUSY;
+
+    return 0;
 }
 
 extern "C" int
@@ -436,7 +769,11 @@ pthread_mutex_unlock(pthread_mutex_t *mutex)
     if (!mutex)
         return -EINVAL;
 
-    __sync_lock_release(mutex);
+    if (__sync_fetch_and_sub(mutex, 1) != MUTEX_LOCKED)
+    {
+        __atomic_store_n(mutex, MUTEX_UNLOCKED, __ATOMIC_RELEASE);
+        futex_wake(mutex, 1);
+    }
 
     return 0;
 }
@@ -524,52 +861,147 @@ pthread_once(pthread_once_t *once, void (*init)(void))
 }
 
 extern "C" int
-pthread_rwlock_destroy(pthread_rwlock_t *)
+pthread_rwlock_destroy(pthread_rwlock_t *rwlock)
 {
-    UNHANDLED();
-    return -ENOSYS;
+    if (!rwlock)
+        return -EINVAL;
+
+    if (__atomic_load_n(rwlock, __ATOMIC_ACQUIRE) != 0)
+        return -EBUSY;
+
+    return 0;
 }
 
 extern "C" int
-pthread_rwlock_init(pthread_rwlock_t *, const pthread_rwlockattr_t *)
+pthread_rwlock_init(pthread_rwlock_t *rwlock, const pthread_rwlockattr_t *attr)
 {
-    UNHANDLED();
-    return -ENOSYS;
+    if (attr)
+        ARG_UNSUPPORTED("attr");
+
+    if (!rwlock)
+        return -EINVAL;
+
+    *rwlock = 0;
+    return 0;
 }
 
+//
+// The rwlock holds the number of readers in its lower bits, and a bit for
+// the writer. Threads that block set the waiters bit, which tells the last
+// thread to release the lock that it has to wake them up.
+//
+
 extern "C" int
-pthread_rwlock_rdlock(pthread_rwlock_t *)
+pthread_rwlock_rdlock(pthread_rwlock_t *rwlock)
 {
-    UNHANDLED();
-    return -ENOSYS;
+    if (!rwlock)
+        return -EINVAL;
+
+    for (auto i = 0; ; i++)
+    {
+        auto &&value = __atomic_load_n(rwlock, __ATOMIC_RELAXED);
+
+        if ((value & RWLOCK_WRITER) == 0)
+        {
+            if (__sync_bool_compare_and_swap(rwlock, value, value + 1))
+                return 0;
+
+            continue;
+        }
+
+        if (i < SPIN_COUNT)
+        {
+            cpu_relax();
+            continue;
+        }
+
+        rwlock_wait(rwlock, value);
+    }
 }
 
 extern "C" int
-pthread_rwlock_tryrdlock(pthread_rwlock_t *)
+pthread_rwlock_tryrdlock(pthread_rwlock_t *rwlock)
 {
-    UNHANDLED();
-    return -ENOSYS;
+    if (!rwlock)
+        return -EINVAL;
+
+    auto &&value = __atomic_load_n(rwlock, __ATOMIC_RELAXED);
+
+    if ((value & RWLOCK_WRITER) != 0)
+        return -EBUSY;
+
+    if (!__sync_bool_compare_and_swap(rwlock, value, value + 1))
+        return -EBUSY;
+
+    return 0;
 }
 
 extern "C" int
-pthread_rwlock_trywrlock(pthread_rwlock_t *)
+pthread_rwlock_trywrlock(pthread_rwlock_t *rwlock)
 {
-    UNHANDLED();
-    return -ENOSYS;
+    if (!rwlock)
+        return -EINVAL;
+
+    auto &&value = __atomic_load_n(rwlock, __ATOMIC_RELAXED);
+
+    if ((value & ~RWLOCK_WAITERS) != 0)
+        return -EBUSY;
+
+    if (!__sync_bool_compare_and_swap(rwlock, value, value | RWLOCK_WRITER))
+        return -EBUSY;
+
+    return 0;
 }
 
 extern "C" int
-pthread_rwlock_unlock(pthread_rwlock_t *)
+pthread_rwlock_unlock(pthread_rwlock_t *rwlock)
 {
-    UNHANDLED();
-    return -ENOSYS;
+    if (!rwlock)
+        return -EINVAL;
+
+    if ((__atomic_load_n(rwlock, __ATOMIC_RELAXED) & RWLOCK_WRITER) != 0)
+    {
+        if ((__sync_lock_test_and_set(rwlock, 0) & RWLOCK_WAITERS) != 0)
+            futex_wake(rwlock, UINT64_MAX);
+
+        return 0;
+    }
+
+    if (__sync_sub_and_fetch(rwlock, 1) == RWLOCK_WAITERS)
+    {
+        if (__sync_bool_compare_and_swap(rwlock, RWLOCK_WAITERS, 0))
+            futex_wake(rwlock, UINT64_MAX);
+    }
+
+    return 0;
 }
 
 extern "C" int
-pthread_rwlock_wrlock(pthread_rwlock_t *)
+pthread_rwlock_wrlock(pthread_rwlock_t *rwlock)
 {
-    UNHANDLED();
-    return -ENOSYS;
+    if (!rwlock)
+        return -EINVAL;
+
+    for (auto i = 0; ; i++)
+    {
+        auto &&value = __atomic_load_n(rwlock, __ATOMIC_RELAXED);
+
+        if ((value & ~RWLOCK_WAITERS) == 0)
+        {
+            if (__sync_bool_compare_and_swap(rwlock, value, value | RWLOCK_WRITER))
+                return 0;
+
+            continue;
+        }
+
+        if (i < SPIN_COUNT)
+        {
+            cpu_relax();
+            continue;
+        }
+
+        rwlock_wait(rwlock, value);
+    }
 }
 
 extern "C" int
@@ -603,8 +1035,7 @@ pthread_rwlockattr_setpshared(pthread_rwlockattr_t *, int)
 extern "C" pthread_t
 pthread_self(void)
 {
-    UNHANDLED();
-    return 1;
+    return reinterpret_cast<pthread_t>(get_tcb());
 }
 
 extern "C" int
@@ -23,6 +23,29 @@
 #ifndef SYSCALL_H
 #define SYSCALL_H
 
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifndef PROT_NONE
+#define PROT_NONE 0x0
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC 0x4
+#endif
+
+#ifndef MAP_FAILED
+#define MAP_SHARED 0x01
+#define MAP_PRIVATE 0x02
+#define MAP_FIXED 0x10
+#define MAP_ANONYMOUS 0x20
+#define MAP_ANON MAP_ANONYMOUS
+#define MAP_FAILED ((void *) -1)
+#endif
+
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0x8000
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -30,6 +53,21 @@ extern "C" {
 int
 set_program_break(uint64_t program_break);
 
+/*
+ * Only private, anonymous maps are supported. The address is a hint
+ * unless MAP_FIXED is given, in which case the map fails if the range is
+ * already in use. Pages are allocated when they are first touched,
+ * unless MAP_POPULATE is given.
+ */
+void *
+mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+
+int
+munmap(void *addr, size_t length);
+
+int
+mprotect(void *addr, size_t length, int prot);
+
 #ifdef __cplusplus
 }
 #endif
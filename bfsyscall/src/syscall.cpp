@@ -46,6 +46,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <malloc.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -53,7 +54,10 @@
 #include <sys/times.h>
 #include <regex.h>
 
+#include <atomic>
+
 #include <crt.h>
+#include <syscall.h>
 #include <constants.h>
 #include <eh_frame_list.h>
 
@@ -76,6 +80,34 @@ extern "C" void vmcall_event(struct vmcall_registers_t *regs);
 typedef void (*init_t)();
 typedef void (*fini_t)();
 
+// Output is written to a ring shared with the VMM, and handed to ttys0 a
+// line (or a full ring) at a time, instead of using a vmcall per byte.
+
+alignas(0x1000) struct ttys_ring_t g_ttys_ring = {};
+std::atomic_flag g_ttys_lock = ATOMIC_FLAG_INIT;
+
+static void
+ttys_flush_locked() noexcept
+{
+    if (g_ttys_ring.head == g_ttys_ring.tail)
+        return;
+
+    // If the flush fails, the output is dropped, as there is nothing else
+    // that can be done with it, and the ring would otherwise stay full.
+
+    if (!vmcall__ttys0_flush(reinterpret_cast<uintptr_t>(&g_ttys_ring)))
+        g_ttys_ring.tail = g_ttys_ring.head;
+}
+
+static void
+ttys_flush() noexcept
+{
+    while (g_ttys_lock.test_and_set(std::memory_order_acquire));
+
+    ttys_flush_locked();
+    g_ttys_lock.clear(std::memory_order_release);
+}
+
 extern "C" clock_t
 times(struct tms *buf)
 {
@@ -185,10 +217,20 @@ unlink(const char *file)
 extern "C" pid_t
 fork(void)
 {
-    UNHANDLED();
+    // Anything still buffered is written once, instead of once by the
+    // parent and again by the child.
 
-    errno = -ENOSYS;
-    return -1;
+    ttys_flush();
+
+    auto id = vmcall__fork();
+
+    if (id == REG_INVALID)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return static_cast<pid_t>(id);
 }
 
 extern "C" int
@@ -275,6 +317,8 @@ _exit(int status)
 {
     (void) status;
 
+    ttys_flush();
+
     vmcall__sched_yield_and_remove();
     while (1);
 }
@@ -326,13 +370,16 @@ mkdir(const char *path, mode_t mode)
 extern "C" int
 posix_memalign(void **memptr, size_t alignment, size_t size)
 {
-    (void) memptr;
-    (void) alignment;
-    (void) size;
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0 || (alignment % sizeof(void *)) != 0)
+        return EINVAL;
 
-    UNHANDLED();
+    if (auto ptr = memalign(alignment, size))
+    {
+        *memptr = ptr;
+        return 0;
+    }
 
-    return 0;
+    return ENOMEM;
 }
 
 extern "C" int
@@ -439,16 +486,25 @@ write(int file, const void *buffer, size_t count)
     if (buffer == nullptr || count == 0)
         return 0;
 
-    try
+    auto bytes = static_cast<const char *>(buffer);
+    auto newline = false;
+
+    while (g_ttys_lock.test_and_set(std::memory_order_acquire));
+
+    for (auto i = 0UL; i < count; i++)
     {
-        for (auto i = 0UL; i < count; i++)
-            vmcall__ttys0(static_cast<const char *>(buffer)[i]);
+        if (g_ttys_ring.head - g_ttys_ring.tail == TTYS_RING_SIZE)
+            ttys_flush_locked();
 
-        return static_cast<int>(count);
+        g_ttys_ring.data[g_ttys_ring.head++ % TTYS_RING_SIZE] = bytes[i];
+        newline |= bytes[i] == '\n';
     }
-    catch (...) { }
 
-    return 0;
+    if (newline)
+        ttys_flush_locked();
+
+    g_ttys_lock.clear(std::memory_order_release);
+    return static_cast<int>(count);
 }
 
 extern "C" int
@@ -471,12 +527,17 @@ __stack_chk_fail(void) noexcept
     abort();
 }
 
+uintptr_t g_program_base = 0;
 uintptr_t g_program_break = 0;
 uintptr_t g_program_cursor = 0;
 
+constexpr const auto sbrk_min_pages = 0x10UL;
+constexpr const auto sbrk_max_pages = 0x4000UL;
+
 extern "C" int
 set_program_break(uint64_t program_break)
 {
+    g_program_base = program_break;
     g_program_break = program_break;
     g_program_cursor = program_break;
 
@@ -489,20 +550,101 @@ set_program_break(uint64_t program_break)
 extern "C" void *
 sbrk(ptrdiff_t inc)
 {
-    g_program_cursor += static_cast<uintptr_t>(inc);
+    auto cursor = g_program_cursor + static_cast<uintptr_t>(inc);
 
-    while (g_program_break < g_program_cursor)
+    if (g_program_break < cursor)
     {
-        if (!vmcall__increase_program_break())
+        // The heap grows by at least its current size (within limits), so
+        // a growing heap only needs a logarithmic number of vmcalls. If
+        // the larger request cannot be met, only what is needed is asked
+        // for.
+
+        auto needed = (cursor - g_program_break + 0xFFF) >> 12;
+        auto num_pages = (g_program_break - g_program_base) >> 12;
+
+        if (num_pages < sbrk_min_pages)
+            num_pages = sbrk_min_pages;
+
+        if (num_pages > sbrk_max_pages)
+            num_pages = sbrk_max_pages;
+
+        if (num_pages < needed)
+            num_pages = needed;
+
+        if (!vmcall__increase_program_break(num_pages))
         {
-            errno = ENOMEM;
-            return reinterpret_cast<void *>(-1);
+            num_pages = needed;
+
+            if (!vmcall__increase_program_break(num_pages))
+            {
+                errno = ENOMEM;
+                return reinterpret_cast<void *>(-1);
+            }
         }
 
-        g_program_break += 0x1000;
+        g_program_break += num_pages << 12;
+    }
+
+    auto prev = g_program_cursor;
+    g_program_cursor = cursor;
+
+    return reinterpret_cast<void *>(prev);
+}
+
+extern "C" void *
+mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+    (void) offset;
+
+    if (length == 0 || fd != -1 || (flags & MAP_ANONYMOUS) == 0 || (flags & MAP_SHARED) != 0)
+    {
+        errno = EINVAL;
+        return MAP_FAILED;
+    }
+
+    auto hint = reinterpret_cast<uintptr_t>(addr);
+    auto lazy = (flags & MAP_POPULATE) != 0 ? 0U : 1U;
+    auto virt = vmcall__mmap(hint, length, static_cast<uint64_t>(prot), lazy);
+
+    if (virt == REG_INVALID)
+    {
+        errno = ENOMEM;
+        return MAP_FAILED;
+    }
+
+    if ((flags & MAP_FIXED) != 0 && virt != hint)
+    {
+        vmcall__munmap(virt, length);
+
+        errno = ENOMEM;
+        return MAP_FAILED;
+    }
+
+    return reinterpret_cast<void *>(virt);
+}
+
+extern "C" int
+munmap(void *addr, size_t length)
+{
+    if (!vmcall__munmap(reinterpret_cast<uintptr_t>(addr), length))
+    {
+        errno = EINVAL;
+        return -1;
     }
 
-    return reinterpret_cast<void *>(g_program_cursor - static_cast<uintptr_t>(inc));
+    return 0;
+}
+
+extern "C" int
+mprotect(void *addr, size_t length, int prot)
+{
+    if (!vmcall__mprotect(reinterpret_cast<uintptr_t>(addr), length, static_cast<uint64_t>(prot)))
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    return 0;
 }
 
 extern "C" int64_t
@@ -31,6 +31,9 @@
 #include <domainid.h>
 #include <user_data.h>
 
+#include <domain/page_pool.h>
+#include <domain/segment_cache.h>
+
 class domain : public user_data
 {
 public:
@@ -91,11 +94,34 @@ public:
     virtual bool is_initialized()
     { return m_is_initialized; }
 
+    /// Page Pool
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the pool of pages shared by the domain's processes
+    ///
+    virtual gsl::not_null<page_pool *> pool()
+    { return m_page_pool.get(); }
+
+    /// Segment Cache
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the read-only ELF segments shared by the domain's processes
+    ///
+    virtual gsl::not_null<segment_cache *> segments()
+    { return m_segment_cache.get(); }
+
 private:
 
     domainid::type m_id;
     bool m_is_initialized;
 
+    std::unique_ptr<page_pool> m_page_pool;
+    std::unique_ptr<segment_cache> m_segment_cache;
+
 public:
 
     friend class hyperkernel_ut;
@@ -22,11 +22,11 @@
 #ifndef DOMAIN_MANAGER_H
 #define DOMAIN_MANAGER_H
 
-#include <map>
 #include <memory>
 
 #include <domainid.h>
 #include <user_data.h>
+#include <object_table.h>
 #include <domain/domain_factory.h>
 
 class domain_manager
@@ -85,14 +85,11 @@ public:
 private:
 
     domain_manager() noexcept;
-    std::unique_ptr<domain> &__add_domain(domainid::type domainid, user_data *data);
-    std::unique_ptr<domain> &__get_domain(domainid::type domainid);
+    domain *__add_domain(domainid::type domainid, user_data *data);
 
 private:
 
-    mutable std::mutex m_domian_mutex;
-    domainid::type m_domian_next_id;
-    std::map<domainid::type, std::unique_ptr<domain>> m_domains;
+    object_table<domain, domainid::type> m_domains;
 
 private:
 
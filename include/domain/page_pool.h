@@ -0,0 +1,184 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef PAGE_POOL_H
+#define PAGE_POOL_H
+
+#include <map>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+/// Page Pool
+///
+/// A slab style allocator for the 4k pages that back a domain's processes.
+/// Pages are taken from the VMM's heap 2m at a time, and freed pages are
+/// kept for reuse by any process in the domain instead of being handed
+/// back to the VMM's heap one page at a time.
+///
+/// Each core has its own cache of free pages. A cache that runs dry is
+/// refilled to the low watermark from the pool's free pages, and a cache
+/// that grows past the high watermark is drained back down to the low
+/// watermark. A 2m chunk is only returned to the VMM's heap once all of
+/// its pages are free and the pool has another chunk's worth of free pages
+/// in reserve.
+///
+class page_pool
+{
+public:
+
+    using integer_pointer = uintptr_t;
+
+    /// Page Deleter
+    ///
+    /// Returns a page to the pool it was allocated from.
+    ///
+    struct page_deleter
+    {
+        page_pool *pool;
+
+        void operator()(char *page) const noexcept
+        {
+            if (pool != nullptr)
+                pool->free_page(page);
+        }
+    };
+
+    using page_ptr = std::unique_ptr<char[], page_deleter>;
+    using shared_page_ptr = std::shared_ptr<char>;
+
+    /// Constructor
+    ///
+    /// @expects low_watermark <= high_watermark
+    /// @expects high_watermark <= pages_per_chunk
+    /// @ensures none
+    ///
+    /// @param low_watermark the number of pages a core's cache is refilled
+    ///     or drained to
+    /// @param high_watermark the number of pages a core's cache may hold
+    ///     before it is drained
+    ///
+    page_pool(std::size_t low_watermark = 64, std::size_t high_watermark = 256);
+
+    /// Destructor
+    ///
+    /// @expects pages_in_use() == 0
+    /// @ensures none
+    ///
+    ~page_pool() = default;
+
+    /// Allocate Page
+    ///
+    /// @expects none
+    /// @ensures ret != nullptr
+    ///
+    /// @return a zeroed 4k page that is returned to the pool when it is
+    ///     released
+    ///
+    page_ptr alloc_page();
+
+    /// Allocate Shared Page
+    ///
+    /// Same as alloc_page, but the page can be owned by more than one
+    /// process (e.g. after a fork), and is returned to the pool once the
+    /// last owner releases it.
+    ///
+    /// @expects none
+    /// @ensures ret != nullptr
+    ///
+    /// @return a zeroed 4k page
+    ///
+    shared_page_ptr alloc_shared_page();
+
+    /// Pages In Use
+    ///
+    /// @return the number of pages that are currently allocated
+    ///
+    uint64_t pages_in_use() const noexcept
+    { return m_pages_in_use.load(); }
+
+    /// Pages Cached
+    ///
+    /// @return the number of free pages held by the pool (including the
+    ///     per-core caches)
+    ///
+    uint64_t pages_cached() const noexcept
+    { return m_pages_cached.load(); }
+
+    /// Pages Returned
+    ///
+    /// @return the total number of pages the pool has returned to the
+    ///     VMM's heap
+    ///
+    uint64_t pages_returned() const noexcept
+    { return m_pages_returned.load(); }
+
+    static constexpr const auto max_cores = 64UL;
+    static constexpr const auto page_size = 0x1000UL;
+    static constexpr const auto pages_per_chunk = 512UL;
+
+private:
+
+    void free_page(char *page) noexcept;
+
+    void refill(std::vector<char *> &pages);
+    void drain(std::vector<char *> &pages) noexcept;
+
+private:
+
+    struct core_cache
+    {
+        std::mutex mutex;
+        std::vector<char *> pages;
+    };
+
+    struct chunk
+    {
+        std::unique_ptr<char[]> mem;
+        std::vector<char *> free;
+    };
+
+    std::size_t m_low_watermark;
+    std::size_t m_high_watermark;
+
+    std::array<core_cache, max_cores> m_core_caches;
+
+    std::mutex m_chunks_mutex;
+    std::map<integer_pointer, chunk> m_chunks;
+    std::size_t m_num_free;
+
+    std::atomic<uint64_t> m_pages_in_use;
+    std::atomic<uint64_t> m_pages_cached;
+    std::atomic<uint64_t> m_pages_returned;
+
+public:
+
+    page_pool(page_pool &&) = delete;
+    page_pool &operator=(page_pool &&) = delete;
+
+    page_pool(const page_pool &) = delete;
+    page_pool &operator=(const page_pool &) = delete;
+};
+
+#endif
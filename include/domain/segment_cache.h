@@ -0,0 +1,171 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+
+#ifndef SEGMENT_CACHE_H
+#define SEGMENT_CACHE_H
+
+#include <map>
+#include <tuple>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+#include <domain/page_pool.h>
+
+/// Segment Cache
+///
+/// Holds one copy of each read-only ELF segment (text and rodata) that has
+/// been loaded into one of a domain's processes, so that the next process
+/// to load the same segment of the same file maps the cached pages instead
+/// of its own copy. Processes map these pages read / execute, and a write
+/// to one of them is handled like any other copy-on-write page.
+///
+/// Segments are identified by the loader, using a file id that changes
+/// whenever the file does (e.g. a hash of its inode and modification
+/// time), the segment's offset in the file, and the segment's size. The
+/// loader is trusted to report these correctly, which is why only the
+/// host can map cached segments (see vm_map_segment). Cached segments are
+/// kept until the domain is destroyed.
+///
+class segment_cache
+{
+public:
+
+    using integer_pointer = uintptr_t;
+    using page_list = std::vector<page_pool::shared_page_ptr>;
+
+    /// Key
+    ///
+    /// Identifies a segment by the file it comes from, its offset in the
+    /// file, and its size in memory.
+    ///
+    struct key_type
+    {
+        uint64_t file_id;
+        uint64_t file_offset;
+        uint64_t size;
+
+        bool operator<(const key_type &other) const
+        {
+            return std::tie(file_id, file_offset, size) <
+                   std::tie(other.file_id, other.file_offset, other.size);
+        }
+    };
+
+    /// Constructor
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    segment_cache();
+
+    /// Destructor
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    ~segment_cache() = default;
+
+    /// Find
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param key the segment to look up
+    /// @return the pages of the segment, or an empty list if the segment
+    ///     is not cached
+    ///
+    page_list find(const key_type &key);
+
+    /// Insert
+    ///
+    /// Adds a segment to the cache. If another process cached the same
+    /// segment first, that segment's pages are kept instead.
+    ///
+    /// @expects pages is not empty
+    /// @ensures none
+    ///
+    /// @param key the segment to add
+    /// @param pages the pages that hold the segment's contents
+    /// @return the pages of the cached segment
+    ///
+    page_list insert(const key_type &key, page_list pages);
+
+    /// Number of Segments
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the number of segments in the cache
+    ///
+    uint64_t num_segments() const;
+
+    /// Number of Pages
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the number of 4k pages held by the cache
+    ///
+    uint64_t num_pages() const
+    { return m_num_pages.load(); }
+
+    /// Hits
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the number of times find returned a cached segment
+    ///
+    uint64_t hits() const
+    { return m_hits.load(); }
+
+    /// Misses
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the number of times find did not find a segment
+    ///
+    uint64_t misses() const
+    { return m_misses.load(); }
+
+private:
+
+    mutable std::mutex m_mutex;
+    std::map<key_type, page_list> m_segments;
+
+    std::atomic<uint64_t> m_num_pages;
+    std::atomic<uint64_t> m_hits;
+    std::atomic<uint64_t> m_misses;
+
+public:
+
+    friend class hyperkernel_ut;
+
+    segment_cache(segment_cache &&) = delete;
+    segment_cache &operator=(segment_cache &&) = delete;
+
+    segment_cache(const segment_cache &) = delete;
+    segment_cache &operator=(const segment_cache &) = delete;
+};
+
+#endif
@@ -23,6 +23,7 @@
 #define DRIVER_DATA_INTEL_X64_H
 
 #include <user_data.h>
+#include <domain/page_pool.h>
 
 class domain_intel_x64;
 class thread_intel_x64;
@@ -34,6 +35,9 @@ public:
 
     driver_data_intel_x64() noexcept :
         m_entry(0),
+        m_buffer(0),
+        m_buffer_phys(0),
+        m_buffer_page(nullptr),
         m_domain(nullptr),
         m_thread(nullptr),
         m_proclt(nullptr)
@@ -42,6 +46,9 @@ public:
     ~driver_data_intel_x64() override = default;
 
     uintptr_t m_entry;
+    uintptr_t m_buffer;
+    uintptr_t m_buffer_phys;
+    page_pool::shared_page_ptr m_buffer_page;
     domain_intel_x64 *m_domain;
     thread_intel_x64 *m_thread;
     process_list *m_proclt;
@@ -0,0 +1,95 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <cstdint>
+
+/// Epoch
+///
+/// Epoch based reclamation for the objects handed out by the object
+/// tables (see object_table.h). Lookups are made while handling an exit,
+/// so a core enters the current epoch when it starts handling an exit,
+/// and leaves it once it resumes the guest. Pointers that are kept past
+/// the end of an exit (e.g. a vCPU's current thread) are not covered, and
+/// must still be kept alive by whoever deletes the object. An object that
+/// is removed from a table is retired in the epoch it was removed in, and
+/// can only be freed once no core is still in that epoch (or an earlier
+/// one).
+///
+/// Each core has its own slot, so the hyperkernel does not start on a
+/// core past max_cores (see pre_create_vcpu).
+///
+/// Handling an exit does not always return to the exit handler, so a core
+/// may not get to leave its epoch. In that case, the core's epoch is moved
+/// forward the next time it enters, which only delays reclamation.
+///
+class epoch
+{
+public:
+
+    static constexpr const auto max_cores = 64UL;
+
+    /// Enter
+    ///
+    /// Marks the current core as using pointers from the object tables.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    static void enter() noexcept;
+
+    /// Leave
+    ///
+    /// Marks the current core as no longer using pointers from the object
+    /// tables.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    static void leave() noexcept;
+
+    /// Retire
+    ///
+    /// Ends the current epoch. Must be called after an object is removed
+    /// from its table, and before it is freed.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the epoch the object was retired in
+    ///
+    static uint64_t retire() noexcept;
+
+    /// Quiescent
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param retired the epoch returned by retire()
+    /// @return true if no core can still be using an object retired in
+    ///     the provided epoch, false otherwise
+    ///
+    static bool quiescent(uint64_t retired) noexcept;
+};
+
+#endif
@@ -27,12 +27,19 @@
 #include <coreid.h>
 #include <vcpuid.h>
 #include <domainid.h>
+#include <threadid.h>
+#include <processid.h>
+#include <processlistid.h>
 #include <driver_data_intel_x64.h>
 
+#include <exit_handler/exit_stats.h>
+
 #include <vmcs/vmcs_intel_x64_hyperkernel.h>
 #include <exit_handler/exit_handler_intel_x64_eapis.h>
 
+class process;
 class process_list;
+class ipc_endpoint;
 class domain_intel_x64;
 class thread_intel_x64;
 class process_intel_x64;
@@ -114,6 +121,10 @@ protected:
     void handle_exit(intel_x64::vmcs::value_type reason) override;
     void handle_vmcall_registers(vmcall_registers_t &regs) override;
 
+    void handle_preemption_timer();
+    bool handle_ept_violation();
+    void handle_guest_failure();
+
     void create_process_list(vmcall_registers_t &regs);
     void delete_process_list(vmcall_registers_t &regs);
 
@@ -122,23 +133,63 @@ protected:
 
     void create_process(vmcall_registers_t &regs);
     void delete_process(vmcall_registers_t &regs);
+    void fork(vmcall_registers_t &regs);
 
     void vm_map(vmcall_registers_t &regs);
     void vm_map_lookup(vmcall_registers_t &regs);
+    void vm_reserve(vmcall_registers_t &regs);
+    void vm_map_segment(vmcall_registers_t &regs);
 
     void set_thread_info(vmcall_registers_t &regs);
+    void create_thread(vmcall_registers_t &regs);
+    void thread_exit(vmcall_registers_t &regs);
+    void thread_join(vmcall_registers_t &regs);
+
+    void register_vmcall_ring(vmcall_registers_t &regs);
+    void vmcall_ring_doorbell(vmcall_registers_t &regs);
 
     void sched_yield(vmcall_registers_t &regs);
     void sched_yield_and_remove(vmcall_registers_t &regs);
 
+    void futex_wait(vmcall_registers_t &regs);
+    void futex_wake(vmcall_registers_t &regs);
+
     void set_program_break(vmcall_registers_t &regs);
     void increase_program_break(vmcall_registers_t &regs);
     void decrease_program_break(vmcall_registers_t &regs);
 
+    void mmap(vmcall_registers_t &regs);
+    void munmap(vmcall_registers_t &regs);
+    void mprotect(vmcall_registers_t &regs);
+
     void handle_ttys0(vmcall_registers_t &regs);
     void handle_ttys1(vmcall_registers_t &regs);
+    void ttys0_flush(vmcall_registers_t &regs);
+    void ttys1_write(vmcall_registers_t &regs);
     void register_ttys0(vmcall_registers_t &regs);
 
+    void dump_exit_stats(vmcall_registers_t &regs);
+
+    void ipc_create_endpoint(vmcall_registers_t &regs);
+    void ipc_delete_endpoint(vmcall_registers_t &regs);
+    void ipc_call(vmcall_registers_t &regs);
+    void ipc_reply_wait(vmcall_registers_t &regs);
+
+private:
+
+    void dispatch_vmcall(vmcall_registers_t &regs);
+
+    bool copy_to_ttys0(const char *buf, std::size_t len);
+    void run_ttys0(vmcall_registers_t &regs, std::size_t len);
+
+    bool handle_vmcall_ring_entry(vmcall_registers_t &entry);
+
+    void ipc_copy_call(ipc_endpoint *endpoint, processid::type processid, uintptr_t buffer, uint64_t len);
+    void ipc_switch_to(processid::type processid, threadid::type threadid);
+
+    process_list *lookup_proclt(processlistid::type procltid);
+    process *lookup_process(processlistid::type procltid, processid::type processid);
+
 private:
 
     coreid::type m_coreid;
@@ -150,6 +201,8 @@ private:
 
     driver_data_intel_x64 m_ttys0;
 
+    std::unique_ptr<exit_stats> m_exit_stats;
+
 public:
 
     friend class hyperkernel_ut;
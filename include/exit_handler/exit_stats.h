@@ -0,0 +1,171 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#ifndef EXIT_STATS_H
+#define EXIT_STATS_H
+
+#include <array>
+#include <cstdint>
+
+#include <vcpuid.h>
+
+/// Exit Stats
+///
+/// Counts the VM exits of a vCPU, by basic exit reason, and for vmcalls,
+/// by vmcall index, along with a histogram of the TSC ticks spent handling
+/// each exit (bucketed by powers of 2). Requests executed from the vmcall
+/// ring are counted by vmcall index as well, but separately, as they are
+/// all part of the doorbell vmcall's exit.
+///
+/// A vCPU only ever runs on one core at a time, so its counters are only
+/// ever written by one core, and are not locked. Each counter has its own
+/// cache line. Handling an exit does not always return to the exit
+/// handler (e.g. a yield resumes another thread), so the start of the
+/// exit being handled is kept per core, and the exit is recorded by
+/// whatever resumes the guest next on that core (see end_exit).
+///
+/// Dumping a vCPU's stats from another core reads them while they may be
+/// changing, so the numbers can be slightly out of date.
+///
+class exit_stats
+{
+public:
+
+    static constexpr const auto max_cores = 64UL;
+    static constexpr const auto num_reasons = 65UL;
+    static constexpr const auto num_vmcalls = 64UL;
+    static constexpr const auto num_buckets = 24UL;
+
+    struct alignas(64) counter
+    {
+        uint64_t key;
+        uint64_t count;
+        uint64_t total_ticks;
+        uint64_t max_ticks;
+
+        std::array<uint64_t, num_buckets> buckets;
+    };
+
+    /// Constructor
+    ///
+    /// Registers the stats so that they can be dumped by vCPU id.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param vcpuid the vCPU being counted
+    ///
+    exit_stats(vcpuid::type vcpuid);
+
+    /// Destructor
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    ~exit_stats();
+
+    /// Begin Exit
+    ///
+    /// Counts an exit, and starts timing it on the current core.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param reason the basic exit reason
+    ///
+    void begin_exit(uint64_t reason) noexcept;
+
+    /// Begin vmcall
+    ///
+    /// Counts a vmcall, which is timed along with the exit started by
+    /// begin_exit.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param index the vmcall index
+    ///
+    void begin_vmcall(uint64_t index) noexcept;
+
+    /// Ring Entry
+    ///
+    /// Counts a request executed from the vmcall ring.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param index the vmcall index of the request
+    /// @param ticks the TSC ticks spent executing the request
+    ///
+    void ring_entry(uint64_t index, uint64_t ticks) noexcept;
+
+    /// End Exit
+    ///
+    /// Records how long the exit started on the current core took. Does
+    /// nothing if no exit was started, or it has already been recorded.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    static void end_exit() noexcept;
+
+    /// Dump
+    ///
+    /// Logs every exit reason and vmcall that has been counted.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    void dump() const;
+
+    /// Dump
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param vcpuid the vCPU to dump the stats of, or vcpuid::invalid to
+    ///     dump the stats of every vCPU
+    ///
+    static void dump(vcpuid::type vcpuid);
+
+private:
+
+    counter *vmcall_counter(std::array<counter, num_vmcalls> &table, uint64_t index) noexcept;
+
+private:
+
+    vcpuid::type m_vcpuid;
+
+    std::array<counter, num_reasons> m_reasons;
+    std::array<counter, num_vmcalls> m_vmcalls;
+    std::array<counter, num_vmcalls> m_ring_entries;
+
+public:
+
+    exit_stats(exit_stats &&) = delete;
+    exit_stats &operator=(exit_stats &&) = delete;
+
+    exit_stats(const exit_stats &) = delete;
+    exit_stats &operator=(const exit_stats &) = delete;
+};
+
+#endif
@@ -0,0 +1,376 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef OBJECT_TABLE_H
+#define OBJECT_TABLE_H
+
+#include <gsl/gsl>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <epoch.h>
+
+/// Object Table
+///
+/// A table of objects indexed by the IDs it hands out. The low bits of an
+/// ID are the slot that holds the object, and the bits above them are the
+/// slot's generation, which changes every time the slot is reused, so a
+/// stale ID does not find the object that took its slot. The first object
+/// added to each slot has a generation of 0, so a new table hands out IDs
+/// 0, 1, 2, ... just like a counter would.
+///
+/// Lookups do not take a lock, and do not modify the table. Slots are
+/// allocated in chunks that are never freed (or moved) while the table
+/// exists, so a lookup is a couple of loads. Adding and removing objects
+/// is serialized with a mutex. Removed objects are retired (see epoch.h),
+/// and are freed once no core can still be using them, the next time the
+/// table is modified or collected (or when the table is destroyed). A
+/// table that is not modified again is collected at the end of each exit
+/// by its owner, so that a retired object does not linger.
+///
+/// Each slot also has a tag, which the owner of the table is free to use
+/// for whatever state it needs to be able to check without a lock.
+///
+template<class T, class ID = uint64_t>
+class object_table
+{
+public:
+
+    static constexpr const auto slot_bits = 16UL;
+    static constexpr const auto chunk_size = 64UL;
+    static constexpr const auto num_chunks = (1UL << slot_bits) / chunk_size;
+    static constexpr const auto generation_mask = 0x7FFFFFFFFFFF0000UL;
+
+    /// Default Constructor
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    object_table() noexcept :
+        m_next_slot(0),
+        m_num_retired(0)
+    { }
+
+    /// Destructor
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    ~object_table()
+    {
+        for (auto &&chunk : m_chunks)
+        {
+            if (auto &&slots = chunk.load())
+            {
+                for (auto i = 0UL; i < chunk_size; i++)
+                    delete slots[i].object.load();
+
+                delete[] slots;
+            }
+        }
+    }
+
+    /// Reserve
+    ///
+    /// Reserves a slot, and returns its ID. Nothing can be found using the
+    /// ID until an object is added using add(), but the ID is needed to
+    /// create the object.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the reserved ID
+    ///
+    ID reserve()
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+
+        __collect();
+
+        if (!m_free_slots.empty())
+        {
+            auto &&slot = __slot(m_free_slots.back());
+            m_free_slots.pop_back();
+
+            slot->reserved = true;
+            return slot->id.load();
+        }
+
+        if (m_next_slot == (1UL << slot_bits))
+            throw std::runtime_error("object table full");
+
+        auto index = m_next_slot++;
+
+        if (index % chunk_size == 0)
+        {
+            auto chunk = new slot_type[chunk_size];
+
+            for (auto i = 0UL; i < chunk_size; i++)
+                chunk[i].id = index + i;
+
+            m_chunks[index / chunk_size] = chunk;
+        }
+
+        auto &&slot = __slot(index);
+
+        slot->reserved = true;
+        return slot->id.load();
+    }
+
+    /// Add
+    ///
+    /// Adds an object to a slot reserved using reserve(). Once added, the
+    /// object can be found using its ID.
+    ///
+    /// @expects object != nullptr
+    /// @ensures none
+    ///
+    /// @param id the reserved ID
+    /// @param object the object to add
+    /// @param tag the initial tag of the object (see tag())
+    /// @return a pointer to the object that was added
+    ///
+    T *add(ID id, std::unique_ptr<T> object, uint64_t tag = 0)
+    {
+        expects(object != nullptr);
+        std::lock_guard<std::mutex> guard(m_mutex);
+
+        __collect();
+
+        auto &&slot = __find(id);
+
+        if (slot == nullptr || !slot->reserved)
+            throw std::invalid_argument("object id not reserved: " + std::to_string(id));
+
+        if (slot->object.load() != nullptr)
+            throw std::runtime_error("object already exists: " + std::to_string(id));
+
+        slot->tag = tag;
+        slot->object = object.get();
+
+        return object.release();
+    }
+
+    /// Remove
+    ///
+    /// Removes the object with the provided ID (if there is one) and
+    /// releases its slot, which is also how a slot that was reserved, but
+    /// never added to, is released. The object is freed once no core can
+    /// still be using it. Does nothing if the ID is stale.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param id the ID of the object to remove
+    ///
+    void remove(ID id)
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+
+        auto &&slot = __find(id);
+
+        if (slot == nullptr || !slot->reserved)
+            return;
+
+        auto &&object = slot->object.exchange(nullptr);
+
+        slot->reserved = false;
+        slot->id = __next_generation(id);
+        m_free_slots.push_back(id & ~generation_mask);
+
+        if (object != nullptr)
+            m_retired.push_back({epoch::retire(), std::unique_ptr<T>(object)});
+
+        __collect();
+    }
+
+    /// Collect
+    ///
+    /// Frees the removed objects that no core can still be using. Does not
+    /// take the lock if there are none.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    void collect()
+    {
+        if (m_num_retired.load() == 0)
+            return;
+
+        std::lock_guard<std::mutex> guard(m_mutex);
+        __collect();
+    }
+
+    /// Get
+    ///
+    /// Wait-free.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param id the ID of the object to get
+    /// @return the object associated with the provided ID, or nullptr if
+    ///     there is no such object (or the ID is stale)
+    ///
+    T *get(ID id) const noexcept
+    {
+        auto &&slot = __find(id);
+
+        if (slot == nullptr)
+            return nullptr;
+
+        auto &&object = slot->object.load();
+        return slot->id.load() == id ? object : nullptr;
+    }
+
+    /// Tag
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param id the ID of the object
+    /// @return the tag of the object associated with the provided ID, or 0
+    ///     if there is no such object
+    ///
+    uint64_t tag(ID id) const noexcept
+    {
+        auto &&slot = __find(id);
+
+        if (slot == nullptr || slot->object.load() == nullptr)
+            return 0;
+
+        auto &&tag = slot->tag.load();
+        return slot->id.load() == id ? tag : 0;
+    }
+
+    /// Set Tag
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param id the ID of the object
+    /// @param tag the tag of the object associated with the provided ID.
+    ///     Does nothing if there is no such object.
+    ///
+    void set_tag(ID id, uint64_t tag)
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+
+        auto &&slot = __find(id);
+
+        if (slot != nullptr && slot->object.load() != nullptr)
+            slot->tag = tag;
+    }
+
+private:
+
+    struct slot_type
+    {
+        std::atomic<ID> id;
+        std::atomic<T *> object;
+        std::atomic<uint64_t> tag;
+
+        bool reserved;
+
+        slot_type() noexcept :
+            id(0),
+            object(nullptr),
+            tag(0),
+            reserved(false)
+        { }
+    };
+
+    struct retired_object
+    {
+        uint64_t epoch;
+        std::unique_ptr<T> object;
+    };
+
+    slot_type *__slot(uint64_t index) const noexcept
+    {
+        if (index >= (1UL << slot_bits))
+            return nullptr;
+
+        if (auto &&chunk = m_chunks[index / chunk_size].load())
+            return &chunk[index % chunk_size];
+
+        return nullptr;
+    }
+
+    slot_type *__find(ID id) const noexcept
+    {
+        auto &&slot = __slot(id & ~generation_mask);
+
+        if (slot == nullptr || slot->id.load() != id)
+            return nullptr;
+
+        return slot;
+    }
+
+    ID __next_generation(ID id) const noexcept
+    {
+        auto &&generation = ((id & generation_mask) + (1UL << slot_bits)) & generation_mask;
+        return generation | (id & ~generation_mask);
+    }
+
+    void __collect()
+    {
+        auto &&iter = m_retired.begin();
+
+        while (iter != m_retired.end())
+        {
+            if (epoch::quiescent(iter->epoch))
+                iter = m_retired.erase(iter);
+            else
+                ++iter;
+        }
+
+        m_num_retired = m_retired.size();
+    }
+
+private:
+
+    std::mutex m_mutex;
+    uint64_t m_next_slot;
+
+    std::array<std::atomic<slot_type *>, num_chunks> m_chunks = {};
+
+    std::vector<uint64_t> m_free_slots;
+    std::vector<retired_object> m_retired;
+    std::atomic<std::size_t> m_num_retired;
+
+public:
+
+    object_table(object_table &&) = delete;
+    object_table &operator=(object_table &&) = delete;
+
+    object_table(const object_table &) = delete;
+    object_table &operator=(const object_table &) = delete;
+};
+
+#endif
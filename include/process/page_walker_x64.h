@@ -0,0 +1,122 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef PAGE_WALKER_X64_H
+#define PAGE_WALKER_X64_H
+
+#include <array>
+#include <cstdint>
+
+#include <memory_manager/map_ptr_x64.h>
+
+/// Page Walker
+///
+/// Translates virtual addresses using a set of 4 level page tables, given
+/// the CR3 that points to them. Each level keeps the last table page it
+/// mapped, so translating consecutive pages only maps a new table when the
+/// walk crosses into one, instead of walking all 4 levels from scratch the
+/// way bfn::virt_to_phys_with_cr3 does.
+///
+class page_walker_x64
+{
+public:
+
+    using integer_pointer = uintptr_t;
+
+    /// Extent
+    ///
+    /// A range of virtual memory that is backed by physically contiguous
+    /// memory.
+    ///
+    struct extent
+    {
+        integer_pointer virt;
+        integer_pointer phys;
+        integer_pointer size;
+    };
+
+    /// Default Constructor
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param cr3 the CR3 of the page tables to walk
+    ///
+    page_walker_x64(integer_pointer cr3) noexcept;
+
+    /// Destructor
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    ~page_walker_x64() = default;
+
+    /// Translate
+    ///
+    /// @expects virt is mapped by the page tables
+    /// @ensures none
+    ///
+    /// @param virt the virtual address to translate
+    /// @param page_size returns the size of the page that maps virt
+    /// @return the physical address of virt
+    ///
+    integer_pointer translate(integer_pointer virt, integer_pointer &page_size);
+
+    /// Next Extent
+    ///
+    /// Returns the largest physically contiguous extent that starts at
+    /// virt, and is no larger than size.
+    ///
+    /// @expects virt is 4k aligned
+    /// @expects size is not 0
+    /// @ensures ret.size <= size
+    ///
+    /// @param virt the virtual address that the extent starts at
+    /// @param size the maximum size of the extent
+    /// @return the extent that starts at virt
+    ///
+    extent next_extent(integer_pointer virt, integer_pointer size);
+
+private:
+
+    uintptr_t entry(std::size_t level, integer_pointer table, integer_pointer virt);
+
+private:
+
+    struct table_cache
+    {
+        integer_pointer phys;
+        bfn::unique_map_ptr_x64<uintptr_t> table;
+    };
+
+    integer_pointer m_cr3;
+    std::array<table_cache, 4> m_tables;
+
+public:
+
+    page_walker_x64(page_walker_x64 &&) = delete;
+    page_walker_x64 &operator=(page_walker_x64 &&) = delete;
+
+    page_walker_x64(const page_walker_x64 &) = delete;
+    page_walker_x64 &operator=(const page_walker_x64 &) = delete;
+};
+
+#endif
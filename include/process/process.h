@@ -24,11 +24,16 @@
 
 #include <map>
 #include <list>
+#include <atomic>
 #include <mutex>
+#include <vector>
 #include <memory>
 
 #include <user_data.h>
 #include <processid.h>
+#include <object_table.h>
+
+#include <domain/page_pool.h>
 
 #include <thread/thread.h>
 #include <thread/thread_factory.h>
@@ -45,8 +50,9 @@ public:
     /// @ensures none
     ///
     /// @param id the id of the process
+    /// @param pool the page pool that backs this process's memory
     ///
-    process(processid::type id);
+    process(processid::type id, gsl::not_null<page_pool *> pool);
 
     /// Destructor
     ///
@@ -86,6 +92,92 @@ public:
                                uintptr_t size,
                                uintptr_t perm);
 
+    /// VM Unmap
+    ///
+    /// Removes the 4k mappings for a range of this process's memory.
+    ///
+    /// @expects virt and size are 4k aligned
+    /// @ensures none
+    ///
+    /// @param virt the (process) virtual address to unmap
+    /// @param size the number of bytes to unmap
+    ///
+    virtual void vm_unmap(uintptr_t virt, uintptr_t size);
+
+    /// VM Sync
+    ///
+    /// Waits until no core can still be using a translation that was
+    /// removed (or made read-only) before this was called, so that the
+    /// memory it pointed to can be freed (or copied). Must not be called
+    /// while holding any of this process's locks.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    virtual void vm_sync();
+
+    /// VM Share
+    ///
+    /// Maps all of this process's memory into another process read-only,
+    /// and makes this process's own mappings read-only as well, so that
+    /// the first write to a page by either process can be caught and the
+    /// page copied (see handle_fault).
+    ///
+    /// @expects child has no memory mapped by vm_map
+    /// @ensures none
+    ///
+    /// @param child the process to share this process's memory with
+    ///
+    virtual void vm_share(gsl::not_null<process *> child);
+
+    /// VM Shared
+    ///
+    /// @expects virt is 4k aligned
+    /// @ensures none
+    ///
+    /// @param virt the (process) virtual address to look up
+    /// @return the physical address of the page that maps virt, if it is
+    ///     mapped read-only by vm_share, or 0 otherwise
+    ///
+    virtual uintptr_t vm_shared(uintptr_t virt) const;
+
+    /// VM Map Shared
+    ///
+    /// Maps memory that other processes also map. The memory is mapped
+    /// read / execute, and is reported by vm_shared, so a write to it is
+    /// copied like any other shared page.
+    ///
+    /// @expects virt, phys and size are 4k aligned
+    /// @ensures none
+    ///
+    /// @param virt the (process) virtual address to map
+    /// @param phys the physical address to map to
+    /// @param size the number of bytes to map
+    ///
+    virtual void vm_map_shared(uintptr_t virt, uintptr_t phys, uintptr_t size);
+
+    /// Read Word
+    ///
+    /// Reads a 64bit word from this process's memory.
+    ///
+    /// @expects virt is 8 byte aligned
+    /// @ensures none
+    ///
+    /// @param virt the (process) virtual address to read
+    /// @return the value stored at virt
+    ///
+    virtual uint64_t read_word(uintptr_t virt);
+
+    /// Virtual To Physical
+    ///
+    /// @expects virt is mapped
+    /// @ensures none
+    ///
+    /// @param virt the (process) virtual address to translate
+    /// @return the physical address that virt is mapped to
+    ///
+    virtual uintptr_t virt_to_phys(uintptr_t virt);
+
     /// Process Id
     ///
     /// @expects none
@@ -137,6 +229,166 @@ public:
     ///
     virtual gsl::not_null<thread *> get_thread(threadid::type threadid);
 
+    /// Find Thread
+    ///
+    /// Unlike get_thread, this function does not fail if the thread does
+    /// not exist.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param threadid the id of the thread to find
+    /// @return returns the thread associated with the provided id, or
+    ///     nullptr if the thread does not exist
+    ///
+    virtual thread *find_thread(threadid::type threadid);
+
+    /// Next Thread
+    ///
+    /// Removes the next runnable thread from this process's run queue
+    /// (round robin), and marks it as running on the provided vCPU. This
+    /// should only be called by a vCPU that removed this process from a
+    /// process list run queue.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param id the id of the vCPU that will execute the thread
+    /// @param migrated set to true if the thread last ran on a different
+    ///     vCPU, false otherwise
+    /// @return returns the thread to execute (or nullptr if this process
+    ///     has no runnable threads), and true if this process still has
+    ///     runnable threads, in which case the caller must place this
+    ///     process back onto a process list run queue
+    ///
+    virtual std::pair<thread *, bool> next_thread(vcpuid::type id, bool &migrated);
+
+    /// Requeue Thread
+    ///
+    /// Places a running thread back onto this process's run queue (e.g. the
+    /// thread yielded or was preempted). If the thread is no longer running
+    /// on the provided vCPU (e.g. it blocked or exited, or it was woken and
+    /// picked up by another vCPU), this function does nothing.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param id the id of the vCPU that was executing the thread
+    /// @param thrd the thread to requeue
+    /// @return true if the caller must place this process onto a process
+    ///     list run queue, false otherwise
+    ///
+    virtual bool requeue_thread(vcpuid::type id, gsl::not_null<thread *> thrd);
+
+    /// Wake Thread
+    ///
+    /// Places a blocked thread onto this process's run queue. If the thread
+    /// is not blocked, this function does nothing.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param thrd the thread to wake
+    /// @return true if the caller must place this process onto a process
+    ///     list run queue, false otherwise
+    ///
+    virtual bool wake_thread(gsl::not_null<thread *> thrd);
+
+    /// Hand Off Thread
+    ///
+    /// Marks a blocked thread as running on the provided vCPU, without
+    /// placing it onto this process's run queue, so that the vCPU can
+    /// switch to it directly. If the thread is not blocked, this function
+    /// does nothing.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param id the id of the vCPU that will execute the thread
+    /// @param thrd the thread to hand off to
+    /// @return true if the thread was handed off, false otherwise
+    ///
+    virtual bool handoff_thread(vcpuid::type id, gsl::not_null<thread *> thrd);
+
+    /// Block Thread
+    ///
+    /// Marks a running thread as blocked. The thread will not execute again
+    /// until it is woken.
+    ///
+    /// @expects thrd->state() == thread_state::running
+    /// @ensures none
+    ///
+    /// @param thrd the thread to block
+    ///
+    virtual void block_thread(gsl::not_null<thread *> thrd);
+
+    /// Exit Thread
+    ///
+    /// Marks a thread as exited, removing it from this process's run queue
+    /// if needed. The thread will never execute again. The thread is not
+    /// deleted, as its return value is kept until it is joined.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param thrd the thread to exit
+    /// @param retval the thread's return value
+    /// @return the id of the thread blocked on joining the exited thread,
+    ///     which the caller must wake, or threadid::invalid
+    ///
+    virtual threadid::type exit_thread(gsl::not_null<thread *> thrd, uint64_t retval);
+
+    /// Join Thread
+    ///
+    /// Waits for a thread to exit. If the thread has already exited, its
+    /// return value is returned, and the caller should delete the thread.
+    /// Otherwise, the running thread is blocked until the thread exits, at
+    /// which point the running thread must call this function again.
+    ///
+    /// @expects thrd->state() == thread_state::running
+    /// @ensures none
+    ///
+    /// @param thrd the running thread that is joining
+    /// @param target the thread to wait for
+    /// @param retval set to the target's return value if it has exited
+    /// @return true if the target has exited, false if thrd was blocked
+    ///
+    virtual bool join_thread(
+        gsl::not_null<thread *> thrd, gsl::not_null<thread *> target, uint64_t &retval);
+
+    /// Futex Wait
+    ///
+    /// Blocks the running thread on the word located at addr, but only if
+    /// the word still holds the expected value. The check and the block are
+    /// atomic with respect to futex_wake, so a wake cannot be lost between
+    /// the guest reading the word and the thread blocking.
+    ///
+    /// @expects thrd->state() == thread_state::running
+    /// @ensures none
+    ///
+    /// @param thrd the running thread that is waiting
+    /// @param addr the (process) virtual address of the word to wait on
+    /// @param expected the value the word must hold for thrd to block
+    /// @return true if thrd was blocked, false if the word did not hold
+    ///     the expected value
+    ///
+    virtual bool futex_wait(gsl::not_null<thread *> thrd, uintptr_t addr, uint64_t expected);
+
+    /// Futex Wake
+    ///
+    /// Wakes up to num threads blocked on the word located at addr, in the
+    /// order in which they blocked.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param addr the (process) virtual address of the word
+    /// @param num the max number of threads to wake
+    /// @return the number of threads woken, and true if the caller must
+    ///     place this process onto a process list run queue
+    ///
+    virtual std::pair<uint64_t, bool> futex_wake(uintptr_t addr, uint64_t num);
+
     /// Clear and Set Program Break
     ///
     /// @expects none
@@ -146,42 +398,244 @@ public:
     ///
     virtual void clear_set_program_break(integer_pointer pb);
 
-    /// Increase Program Break (4k)
+    /// Increase Program Break
+    ///
+    /// Increases the program break for this process by num_pages 4k
+    /// pages. The pages come from the process's page pool, and runs of
+    /// pages that happen to be physically contiguous are mapped together.
+    ///
+    /// @expects num_pages != 0
+    /// @expects the new program break does not overflow
+    /// @ensures none
+    ///
+    /// @param num_pages the number of 4k pages to add
+    ///
+    virtual void increase_program_break(integer_pointer num_pages);
+
+    /// Decrease Program Break
+    ///
+    /// Decreases the program break for this process by num_pages 4k
+    /// pages. Each increase is unmapped and freed as a whole, so the
+    /// program break can only be decreased to the start of an earlier
+    /// increase.
+    ///
+    /// @expects num_pages != 0
+    /// @expects num_pages is no more than the size of the heap
+    /// @expects the new program break is the start of an increase
+    /// @ensures none
+    ///
+    /// @param num_pages the number of 4k pages to remove
+    ///
+    virtual void decrease_program_break(integer_pointer num_pages);
+
+    /// Map Memory
+    ///
+    /// Allocates zeroed memory and maps it into an unused range of this
+    /// process's address space. Ranges of 2m or more are 2m aligned.
+    ///
+    /// @expects size != 0
+    /// @ensures ret is 4k aligned
+    ///
+    /// @param addr a hint for where to place the memory, or 0
+    /// @param size the number of bytes to map (rounded up to 4k)
+    /// @param perm the PROT_ flags of the memory
+    /// @param lazy if true, each page is only allocated and mapped when
+    ///     it is first touched (see handle_fault)
+    /// @return the (process) virtual address of the memory
+    ///
+    virtual integer_pointer mmap(
+        integer_pointer addr, integer_pointer size, integer_pointer perm, bool lazy);
+
+    /// Reserve Memory
+    ///
+    /// Reserves a fixed range of this process's address space. No memory is
+    /// allocated until a page is first touched, at which point it is
+    /// filled with zeros, or copied from the backing pages if provided.
     ///
-    /// Increases the program break for this process by 4k.
+    /// @expects virt is 4k aligned
+    /// @expects size != 0
+    /// @expects backing is empty, or has one page per 4k of size
+    /// @ensures none
+    ///
+    /// @param virt the (process) virtual address to reserve
+    /// @param size the number of bytes to reserve (rounded up to 4k)
+    /// @param perm the PROT_ flags of the memory
+    /// @param backing a page holding each page's initial contents
+    ///
+    virtual void reserve(
+        integer_pointer virt, integer_pointer size, integer_pointer perm,
+        std::vector<page_pool::shared_page_ptr> backing = {});
+
+    /// Handle Fault
+    ///
+    /// Called when this process touches a page that is not mapped, or
+    /// writes to a page that is shared with another process by fork. If
+    /// the page belongs to a range from mmap or reserve, it is allocated
+    /// and mapped, and if it is shared, it is copied, and in both cases
+    /// the process can continue.
     ///
     /// @expects none
     /// @ensures none
     ///
-    virtual void increase_program_break_4k();
+    /// @param virt the (process) virtual address that was touched
+    /// @param write true if the access was a write
+    /// @return true if the page is now mapped, false if the access is
+    ///     invalid
+    ///
+    virtual bool handle_fault(integer_pointer virt, bool write);
 
-    /// Decrease Program Break (4k)
+    /// Resident Pages
     ///
-    /// Decrease the program break for this process by 4k.
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the number of 4k pages that are allocated for this
+    ///     process's heap and mapped ranges
+    ///
+    virtual uint64_t resident_pages() const;
+
+    /// Reserved Pages
     ///
     /// @expects none
     /// @ensures none
     ///
-    virtual void decrease_program_break_4k();
+    /// @return the number of 4k pages of this process's address space that
+    ///     are reserved for its heap and mapped ranges
+    ///
+    virtual uint64_t reserved_pages() const;
+
+    /// Unmap Memory
+    ///
+    /// Unmaps and frees any memory in the range that was mapped by mmap.
+    /// Ranges that are not mapped are ignored.
+    ///
+    /// @expects addr is 4k aligned
+    /// @ensures none
+    ///
+    /// @param addr the (process) virtual address to unmap
+    /// @param size the number of bytes to unmap (rounded up to 4k)
+    ///
+    virtual void munmap(integer_pointer addr, integer_pointer size);
+
+    /// Protect Memory
+    ///
+    /// Changes the permissions of memory that was mapped by mmap. Memory
+    /// with no permissions (PROT_NONE) is unmapped, but is not freed.
+    ///
+    /// @expects addr is 4k aligned
+    /// @expects the range is entirely mapped by mmap
+    /// @ensures none
+    ///
+    /// @param addr the (process) virtual address to protect
+    /// @param size the number of bytes to protect (rounded up to 4k)
+    /// @param perm the new PROT_ flags of the memory
+    ///
+    virtual void mprotect(integer_pointer addr, integer_pointer size, integer_pointer perm);
+
+    /// Map Shared Pages
+    ///
+    /// Maps pages that other processes may also map, such as the pages of
+    /// the domain's segment cache. The process holds a reference to each
+    /// page for as long as the page is mapped.
+    ///
+    /// @expects virt is 4k aligned
+    /// @ensures none
+    ///
+    /// @param virt the (process) virtual address to map the pages at
+    /// @param pages the pages to map
+    ///
+    virtual void map_shared_pages(
+        integer_pointer virt, const std::vector<page_pool::shared_page_ptr> &pages);
+
+    /// Pin Page
+    ///
+    /// Returns a reference to the page that backs virt, which keeps the
+    /// page allocated even if the process unmaps it, so that the
+    /// hyperkernel can keep writing to it (e.g. a driver's buffer). Memory
+    /// mapped by the loader (e.g. using vm_map_lookup) is not owned by the
+    /// hyperkernel, and cannot be unmapped by the process, so it has
+    /// nothing to pin.
+    ///
+    /// @expects virt is 4k aligned
+    /// @ensures none
+    ///
+    /// @param virt the (process) virtual address of the page
+    /// @return the page that backs virt, or nullptr if there is none
+    ///
+    virtual page_pool::shared_page_ptr pin_page(integer_pointer virt);
+
+    /// Fork
+    ///
+    /// Gives a newly created process a copy-on-write copy of this
+    /// process's memory: the heap, mapped ranges, and everything mapped by
+    /// vm_map and vm_map_lookup. Threads are not copied.
+    ///
+    /// @expects child is newly created
+    /// @ensures none
+    ///
+    /// @param child the process to copy this process into
+    ///
+    virtual void fork(gsl::not_null<process *> child);
 
 private:
 
-    std::unique_ptr<thread> &__add_thread(threadid::type threadid, user_data *data);
-    std::unique_ptr<thread> &__get_thread(threadid::type threadid);
+    thread *__add_thread(threadid::type threadid, user_data *data);
+
+    struct vma
+    {
+        integer_pointer size;
+        integer_pointer perm;
+        std::vector<page_pool::shared_page_ptr> pages;
+        std::vector<page_pool::shared_page_ptr> backing;
+    };
+
+    integer_pointer __find_free_range(integer_pointer addr, integer_pointer size) const;
+    void __split_vma(integer_pointer addr);
+    void __map_vma(integer_pointer addr, const vma &area);
+    void __unmap_vma(integer_pointer addr, const vma &area, std::size_t num);
+
+    struct heap_chunk
+    {
+        integer_pointer virt;
+        integer_pointer size;
+        std::vector<page_pool::shared_page_ptr> pages;
+    };
+
+    page_pool::shared_page_ptr *__find_page(integer_pointer virt);
+    page_pool::shared_page_ptr __copy_on_write(integer_pointer virt, integer_pointer phys);
+    bool __fault_in(integer_pointer virt);
 
 private:
 
     processid::type m_id;
     bool m_is_initialized;
 
+    gsl::not_null<page_pool *> m_page_pool;
+
     integer_pointer m_program_break;
-    std::list<std::unique_ptr<char[]>> m_pages;
+    std::vector<heap_chunk> m_heap;
+
+private:
+
+    mutable std::mutex m_vma_mutex;
+    std::map<integer_pointer, vma> m_vmas;
+    std::map<integer_pointer, page_pool::shared_page_ptr> m_mapped_pages;
+
+private:
+
+    object_table<thread, threadid::type> m_threads;
+
+private:
+
+    mutable std::mutex m_run_queue_mutex;
+    std::list<thread *> m_run_queue;
+
+    bool m_is_queued;
 
 private:
 
-    mutable std::mutex m_thread_mutex;
-    threadid::type m_thread_next_id;
-    std::map<threadid::type, std::unique_ptr<thread>> m_threads;
+    mutable std::mutex m_futex_mutex;
+    std::map<uintptr_t, std::list<threadid::type>> m_futex_queues;
 
 private:
 
@@ -22,6 +22,11 @@
 #ifndef PROCESS_INTEL_X64_H
 #define PROCESS_INTEL_X64_H
 
+#include <map>
+#include <set>
+#include <array>
+#include <mutex>
+#include <atomic>
 #include <gsl/gsl>
 
 #include <process/process.h>
@@ -35,6 +40,8 @@ public:
 
     using integer_pointer = uintptr_t;
 
+    static constexpr const auto max_cores = 64UL;
+
     /// Default Constructor
     ///
     /// @expects
@@ -84,14 +91,220 @@ public:
                      uintptr_t phys,
                      uintptr_t perm);
 
+    void vm_unmap(uintptr_t virt, uintptr_t size) override;
+    void vm_sync() override;
+
+    void vm_share(gsl::not_null<process *> child) override;
+    uintptr_t vm_shared(uintptr_t virt) const override;
+    void vm_map_shared(uintptr_t virt, uintptr_t phys, uintptr_t size) override;
+
+    uint64_t read_word(uintptr_t virt) override;
+    uintptr_t virt_to_phys(uintptr_t virt) override;
+
     auto eptp() const
     { return m_root_ept->eptp(); }
 
+    /// Flush EPT
+    ///
+    /// Invalidates the translations cached from this process's EPT on the
+    /// current core, and marks the translations cached on every other core
+    /// as stale, so that they are invalidated the next time a thread from
+    /// this process is scheduled there (see sync_ept). Only this process's
+    /// translations are invalidated, so other processes keep theirs.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    void flush_ept();
+
+    /// Sync EPT
+    ///
+    /// Records that the current core is executing this process, and
+    /// invalidates the translations cached from this process's EPT on the
+    /// current core, if the EPT has changed (or the core has never executed
+    /// this process) since they were last invalidated. Must be called
+    /// before a thread from this process is executed.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    void sync_ept();
+
+    /// Unload EPT
+    ///
+    /// Records that the current core is no longer executing a process
+    /// (i.e. it is executing the host), so vm_sync does not wait for it.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    static void unload_ept();
+
+    /// Number of 4k Pages Mapped
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the number of 4k EPT entries created by vm_map and
+    ///     vm_map_lookup
+    ///
+    auto num_4k_pages() const
+    { return m_num_4k_pages.load(); }
+
+    /// Number of 2m Pages Mapped
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the number of 2m EPT entries created by vm_map and
+    ///     vm_map_lookup
+    ///
+    auto num_2m_pages() const
+    { return m_num_2m_pages.load(); }
+
+    /// Number of 1g Pages Mapped
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the number of 1g EPT entries created by vm_map and
+    ///     vm_map_lookup
+    ///
+    auto num_1g_pages() const
+    { return m_num_1g_pages.load(); }
+
+private:
+
+    /// Map Range
+    ///
+    /// Maps a physically contiguous range using the largest EPT entries
+    /// that both addresses are aligned to, falling back to smaller pages
+    /// at the edges of the range.
+    ///
+    /// @expects virt, phys and size are 4k aligned
+    /// @ensures none
+    ///
+    /// @param virt the (process) virtual address to map
+    /// @param phys the physical address to map to
+    /// @param size the number of bytes to map
+    /// @param perm the permissions of the mapping
+    ///
+    void vm_map_range(uintptr_t virt,
+                      uintptr_t phys,
+                      uintptr_t size,
+                      uintptr_t perm);
+
+    /// Map 4k Page
+    ///
+    /// Adds a 4k EPT entry, and records that the 2m range it is in has a
+    /// table of 4k entries, so that it is never mapped with a large page.
+    ///
+    /// @expects virt is not part of a large page
+    /// @ensures none
+    ///
+    /// @param virt the (process) virtual address to map
+    /// @param phys the physical address to map to
+    /// @param attr the EPT memory attributes of the entry
+    ///
+    void map_4k(uintptr_t virt, uintptr_t phys, root_ept_intel_x64::attr_type attr);
+
+    /// Can Map Large Page
+    ///
+    /// @expects virt is aligned to size
+    /// @ensures none
+    ///
+    /// @param virt the (process) virtual address to map
+    /// @param size the size of the large page (2m or 1g)
+    /// @return true if mapping a large page at virt would not overlap a
+    ///     table of 4k entries or a large page of another size
+    ///
+    bool can_map_large(uintptr_t virt, uintptr_t size) const;
+
+    /// Invalidate Stale EPT
+    ///
+    /// Invalidates the translations cached from this process's EPT on the
+    /// current core, if the EPT has changed since they were last
+    /// invalidated.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    void invalidate_stale_ept();
+
+    /// Page Size
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param virt the (process) virtual address to look up
+    /// @return the size of the EPT page that maps virt
+    ///
+    uintptr_t page_size(uintptr_t virt) const;
+
+    /// Split Mapping
+    ///
+    /// Splits the mapping that contains virt (if any) in two, so that a
+    /// mapping starts at virt.
+    ///
+    /// @expects m_maps_mutex is locked
+    /// @ensures none
+    ///
+    /// @param virt the (process) virtual address to split at
+    ///
+    void split_mapping(uintptr_t virt);
+
+    /// Unmap Entries
+    ///
+    /// Removes the EPT entries (of any size) that map a range.
+    ///
+    /// @expects virt and size are 4k aligned, and the range does not
+    ///     split a large page
+    /// @ensures none
+    ///
+    /// @param virt the (process) virtual address of the range
+    /// @param size the number of bytes in the range
+    ///
+    void unmap_entries(uintptr_t virt, uintptr_t size);
+
+    /// Write Protect
+    ///
+    /// Replaces the EPT entries for a range with read / execute 4k entries.
+    ///
+    /// @expects virt, phys and size are 4k aligned
+    /// @ensures none
+    ///
+    /// @param virt the (process) virtual address of the range
+    /// @param phys the physical address the range is mapped to
+    /// @param size the number of bytes in the range
+    ///
+    void write_protect(uintptr_t virt, uintptr_t phys, uintptr_t size);
+
 private:
 
+    struct mapping
+    {
+        uintptr_t phys;
+        uintptr_t size;
+        bool shared;
+    };
+
     gsl::not_null<domain_intel_x64 *> m_domain;
     std::unique_ptr<root_ept_intel_x64> m_root_ept;
 
+    std::atomic<uint64_t> m_num_4k_pages;
+    std::atomic<uint64_t> m_num_2m_pages;
+    std::atomic<uint64_t> m_num_1g_pages;
+
+    std::atomic<uint64_t> m_ept_generation;
+    std::array<std::atomic<uint64_t>, max_cores> m_ept_synced;
+
+    mutable std::mutex m_large_pages_mutex;
+    std::map<uintptr_t, uintptr_t> m_large_pages;
+    std::set<uintptr_t> m_4k_tables;
+
+    mutable std::mutex m_maps_mutex;
+    std::map<uintptr_t, mapping> m_maps;
+
 public:
 
     friend class hyperkernel_ut;
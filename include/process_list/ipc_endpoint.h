@@ -0,0 +1,281 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef IPC_ENDPOINT_H
+#define IPC_ENDPOINT_H
+
+#include <gsl/gsl>
+
+#include <map>
+#include <list>
+#include <array>
+#include <mutex>
+#include <vector>
+
+#include <threadid.h>
+#include <processid.h>
+#include <endpointid.h>
+
+#include <domain/page_pool.h>
+
+class thread;
+class process;
+
+/// IPC Message
+///
+/// A call (or a reply), along with the client that made it. The words are
+/// passed in registers. The buffer is the client's buffer, which the first
+/// len bytes of a call are copied from, and a reply is copied to.
+///
+struct ipc_message
+{
+    static constexpr const auto num_words = 4UL;
+
+    processid::type processid;
+    threadid::type threadid;
+
+    std::array<uint64_t, num_words> words;
+
+    uintptr_t buffer;
+    uint64_t len;
+};
+
+/// IPC Endpoint
+///
+/// A synchronous, L4 style endpoint, served by a single thread. Clients
+/// call the endpoint and block until the server replies. The server replies
+/// to one call and waits for the next in a single step (see reply and
+/// wait), and only blocks if no calls are waiting.
+///
+/// The endpoint does not switch between threads itself. Instead, call()
+/// and wait() say whether the thread that was just blocked should hand
+/// its vCPU straight to the server (or back to the client), which is left
+/// to the exit handler. Threads are blocked while the endpoint is locked,
+/// so that a thread is always blocked before it can be handed a vCPU.
+///
+/// The server's buffer is a single page, given when the endpoint is
+/// created, that calls are copied into and replies are copied from. The
+/// page is pinned for the lifetime of the endpoint, so that it is not
+/// handed to another process if the server unmaps it.
+///
+class ipc_endpoint
+{
+public:
+
+    /// Constructor
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param id the id of the endpoint
+    /// @param processid the id of the server's process
+    /// @param threadid the id of the server's thread
+    /// @param buffer_phys the physical address of the server's buffer, or
+    ///     0 if the endpoint only takes words
+    /// @param buffer_page the page that backs the server's buffer, which is
+    ///     held until the endpoint is deleted (nullptr if there is none)
+    ///
+    ipc_endpoint(
+        endpointid::type id,
+        processid::type processid,
+        threadid::type threadid,
+        uintptr_t buffer_phys,
+        page_pool::shared_page_ptr buffer_page);
+
+    /// Destructor
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    virtual ~ipc_endpoint() = default;
+
+    /// Get ID
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the endpoint's id
+    ///
+    virtual endpointid::type id() const
+    { return m_id; }
+
+    /// Server Process ID
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the id of the server's process
+    ///
+    virtual processid::type server_processid() const
+    { return m_processid; }
+
+    /// Server Thread ID
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the id of the server's thread
+    ///
+    virtual threadid::type server_threadid() const
+    { return m_threadid; }
+
+    /// Is Server
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param processid the id of a process
+    /// @param threadid the id of a thread in the process
+    /// @return true if the provided thread serves this endpoint, false
+    ///     otherwise
+    ///
+    virtual bool is_server(processid::type processid, threadid::type threadid) const
+    { return m_processid == processid && m_threadid == threadid; }
+
+    /// Buffer
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the physical address of the server's buffer, or 0 if the
+    ///     endpoint only takes words
+    ///
+    virtual uintptr_t buffer_phys() const
+    { return m_buffer_phys; }
+
+    /// Call
+    ///
+    /// Blocks the client, and delivers its call to the server if the
+    /// server is waiting, or queues the call if it is not.
+    ///
+    /// @expects the client is running
+    /// @ensures none
+    ///
+    /// @param proc the client's process
+    /// @param client the client's thread
+    /// @param msg the call
+    /// @return true if the call was delivered, in which case the server has
+    ///     to be switched to, false if the call was queued
+    ///
+    virtual bool call(
+        gsl::not_null<process *> proc, gsl::not_null<thread *> client, const ipc_message &msg);
+
+    /// Take Reply
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param processid the id of the client's process
+    /// @param threadid the id of the client's thread
+    /// @param reply where to put the reply
+    /// @return true if the server has replied to the provided client (the
+    ///     reply is only returned once), false otherwise
+    ///
+    virtual bool take_reply(processid::type processid, threadid::type threadid, ipc_message &reply);
+
+    /// Take Delivery
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param msg where to put the call
+    /// @return true if a call was delivered to the server while it was
+    ///     waiting (the call is only returned once), false otherwise
+    ///
+    virtual bool take_delivery(ipc_message &msg);
+
+    /// Reply
+    ///
+    /// Replies to the client the server is serving, if any. The client is
+    /// left blocked, and has to be woken (or switched to) by the caller.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param reply the reply
+    /// @param client where to put the call being replied to
+    /// @return true if there was a client to reply to, false otherwise
+    ///
+    virtual bool reply(const ipc_message &reply, ipc_message &client);
+
+    /// Wait
+    ///
+    /// Takes the next queued call, or blocks the server if there are none.
+    ///
+    /// @expects the server is running, and is not serving a client
+    /// @ensures none
+    ///
+    /// @param proc the server's process
+    /// @param server the server's thread
+    /// @param msg where to put the next call
+    /// @return true if there was a call, false if the server was blocked
+    ///
+    virtual bool wait(
+        gsl::not_null<process *> proc, gsl::not_null<thread *> server, ipc_message &msg);
+
+    /// Close
+    ///
+    /// Closes the endpoint. Any call or wait after this fails.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the ids of the threads that were blocked on the endpoint,
+    ///     and have to be woken
+    ///
+    virtual std::vector<std::pair<processid::type, threadid::type>> close();
+
+private:
+
+    enum class endpoint_state
+    {
+        idle,
+        waiting,
+        delivered,
+        serving
+    };
+
+    endpointid::type m_id;
+
+    processid::type m_processid;
+    threadid::type m_threadid;
+    uintptr_t m_buffer_phys;
+    page_pool::shared_page_ptr m_buffer_page;
+
+    mutable std::mutex m_mutex;
+
+    bool m_closed;
+    endpoint_state m_state;
+
+    ipc_message m_current;
+    std::list<ipc_message> m_callers;
+    std::map<std::pair<processid::type, threadid::type>, ipc_message> m_replies;
+
+public:
+
+    ipc_endpoint(ipc_endpoint &&) = delete;
+    ipc_endpoint &operator=(ipc_endpoint &&) = delete;
+
+    ipc_endpoint(const ipc_endpoint &) = delete;
+    ipc_endpoint &operator=(const ipc_endpoint &) = delete;
+};
+
+#endif
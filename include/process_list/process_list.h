@@ -24,18 +24,22 @@
 
 #include <gsl/gsl>
 
-#include <map>
 #include <set>
 #include <list>
+#include <array>
 #include <mutex>
+#include <atomic>
 #include <memory>
 
 #include <vcpuid.h>
 #include <user_data.h>
+#include <object_table.h>
 #include <processlistid.h>
 
 #include <process/process.h>
 #include <process/process_factory.h>
+#include <process_list/run_queue.h>
+#include <process_list/ipc_endpoint.h>
 
 class domain;
 class thread;
@@ -45,6 +49,13 @@ class process_list : public user_data
 {
 public:
 
+    /// Max vCPUs
+    ///
+    /// The maximum number of vCPUs that can execute a process list at the
+    /// same time. Each vCPU is given its own run queue.
+    ///
+    static constexpr const auto max_vcpus = 64UL;
+
     /// Constructor
     ///
     /// @expects none
@@ -116,7 +127,11 @@ public:
 
     /// Add vCPU
     ///
-    /// @expects none
+    /// Each vCPU is given its own run queue. Jobs are only ever pushed onto
+    /// a run queue by the vCPU that owns it, while idle vCPUs steal jobs
+    /// from the other run queues.
+    ///
+    /// @expects vcpu_count() < max_vcpus
     /// @ensures none
     ///
     /// @param id the vcpu id to add to the process list
@@ -125,10 +140,13 @@ public:
 
     /// Remove vCPU
     ///
+    /// The jobs left on the vCPU's run queue remain available to be stolen
+    /// by the remaining vCPUs.
+    ///
     /// @expects none
     /// @ensures none
     ///
-    /// @param id the vcpu id to add to the process list
+    /// @param id the vcpu id to remove from the process list
     ///
     virtual void remove_vcpu(vcpuid::type id);
 
@@ -185,31 +203,189 @@ public:
     ///
     virtual void remove_process(processid::type processid);
 
+    /// Queue Process
+    ///
+    /// Places a process that has runnable threads onto a run queue. If the
+    /// provided vCPU belongs to this process list, the process is placed on
+    /// that vCPU's run queue, otherwise it is placed on the list of new
+    /// jobs that any vCPU can take from. This should only be called when
+    /// process::wake_thread or process::requeue_thread returns true.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param id the id of the vCPU queuing the process
+    /// @param processid the process to queue
+    ///
+    virtual void queue_process(vcpuid::type id, processid::type processid);
+
     /// Get Next Job
     ///
     /// This function is called by a vCPU to get the next thing to execute.
     /// The vCPU will need both the process and the thread in order to setup
-    /// the vCPU for execution.
+    /// the vCPU for execution. The thread that the vCPU was previously
+    /// executing (if it is still running) is placed back onto its
+    /// process's run queue. The next process is then taken from the vCPU's
+    /// run queue, the list of new jobs, or stolen from another vCPU, in that
+    /// order, and the process's next runnable thread is returned. If the
+    /// thread was last executed by a different vCPU, it is migrated to the
+    /// provided vCPU.
     ///
     /// @expects none
     /// @ensures none
     ///
+    /// @param id the id of the vCPU asking for a job
     /// @return returns a thread (and it's parent process) to be executed
-    ///     by a vCPU
+    ///     by a vCPU, or {} if there is nothing for this vCPU to execute
     ///
-    virtual std::pair<thread *, process *> next_job();
+    virtual std::pair<thread *, process *> next_job(vcpuid::type id);
 
     /// Job Count
     ///
     /// @return returns the total number of processes in this process list.
     ///
     auto num_jobs()
-    { return m_process_list.size(); }
+    { return m_num_jobs.load(); }
+
+    /// Migrations
+    ///
+    /// @return returns the number of times a job was migrated from one vCPU
+    ///     to another.
+    ///
+    auto migrations()
+    { return m_migrations.load(); }
+
+    /// vmcall Ring
+    ///
+    /// @return returns the physical address of the vmcall ring registered
+    ///     with this process list, or 0 if no ring is registered
+    ///
+    auto vmcall_ring() const
+    { return m_vmcall_ring.load(); }
+
+    /// Set vmcall Ring
+    ///
+    /// Registers the page that holds the vmcall ring (see vmcall_ring_t)
+    /// used to submit batched vmcalls for this process list.
+    ///
+    /// @expects phys is page aligned
+    /// @ensures none
+    ///
+    /// @param phys the physical address of the vmcall ring
+    ///
+    virtual void set_vmcall_ring(uintptr_t phys);
+
+    /// Handoff
+    ///
+    /// Hands the provided vCPU to a blocked thread, so that the vCPU can
+    /// switch to it (see task::switch_to) without going through the run
+    /// queues. The thread becomes the vCPU's current job.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param id the id of the vCPU the thread will execute on
+    /// @param processid the id of the thread's process
+    /// @param threadid the id of the thread to hand off to
+    /// @return returns the thread, or nullptr if the thread no longer
+    ///     exists or is not blocked, in which case the vCPU has to
+    ///     schedule something else
+    ///
+    virtual thread *handoff(vcpuid::type id, processid::type processid, threadid::type threadid);
+
+    /// Wake Thread
+    ///
+    /// Wakes a blocked thread, and queues its process if needed. Threads
+    /// that no longer exist, or are not blocked, are ignored.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param id the id of the vCPU waking the thread
+    /// @param processid the id of the thread's process
+    /// @param threadid the id of the thread to wake
+    ///
+    virtual void wake_thread(vcpuid::type id, processid::type processid, threadid::type threadid);
+
+    /// Create Endpoint
+    ///
+    /// Creates an IPC endpoint that is served by the provided thread.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param processid the id of the server's process
+    /// @param threadid the id of the server's thread
+    /// @param buffer_phys the physical address of the server's buffer, or
+    ///     0 if the endpoint only takes words
+    /// @param buffer_page the page that backs the server's buffer, which is
+    ///     pinned until the endpoint is deleted (nullptr if there is none)
+    /// @return the id of the new endpoint
+    ///
+    virtual endpointid::type create_endpoint(
+        processid::type processid,
+        threadid::type threadid,
+        uintptr_t buffer_phys,
+        page_pool::shared_page_ptr buffer_page);
+
+    /// Delete Endpoint
+    ///
+    /// Closes and deletes the endpoint. Threads that are blocked on the
+    /// endpoint are woken, and their call (or wait) fails.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param id the id of the vCPU deleting the endpoint
+    /// @param endpointid the endpoint to delete
+    ///
+    virtual void delete_endpoint(vcpuid::type id, endpointid::type endpointid);
+
+    /// Get Endpoint
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param endpointid the id of the endpoint to get
+    /// @return returns the endpoint associated with the provided id
+    ///
+    virtual gsl::not_null<ipc_endpoint *> get_endpoint(endpointid::type endpointid);
+
+    /// Collect
+    ///
+    /// Frees the processes and endpoints that were deleted, once no core
+    /// can still be using them (see object_table::collect). Called at the
+    /// end of each exit, after the core has left its epoch.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    virtual void collect();
 
 private:
 
-    std::unique_ptr<process> &__add_process(processid::type processid, user_data *data);
-    std::unique_ptr<process> &__get_process(processid::type processid);
+    // Processes that have been removed (see remove_process) are kept in the
+    // process table without this tag, so that they can still be deleted.
+
+    static constexpr const auto process_listed = 1UL;
+
+    struct vcpu_run_queue
+    {
+        std::atomic<vcpuid::type> owner;
+
+        processid::type current;
+        threadid::type current_thread;
+
+        run_queue<processid::type> jobs;
+    };
+
+    process *__add_process(processid::type processid, user_data *data);
+
+    process *__get_listed_process(processid::type processid);
+
+    vcpu_run_queue *__get_run_queue(vcpuid::type id);
+    bool __next_new_job(processid::type &processid);
+    bool __steal_job(vcpu_run_queue *thief, processid::type &processid);
 
 private:
 
@@ -223,13 +399,25 @@ private:
     mutable std::mutex m_vcpu_mutex;
     std::set<vcpuid::type> m_vcpuids;
 
+    std::array<vcpu_run_queue, max_vcpus> m_run_queues;
+
 private:
 
     mutable std::mutex m_process_mutex;
-    processid::type m_process_next_id;
-    std::map<processid::type, std::unique_ptr<process>> m_processes;
+    object_table<process, processid::type> m_processes;
+
+    std::list<processid::type> m_new_jobs;
+
+    std::atomic<std::size_t> m_num_jobs;
+    std::atomic<uint64_t> m_migrations;
+
+private:
+
+    std::atomic<uintptr_t> m_vmcall_ring;
+
+private:
 
-    std::list<processid::type> m_process_list;
+    object_table<ipc_endpoint, endpointid::type> m_endpoints;
 
 private:
 
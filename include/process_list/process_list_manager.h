@@ -22,11 +22,10 @@
 #ifndef PROCESS_LIST_MANAGER_H
 #define PROCESS_LIST_MANAGER_H
 
-#include <map>
-#include <mutex>
 #include <memory>
 
 #include <user_data.h>
+#include <object_table.h>
 #include <processlistid.h>
 #include <process_list/process_list_factory.h>
 
@@ -85,14 +84,11 @@ public:
 
 private:
     process_list_manager() noexcept;
-    std::unique_ptr<process_list> &__add_process_list(processlistid::type processlistid, user_data *data);
-    std::unique_ptr<process_list> &__get_process_list(processlistid::type processlistid);
+    process_list *__add_process_list(processlistid::type processlistid, user_data *data);
 
 private:
 
-    mutable std::mutex m_process_list_mutex;
-    processlistid::type m_process_list_next_id;
-    std::map<processlistid::type, std::unique_ptr<process_list>> m_process_lists;
+    object_table<process_list, processlistid::type> m_process_lists;
 
 private:
 
@@ -0,0 +1,218 @@
+//
+// Bareflank Hypervisor
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#ifndef RUN_QUEUE_H
+#define RUN_QUEUE_H
+
+#include <gsl/gsl>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+/// Run Queue
+///
+/// A bounded Chase-Lev work-stealing deque. Only the vCPU that owns the run
+/// queue may push to it, while any vCPU (including the owner) may steal
+/// from it. Stealing takes from the top of the deque, which makes it FIFO,
+/// and is what the owner uses to get its next job so that jobs are executed
+/// round robin. pop() takes from the bottom (LIFO), and is only used to
+/// drain the run queue.
+///
+/// @expects T is trivially copyable
+/// @expects N is a power of 2
+///
+template<typename T, std::size_t N = 1024>
+class run_queue
+{
+    static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+    static_assert((N & (N - 1)) == 0, "N must be a power of 2");
+
+public:
+
+    using value_type = T;
+    using index_type = int64_t;
+
+    /// Default Constructor
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    run_queue() noexcept :
+        m_top(0),
+        m_bottom(0)
+    { }
+
+    /// Destructor
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    ~run_queue() = default;
+
+    /// Push
+    ///
+    /// Adds a job to the bottom of the run queue. Must only be called by
+    /// the owner of the run queue.
+    ///
+    /// @expects size() < N
+    /// @ensures none
+    ///
+    /// @param value the job to add
+    ///
+    void push(value_type value)
+    {
+        auto b = m_bottom.load(std::memory_order_relaxed);
+        auto t = m_top.load(std::memory_order_acquire);
+
+        if (b - t >= static_cast<index_type>(N))
+            throw std::runtime_error("run queue full");
+
+        m_buffer.at(index(b)).store(value, std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    /// Pop
+    ///
+    /// Removes a job from the bottom of the run queue. Must only be called
+    /// by the owner of the run queue.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param value where to store the job
+    /// @return true if a job was removed, false if the run queue is empty
+    ///
+    bool pop(value_type &value)
+    {
+        auto b = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(b, std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = m_top.load(std::memory_order_relaxed);
+
+        if (t > b)
+        {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        value = m_buffer.at(index(b)).load(std::memory_order_relaxed);
+
+        if (t == b)
+        {
+            auto success = m_top.compare_exchange_strong(
+                               t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return success;
+        }
+
+        return true;
+    }
+
+    /// Steal
+    ///
+    /// Removes a job from the top of the run queue. This can be called by
+    /// any vCPU.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param value where to store the job
+    /// @return true if a job was removed, false if the run queue is empty
+    ///
+    bool steal(value_type &value)
+    {
+        while (true)
+        {
+            auto t = m_top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto b = m_bottom.load(std::memory_order_acquire);
+
+            if (t >= b)
+                return false;
+
+            value = m_buffer.at(index(t)).load(std::memory_order_relaxed);
+
+            if (m_top.compare_exchange_strong(
+                    t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                return true;
+            }
+        }
+    }
+
+    /// Size
+    ///
+    /// Note that this is only a snapshot, and may be stale by the time it
+    /// is returned if other vCPUs are accessing the run queue.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the number of jobs in the run queue
+    ///
+    std::size_t size() const noexcept
+    {
+        auto b = m_bottom.load(std::memory_order_relaxed);
+        auto t = m_top.load(std::memory_order_relaxed);
+
+        return b > t ? static_cast<std::size_t>(b - t) : 0;
+    }
+
+    /// Empty
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return true if the run queue is empty, false otherwise
+    ///
+    bool empty() const noexcept
+    { return size() == 0; }
+
+private:
+
+    static std::size_t index(index_type i) noexcept
+    { return static_cast<std::size_t>(i) & (N - 1); }
+
+private:
+
+    std::atomic<index_type> m_top;
+    std::atomic<index_type> m_bottom;
+
+    std::array<std::atomic<value_type>, N> m_buffer;
+
+public:
+
+    run_queue(run_queue &&) = delete;
+    run_queue &operator=(run_queue &&) = delete;
+
+    run_queue(const run_queue &) = delete;
+    run_queue &operator=(const run_queue &) = delete;
+};
+
+#endif
@@ -0,0 +1,78 @@
+//
+// Bareflank Hypervisor
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#ifndef QUANTUM_H
+#define QUANTUM_H
+
+#include <stdint.h>
+
+// *INDENT-OFF*
+
+namespace quantum
+{
+    using type = uint64_t;
+
+    /// Default Ticks per Millisecond
+    ///
+    /// Used until set_ticks_per_ms is given the TSC's actual frequency
+    /// (see entry_intel_x64_hyperkernel.cpp), which is a 2 GHz TSC.
+    ///
+    constexpr const auto default_ticks_per_ms = 2000000UL;
+
+    constexpr const auto task_ms = 100UL;
+    constexpr const auto thread_ms = 10UL;
+    constexpr const auto boost_ms = 1000UL;
+
+    /// Ticks per Millisecond
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the number of TSC ticks in a millisecond
+    ///
+    type ticks_per_ms() noexcept;
+
+    /// Set Ticks per Millisecond
+    ///
+    /// @expects ticks != 0
+    /// @ensures none
+    ///
+    /// @param ticks the number of TSC ticks in a millisecond
+    ///
+    void set_ticks_per_ms(type ticks);
+
+    inline type task() noexcept
+    { return task_ms * ticks_per_ms(); }
+
+    inline type thread() noexcept
+    { return thread_ms * ticks_per_ms(); }
+
+    inline type boost() noexcept
+    { return boost_ms * ticks_per_ms(); }
+
+    inline type now() noexcept
+    { return __builtin_ia32_rdtsc(); }
+}
+
+// *INDENT-ON*
+
+#endif
@@ -26,6 +26,7 @@
 
 #include <list>
 
+#include <quantum.h>
 #include <user_data.h>
 #include <schedulerid.h>
 
@@ -106,19 +107,108 @@ public:
     ///
     virtual void yield();
 
-    /// Yield
+    /// Schedule (args)
     ///
-    /// Yields the current task and schedules the next one.
+    /// Executes the provided thread on the current task.
     ///
-    /// @expects none
+    /// @expects a task has been dispatched
     /// @ensures none
     ///
     virtual void schedule(thread *thrd, uintptr_t entry, uintptr_t arg1, uintptr_t arg2);
 
+    /// Switch To
+    ///
+    /// Executes the provided thread on the current task, without a
+    /// scheduling pass (see task::switch_to).
+    ///
+    /// @expects a task has been dispatched
+    /// @ensures none
+    ///
+    /// @param thrd the thread to execute
+    ///
+    virtual void switch_to(thread *thrd);
+
+    /// Current
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the task that was last dispatched on this scheduler, or
+    ///     nullptr if there is none
+    ///
+    virtual task *current() const
+    { return m_current; }
+
+    /// Preempt
+    ///
+    /// Called when the current thread has used its time slice. This is the
+    /// same as a yield, with the exception that the time spent between
+    /// start and the next task being dispatched is accounted for as
+    /// preemption overhead.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param start the time the preemption started (i.e. when the exit
+    ///     handler was entered)
+    ///
+    virtual void preempt(quantum::type start);
+
+    /// Preemptions
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the number of times a thread has been preempted
+    ///
+    virtual uint64_t preemptions() const
+    { return m_preemptions; }
+
+    /// Preemption Ticks
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the total number of ticks spent handling preemptions
+    ///
+    virtual quantum::type preemption_ticks() const
+    { return m_preemption_ticks; }
+
+protected:
+
+    /// Account Preemption
+    ///
+    /// Must be called by a scheduler right before a task is dispatched so
+    /// that the cost of an outstanding preemption can be accounted for.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    void account_preemption() noexcept;
+
+    /// Set Current
+    ///
+    /// Must be called by a scheduler right before a task is dispatched so
+    /// that schedule() and switch_to() execute on the task that is
+    /// actually running.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param tk the task being dispatched, or nullptr if there is none
+    ///
+    void set_current(task *tk) noexcept
+    { m_current = tk; }
+
 private:
 
     schedulerid::type m_id;
     std::list<task *> m_tasks;
+    task *m_current;
+
+    uint64_t m_preemptions;
+    quantum::type m_preemption_ticks;
+    quantum::type m_preemption_start;
 
 public:
 
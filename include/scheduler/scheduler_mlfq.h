@@ -0,0 +1,176 @@
+//
+// Bareflank Hypervisor
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#ifndef SCHEDULER_MLFQ_H
+#define SCHEDULER_MLFQ_H
+
+#include <gsl/gsl>
+
+#include <list>
+#include <array>
+
+#include <quantum.h>
+#include <scheduler/scheduler.h>
+
+class scheduler_mlfq : public scheduler
+{
+public:
+
+    /// Number of Priority Levels
+    ///
+    /// Level 0 is the highest priority level, and has the shortest
+    /// quantum. Each level below it doubles the quantum, with the last
+    /// level receiving the task's full quantum (see task::task_quantum).
+    ///
+    static constexpr const auto num_levels = 3UL;
+
+    /// Constructor
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    scheduler_mlfq(schedulerid::type id);
+
+    /// Destructor
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    ~scheduler_mlfq() override = default;
+
+    /// Add Task
+    ///
+    /// New tasks start at the highest priority level.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param tk the task to add to the scheduler
+    ///
+    void add_task(gsl::not_null<task *> tk) override;
+
+    /// Remove Task
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param tk the task to remove from the scheduler
+    ///
+    void remove_task(gsl::not_null<task *> tk) override;
+
+    /// Yield
+    ///
+    /// Charges the current task for the time it has executed since it was
+    /// last dispatched, and then schedules the next task. The current task
+    /// keeps the CPU until it has used its quantum (which allows the vCPU
+    /// to rotate through its own threads), at which point it is demoted to
+    /// the next priority level. Tasks with no jobs are only scheduled when
+    /// no other task has work, and a task that has nothing it can execute
+    /// (i.e. its jobs are being executed on other cores) is skipped. All
+    /// tasks are periodically boosted back to the highest priority level
+    /// so that CPU bound tasks cannot starve.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    void yield() override;
+
+    /// Level
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param tk the task to get the priority level of
+    /// @return the priority level of the provided task
+    ///
+    virtual std::size_t level(gsl::not_null<task *> tk) const;
+
+    /// Dispatches
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the number of times a task has been dispatched
+    ///
+    virtual uint64_t dispatches() const
+    { return m_dispatches; }
+
+protected:
+
+    /// Now
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the current time in ticks
+    ///
+    virtual quantum::type now() const
+    { return quantum::now(); }
+
+    /// Level Quantum
+    ///
+    /// @expects level < num_levels
+    /// @ensures none
+    ///
+    /// @param tk the task to get the quantum of
+    /// @param level the priority level
+    /// @return the number of ticks the task may execute at the provided
+    ///     level before it is demoted
+    ///
+    virtual quantum::type level_quantum(gsl::not_null<task *> tk, std::size_t level) const;
+
+private:
+
+    struct mlfq_task
+    {
+        task *tk;
+        quantum::type used;
+    };
+
+    using level_type = std::list<mlfq_task>;
+
+    bool account(quantum::type now);
+    void boost(quantum::type now);
+
+    void dispatch(gsl::not_null<task *> tk, quantum::type now);
+
+private:
+
+    std::array<level_type, num_levels> m_levels;
+
+    quantum::type m_dispatched;
+    quantum::type m_last_boost;
+
+    uint64_t m_dispatches;
+
+public:
+
+    friend class hyperkernel_ut;
+
+    scheduler_mlfq(scheduler_mlfq &&) = default;
+    scheduler_mlfq &operator=(scheduler_mlfq &&) = default;
+
+    scheduler_mlfq(const scheduler_mlfq &) = delete;
+    scheduler_mlfq &operator=(const scheduler_mlfq &) = delete;
+};
+
+#endif
@@ -0,0 +1,56 @@
+//
+// Bareflank Hypervisor
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#ifndef SCHEDULER_DATA_H
+#define SCHEDULER_DATA_H
+
+#include <gsl/gsl>
+#include <user_data.h>
+
+enum class scheduler_policy
+{
+    fcfs,
+    mlfq
+};
+
+class scheduler_data : public user_data
+{
+public:
+
+    scheduler_data() noexcept :
+        m_policy(scheduler_policy::mlfq)
+    { }
+
+    ~scheduler_data() override = default;
+
+    scheduler_policy m_policy;
+
+public:
+
+    scheduler_data(scheduler_data &&) = default;
+    scheduler_data &operator=(scheduler_data &&) = default;
+
+    scheduler_data(const scheduler_data &) = delete;
+    scheduler_data &operator=(const scheduler_data &) = delete;
+};
+
+#endif
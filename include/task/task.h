@@ -26,6 +26,7 @@
 
 #include <coreid.h>
 #include <vcpuid.h>
+#include <quantum.h>
 
 class domain;
 class thread;
@@ -64,7 +65,8 @@ public:
     /// Executes this task. Note that the task is really a vCPU, which could
     /// be executing a bunch of VM apps, or a single Thick VM. For this reason,
     /// this is a pure virtual function as the vCPU needs to implement this
-    /// function based on how the hardware executes a VM.
+    /// function based on how the hardware executes a VM. This function only
+    /// returns if the task had nothing it could execute.
     ///
     /// @expects none
     /// @ensures none
@@ -83,12 +85,70 @@ public:
     ///
     virtual void schedule(thread *thrd, uintptr_t entry, uintptr_t arg1, uintptr_t arg2) = 0;
 
+    /// Switch To
+    ///
+    /// Executes the provided thread right away, without picking the next
+    /// job from the process list. The thread is given what is left of the
+    /// current thread's time slice. This is used to hand a vCPU from one
+    /// thread to another (e.g. IPC), and as with schedule, this is a pure
+    /// virtual function as the vCPU needs to implement it.
+    ///
+    /// @expects the thread was handed off to this task's vCPU (see
+    ///     process_list::handoff)
+    /// @ensures none
+    ///
+    /// @param thrd the thread to execute
+    ///
+    virtual void switch_to(thread *thrd) = 0;
+
     /// Done
     ///
     /// @return returns true if there is no more work to be done,
     ///     false otherwise
     virtual size_t num_jobs();
 
+    /// Task Quantum
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the number of ticks this task may execute before the
+    ///     scheduler moves onto another task
+    ///
+    virtual quantum::type task_quantum() const
+    { return m_task_quantum; }
+
+    /// Set Task Quantum
+    ///
+    /// @expects ticks != 0
+    /// @ensures none
+    ///
+    /// @param ticks the number of ticks this task may execute before the
+    ///     scheduler moves onto another task
+    ///
+    virtual void set_task_quantum(quantum::type ticks);
+
+    /// Thread Quantum
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the number of ticks a thread executing on this task may
+    ///     execute before it is preempted
+    ///
+    virtual quantum::type thread_quantum() const
+    { return m_thread_quantum; }
+
+    /// Set Thread Quantum
+    ///
+    /// @expects ticks != 0
+    /// @ensures none
+    ///
+    /// @param ticks the number of ticks a thread executing on this task may
+    ///     execute before it is preempted
+    ///
+    virtual void set_thread_quantum(quantum::type ticks);
+
 private:
 
     coreid::type m_coreid;
@@ -96,6 +156,9 @@ private:
     gsl::not_null<process_list *> m_proclt;
     gsl::not_null<domain *> m_domain;
 
+    quantum::type m_task_quantum;
+    quantum::type m_thread_quantum;
+
 public:
 
     friend class hyperkernel_ut;
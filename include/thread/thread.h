@@ -26,11 +26,28 @@
 
 #include <memory>
 
+#include <vcpuid.h>
 #include <user_data.h>
 #include <threadid.h>
 
 class process;
 
+/// Thread State
+///
+/// - runnable: the thread is waiting in its process's run queue
+/// - running: the thread is being executed by a vCPU
+/// - blocked: the thread is waiting for an event (or has not been given an
+///   entry point yet)
+/// - exited: the thread will never execute again
+///
+enum class thread_state
+{
+    runnable,
+    running,
+    blocked,
+    exited
+};
+
 class thread : public user_data
 {
 public:
@@ -124,6 +141,94 @@ public:
     virtual threadid::type id() const
     { return m_id; }
 
+    /// Thread vCPU Id
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the id of the vCPU that owns this thread (i.e. the vCPU
+    ///     that last executed this thread), or vcpuid::invalid if the
+    ///     thread has not been executed yet
+    ///
+    virtual vcpuid::type vcpuid() const
+    { return m_vcpuid; }
+
+    /// Set Thread vCPU Id
+    ///
+    /// Migrates the thread to the provided vCPU.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param id the id of the vCPU that owns this thread
+    ///
+    virtual void set_vcpuid(vcpuid::type id)
+    { m_vcpuid = id; }
+
+    /// Thread State
+    ///
+    /// Note that the thread's state is owned by its process, which is
+    /// responsible for moving the thread in and out of its run queue.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the thread's current state
+    ///
+    virtual thread_state state() const
+    { return m_state; }
+
+    /// Set Thread State
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param state the thread's new state
+    ///
+    virtual void set_state(thread_state state)
+    { m_state = state; }
+
+    /// Return Value
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the value the thread passed to thread_exit
+    ///
+    virtual uint64_t retval() const
+    { return m_retval; }
+
+    /// Set Return Value
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param retval the value the thread passed to thread_exit
+    ///
+    virtual void set_retval(uint64_t retval)
+    { m_retval = retval; }
+
+    /// Joiner
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return the id of the thread waiting for this thread to exit, or
+    ///     threadid::invalid if no thread has joined this thread
+    ///
+    virtual threadid::type joiner() const
+    { return m_joiner; }
+
+    /// Set Joiner
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param threadid the id of the thread waiting for this thread to exit
+    ///
+    virtual void set_joiner(threadid::type threadid)
+    { m_joiner = threadid; }
+
     /// Is Running
     ///
     /// @expects none
@@ -149,6 +254,12 @@ private:
     threadid::type m_id;
     process *m_proc;
 
+    vcpuid::type m_vcpuid;
+    thread_state m_state;
+
+    uint64_t m_retval;
+    threadid::type m_joiner;
+
     bool m_is_running;
     bool m_is_initialized;
 
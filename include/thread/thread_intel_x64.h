@@ -58,6 +58,38 @@ public:
     ///
     void set_info(uintptr_t entry, uintptr_t stack, uintptr_t arg1, uintptr_t arg2) override;
 
+    /// Save State
+    ///
+    /// Saves a vCPU's state save as this thread's state. The state save is
+    /// made up of the guest's general purpose registers, the fields that
+    /// belong to the VMM (vcpuid through exit_handler_ptr), and the guest's
+    /// extended state (everything after the VMM's fields). The VMM's fields
+    /// are not saved.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param state_save the vCPU's state save
+    ///
+    void save_state(const state_save_intel_x64 &state_save);
+
+    /// Load State
+    ///
+    /// Loads this thread's state into a vCPU's state save, leaving the
+    /// VMM's fields alone. The guest's extended state is only loaded if
+    /// the vCPU's state save does not already hold it, which is the case
+    /// if this thread was the last thread the vCPU executed, and this
+    /// thread has not been saved to any other state save since.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @param state_save the vCPU's state save
+    /// @param resumed true if this thread was the last thread loaded into
+    ///     the provided state save, false otherwise
+    ///
+    void load_state(state_save_intel_x64 &state_save, bool resumed);
+
     /// TODO:
     ///
     /// These should not be public
@@ -65,6 +97,10 @@ public:
     uintptr_t m_stack;
     state_save_intel_x64 m_state_save;
 
+private:
+
+    const state_save_intel_x64 *m_extended_state_owner;
+
 public:
 
     friend class hyperkernel_ut;
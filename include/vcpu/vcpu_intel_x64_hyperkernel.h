@@ -150,9 +150,23 @@ public:
     virtual gsl::not_null<domain_intel_x64 *> get_domain() const
     { return m_domain; }
 
+    /// Is Host vCPU
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @return true if this is the host vCPU for this core (i.e. the guest
+    ///     portion of its vcpuid is 0), false otherwise
+    ///
+    virtual bool is_host_vcpu() const
+    { return (this->id() & vcpuid::guest_mask) == 0; }
+
     /// Schedule
     ///
-    /// Executes this vCPU.
+    /// Executes this vCPU. If this is a guest vCPU and there is nothing
+    /// in the process list that this vCPU can execute (e.g. all of the jobs
+    /// are being executed by other vCPUs), this function returns so that
+    /// the scheduler can pick another task.
     ///
     /// @expects none
     /// @ensures none
@@ -173,6 +187,17 @@ public:
     ///
     void schedule(thread *thrd, uintptr_t entry, uintptr_t arg1, uintptr_t arg2) override;
 
+    /// Switch To
+    ///
+    /// Executes this vCPU.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    /// @see task::switch_to
+    ///
+    void switch_to(thread *thrd) override;
+
     /// Schedule
     ///
     /// Executes this vCPU.
@@ -183,8 +208,11 @@ public:
     /// @param proc the process to execute
     /// @param thrd the thread to execute
     /// @param state_save the state save for the process
+    /// @param donate if true, the thread is given what is left of the
+    ///     current time slice instead of a new one
     ///
-    void schedule(process_intel_x64 *proc, thread_intel_x64 *thrd, state_save_intel_x64 *state_save);
+    void schedule(
+        process_intel_x64 *proc, thread_intel_x64 *thrd, state_save_intel_x64 *state_save, bool donate = false);
 
     /// Next vCPU ID
     ///
@@ -209,6 +237,9 @@ private:
     gsl::not_null<vmcs_intel_x64_hyperkernel *> m_vmcs_hyperkernel;
     gsl::not_null<exit_handler_intel_x64_hyperkernel *> m_exit_handler_hyperkernel;
 
+    thread_intel_x64 *m_loaded_thread;
+    uint64_t m_loaded_eptp;
+
 public:
 
     friend class hyperkernel_ut;
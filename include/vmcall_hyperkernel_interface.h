@@ -65,19 +65,42 @@ enum hyperkernel_vmcall_functions
     hyperkernel_vmcall__delete_process = 0x302,
     hyperkernel_vmcall__run_process = 0x303,
     hyperkernel_vmcall__hlt_process = 0x304,
+    hyperkernel_vmcall__fork = 0x305,
 
     hyperkernel_vmcall__vm_map = 0x401,
     hyperkernel_vmcall__vm_map_lookup = 0x402,
+    hyperkernel_vmcall__vm_reserve = 0x403,
+    hyperkernel_vmcall__vm_map_segment = 0x404,
 
     hyperkernel_vmcall__set_thread_info = 0x501,
+    hyperkernel_vmcall__create_thread = 0x502,
+    hyperkernel_vmcall__thread_exit = 0x503,
+    hyperkernel_vmcall__thread_join = 0x504,
+
+    hyperkernel_vmcall__register_vmcall_ring = 0x601,
+    hyperkernel_vmcall__vmcall_ring_doorbell = 0x602,
 
     hyperkernel_vmcall__sched_yield = 0x1001,
     hyperkernel_vmcall__sched_yield_and_remove = 0x1002,
 
+    hyperkernel_vmcall__futex_wait = 0x1201,
+    hyperkernel_vmcall__futex_wake = 0x1202,
+
     hyperkernel_vmcall__set_program_break = 0x1101,
     hyperkernel_vmcall__increase_program_break = 0x1102,
     hyperkernel_vmcall__decrease_program_break = 0x1103,
 
+    hyperkernel_vmcall__mmap = 0x1301,
+    hyperkernel_vmcall__munmap = 0x1302,
+    hyperkernel_vmcall__mprotect = 0x1303,
+
+    hyperkernel_vmcall__dump_exit_stats = 0x1401,
+
+    hyperkernel_vmcall__ipc_create_endpoint = 0x1501,
+    hyperkernel_vmcall__ipc_delete_endpoint = 0x1502,
+    hyperkernel_vmcall__ipc_call = 0x1503,
+    hyperkernel_vmcall__ipc_reply_wait = 0x1504,
+
     // TODO:
     //
     // These need to be made more generic
@@ -85,10 +108,96 @@ enum hyperkernel_vmcall_functions
 
     hyperkernel_vmcall__ttys0 = 0x2001,
     hyperkernel_vmcall__ttys1 = 0x2002,
+    hyperkernel_vmcall__ttys0_flush = 0x2003,
+    hyperkernel_vmcall__ttys1_write = 0x2004,
     hyperkernel_vmcall__register_ttys0 = 0x3001,
 
 };
 
+//
+// vmcall Ring
+//
+// A page of vmcalls that is registered once per process list. Requests are
+// written to the entries using the same registers that the vmcall would
+// use, and the head is advanced. A single doorbell vmcall then executes
+// all of the requests between the tail and the head, in order, writing the
+// result of each request back into its entry (r01 is set to REG_SUCCESS or
+// REG_INVALID, and r03 holds the result if there is one), and advancing
+// the tail. Once a request fails, the requests after it are not executed,
+// and are marked as failed. Only vmcalls that do not change the state of
+// the caller (i.e. map and thread setup requests) can be submitted this way.
+// Only the host can register a ring, or ring its doorbell.
+//
+
+#define VMCALL_RING_ENTRIES 31
+
+struct vmcall_ring_t
+{
+    uint64_t head;
+    uint64_t tail;
+    uint64_t reserved[14];
+
+    struct vmcall_registers_t entries[VMCALL_RING_ENTRIES];
+};
+
+//
+// ttys Ring
+//
+// A page of output owned by a process. Bytes are written to the data at
+// the head (modulo the size of the data), and the head is advanced. A
+// flush vmcall then hands all of the bytes between the tail and the head
+// to ttys0 at once (i.e. to the registered ttys0 driver, in a single
+// schedule, or to the VMM's serial port if there is no driver), and
+// advances the tail. The ring is passed to every flush, so it does not
+// need to be registered.
+//
+// A registered ttys0 driver is given a page aligned buffer of at least
+// TTYS0_BUFFER_SIZE bytes when it registers, and its entry point is called
+// with the buffer and the number of bytes in it.
+//
+
+#define TTYS_RING_SIZE 0xF80
+#define TTYS0_BUFFER_SIZE 0x1000
+
+struct ttys_ring_t
+{
+    uint64_t head;
+    uint64_t tail;
+    uint64_t reserved[14];
+
+    char data[TTYS_RING_SIZE];
+};
+
+//
+// IPC
+//
+// Synchronous, L4 style message passing between the threads of a process
+// list. An endpoint is served by the thread that creates it. A client
+// calls the endpoint and blocks until the server replies, while the
+// server replies to its last call and waits for the next one in a single
+// vmcall. When the other side is already waiting, the vCPU is handed
+// straight to it (along with what is left of the time slice), without
+// going through the scheduler.
+//
+// Each message carries IPC_MESSAGE_WORDS words, which are passed in
+// registers, and up to IPC_BUFFER_SIZE bytes. The server's buffer is given
+// when the endpoint is created, and must be page aligned. A client's
+// buffer is given with each call, and must be IPC_BUFFER_SIZE bytes, as
+// the reply is copied into it. The badge of a call is the id of the
+// client's process. A server's first reply_wait has no call to reply to,
+// so its reply is ignored.
+//
+
+#define IPC_MESSAGE_WORDS 4
+#define IPC_BUFFER_SIZE 0x1000
+
+struct ipc_message_t
+{
+    uint64_t badge;
+    uint64_t words[IPC_MESSAGE_WORDS];
+    uint64_t len;
+};
+
 inline uint64_t
 vmcall__create_process_list(void)
 {
@@ -243,6 +352,23 @@ vmcall__delete_foreign_process(uint64_t procltid, uint64_t processid)
     return regs.r01 == REG_SUCCESS;
 }
 
+inline uint64_t
+vmcall__fork()
+{
+    struct vmcall_registers_t regs = struct_init;
+
+    regs.r00 = VMCALL_REGISTERS;
+    regs.r01 = VMCALL_MAGIC_NUMBER;
+    regs.r02 = hyperkernel_vmcall__fork;                        // vmcall index
+
+    vmcall(&regs);
+
+    if (regs.r01 == REG_SUCCESS)
+        return regs.r03;
+
+    return REG_INVALID;
+}
+
 inline bool
 vmcall__vm_map_foreign(
     uint64_t procltid,
@@ -295,6 +421,91 @@ vmcall__vm_map_foreign_lookup(
     return regs.r01 == 0;
 }
 
+inline bool
+vmcall__vm_reserve_foreign(
+    uint64_t procltid,
+    uint64_t processid,
+    uint64_t virt,
+    uint64_t addr,
+    uint64_t size,
+    uint64_t perm)
+{
+    struct vmcall_registers_t regs = struct_init;
+
+    regs.r00 = VMCALL_REGISTERS;
+    regs.r01 = VMCALL_MAGIC_NUMBER;
+    regs.r02 = hyperkernel_vmcall__vm_reserve;                  // vmcall index
+    regs.r03 = procltid;                                        // process list id
+    regs.r04 = processid;                                       // process id
+    regs.r05 = virt;                                            // virtual address to reserve
+    regs.r06 = addr;                                            // virtual address of the initial contents, or 0
+    regs.r07 = size;                                            // size of the reservation
+    regs.r08 = perm;                                            // PROT_ permissions
+
+    vmcall(&regs);
+
+    return regs.r01 == 0;
+}
+
+inline bool
+vmcall__vm_map_foreign_segment(
+    uint64_t procltid,
+    uint64_t processid,
+    uint64_t virt,
+    uint64_t addr,
+    uint64_t size,
+    uint64_t file_id,
+    uint64_t file_offset)
+{
+    struct vmcall_registers_t regs = struct_init;
+
+    regs.r00 = VMCALL_REGISTERS;
+    regs.r01 = VMCALL_MAGIC_NUMBER;
+    regs.r02 = hyperkernel_vmcall__vm_map_segment;              // vmcall index
+    regs.r03 = procltid;                                        // process list id
+    regs.r04 = processid;                                       // process id
+    regs.r05 = virt;                                            // virtual address for the map
+    regs.r06 = addr;                                            // virtual address of the segment, used if not cached
+    regs.r07 = size;                                            // size of the segment
+    regs.r08 = file_id;                                         // id of the file the segment is from
+    regs.r09 = file_offset;                                     // offset of the segment in the file
+
+    vmcall(&regs);
+
+    return regs.r01 == 0;
+}
+
+inline bool
+vmcall__register_vmcall_ring(uint64_t procltid, uint64_t ring)
+{
+    struct vmcall_registers_t regs = struct_init;
+
+    regs.r00 = VMCALL_REGISTERS;
+    regs.r01 = VMCALL_MAGIC_NUMBER;
+    regs.r02 = hyperkernel_vmcall__register_vmcall_ring;        // vmcall index
+    regs.r03 = procltid;                                        // process list id
+    regs.r04 = ring;                                            // virtual address of the ring
+
+    vmcall(&regs);
+
+    return regs.r01 == REG_SUCCESS;
+}
+
+inline bool
+vmcall__vmcall_ring_doorbell(uint64_t procltid)
+{
+    struct vmcall_registers_t regs = struct_init;
+
+    regs.r00 = VMCALL_REGISTERS;
+    regs.r01 = VMCALL_MAGIC_NUMBER;
+    regs.r02 = hyperkernel_vmcall__vmcall_ring_doorbell;        // vmcall index
+    regs.r03 = procltid;                                        // process list id
+
+    vmcall(&regs);
+
+    return regs.r01 == REG_SUCCESS;
+}
+
 inline bool
 vmcall__set_thread_info(
     uint64_t threadid,
@@ -349,6 +560,93 @@ vmcall__set_thread_foreign_info(
     return regs.r01 == 0;
 }
 
+inline uint64_t
+vmcall__create_thread(
+    uint64_t entry,
+    uint64_t stack,
+    uint64_t arg1,
+    uint64_t arg2)
+{
+    struct vmcall_registers_t regs = struct_init;
+
+    regs.r00 = VMCALL_REGISTERS;
+    regs.r01 = VMCALL_MAGIC_NUMBER;
+    regs.r02 = hyperkernel_vmcall__create_thread;               // vmcall index
+    regs.r03 = REG_CURRENT;                                     // process list id
+    regs.r04 = REG_CURRENT;                                     // process id
+    regs.r05 = entry;
+    regs.r06 = stack;
+    regs.r07 = arg1;
+    regs.r08 = arg2;
+
+    vmcall(&regs);
+
+    if (regs.r01 == 0)
+        return regs.r03;
+
+    return REG_INVALID;
+}
+
+inline uint64_t
+vmcall__create_foreign_thread(
+    uint64_t procltid,
+    uint64_t processid,
+    uint64_t entry,
+    uint64_t stack,
+    uint64_t arg1,
+    uint64_t arg2)
+{
+    struct vmcall_registers_t regs = struct_init;
+
+    regs.r00 = VMCALL_REGISTERS;
+    regs.r01 = VMCALL_MAGIC_NUMBER;
+    regs.r02 = hyperkernel_vmcall__create_thread;               // vmcall index
+    regs.r03 = procltid;                                        // process list id
+    regs.r04 = processid;                                       // process id
+    regs.r05 = entry;
+    regs.r06 = stack;
+    regs.r07 = arg1;
+    regs.r08 = arg2;
+
+    vmcall(&regs);
+
+    if (regs.r01 == 0)
+        return regs.r03;
+
+    return REG_INVALID;
+}
+
+inline void
+vmcall__thread_exit(uint64_t retval)
+{
+    struct vmcall_registers_t regs = struct_init;
+
+    regs.r00 = VMCALL_REGISTERS;
+    regs.r01 = VMCALL_MAGIC_NUMBER;
+    regs.r02 = hyperkernel_vmcall__thread_exit;                 // vmcall index
+    regs.r03 = retval;                                          // return value
+
+    vmcall(&regs);
+}
+
+inline bool
+vmcall__thread_join(uint64_t threadid, uint64_t *retval)
+{
+    struct vmcall_registers_t regs = struct_init;
+
+    regs.r00 = VMCALL_REGISTERS;
+    regs.r01 = VMCALL_MAGIC_NUMBER;
+    regs.r02 = hyperkernel_vmcall__thread_join;                 // vmcall index
+    regs.r03 = threadid;                                        // thread id
+
+    vmcall(&regs);
+
+    if (retval != 0)
+        *retval = regs.r03;
+
+    return regs.r01 == REG_SUCCESS;
+}
+
 inline bool
 vmcall__sched_yield()
 {
@@ -377,6 +675,41 @@ vmcall__sched_yield_and_remove()
     return regs.r01 == REG_SUCCESS;
 }
 
+inline bool
+vmcall__futex_wait(uint64_t addr, uint64_t expected)
+{
+    struct vmcall_registers_t regs = struct_init;
+
+    regs.r00 = VMCALL_REGISTERS;
+    regs.r01 = VMCALL_MAGIC_NUMBER;
+    regs.r02 = hyperkernel_vmcall__futex_wait;                  // vmcall index
+    regs.r03 = addr;                                            // address
+    regs.r04 = expected;                                        // expected value
+
+    vmcall(&regs);
+
+    return regs.r01 == REG_SUCCESS;
+}
+
+inline uint64_t
+vmcall__futex_wake(uint64_t addr, uint64_t num)
+{
+    struct vmcall_registers_t regs = struct_init;
+
+    regs.r00 = VMCALL_REGISTERS;
+    regs.r01 = VMCALL_MAGIC_NUMBER;
+    regs.r02 = hyperkernel_vmcall__futex_wake;                  // vmcall index
+    regs.r03 = addr;                                            // address
+    regs.r04 = num;                                             // max threads to wake
+
+    vmcall(&regs);
+
+    if (regs.r01 == REG_SUCCESS)
+        return regs.r03;
+
+    return 0;
+}
+
 inline bool
 vmcall__set_program_break(uint64_t program_break)
 {
@@ -395,7 +728,7 @@ vmcall__set_program_break(uint64_t program_break)
 }
 
 inline bool
-vmcall__increase_program_break()
+vmcall__increase_program_break(uint64_t num_pages)
 {
     struct vmcall_registers_t regs = struct_init;
 
@@ -404,6 +737,7 @@ vmcall__increase_program_break()
     regs.r02 = hyperkernel_vmcall__increase_program_break;      // vmcall index
     regs.r03 = REG_CURRENT;                                     // process list id
     regs.r04 = REG_CURRENT;                                     // process id
+    regs.r05 = num_pages;                                       // number of 4k pages
 
     vmcall(&regs);
 
@@ -411,7 +745,7 @@ vmcall__increase_program_break()
 }
 
 inline bool
-vmcall__increase_foreign_program_break(uint64_t procltid, uint64_t processid)
+vmcall__increase_foreign_program_break(uint64_t procltid, uint64_t processid, uint64_t num_pages)
 {
     struct vmcall_registers_t regs = struct_init;
 
@@ -420,6 +754,7 @@ vmcall__increase_foreign_program_break(uint64_t procltid, uint64_t processid)
     regs.r02 = hyperkernel_vmcall__increase_program_break;      // vmcall index
     regs.r03 = procltid;                                        // process list id
     regs.r04 = processid;                                       // process id
+    regs.r05 = num_pages;                                       // number of 4k pages
 
     vmcall(&regs);
 
@@ -427,7 +762,7 @@ vmcall__increase_foreign_program_break(uint64_t procltid, uint64_t processid)
 }
 
 inline bool
-vmcall__decrease_program_break()
+vmcall__decrease_program_break(uint64_t num_pages)
 {
     struct vmcall_registers_t regs = struct_init;
 
@@ -436,6 +771,7 @@ vmcall__decrease_program_break()
     regs.r02 = hyperkernel_vmcall__decrease_program_break;      // vmcall index
     regs.r03 = REG_CURRENT;                                     // process list id
     regs.r04 = REG_CURRENT;                                     // process id
+    regs.r05 = num_pages;                                       // number of 4k pages
 
     vmcall(&regs);
 
@@ -443,7 +779,7 @@ vmcall__decrease_program_break()
 }
 
 inline bool
-vmcall__decrease_foreign_program_break(uint64_t procltid, uint64_t processid)
+vmcall__decrease_foreign_program_break(uint64_t procltid, uint64_t processid, uint64_t num_pages)
 {
     struct vmcall_registers_t regs = struct_init;
 
@@ -452,9 +788,172 @@ vmcall__decrease_foreign_program_break(uint64_t procltid, uint64_t processid)
     regs.r02 = hyperkernel_vmcall__decrease_program_break;      // vmcall index
     regs.r03 = procltid;                                        // process list id
     regs.r04 = processid;                                       // process id
+    regs.r05 = num_pages;                                       // number of 4k pages
+
+    vmcall(&regs);
+
+    return regs.r01 == REG_SUCCESS;
+}
+
+inline uint64_t
+vmcall__mmap(uint64_t addr, uint64_t size, uint64_t perm, uint64_t lazy)
+{
+    struct vmcall_registers_t regs = struct_init;
+
+    regs.r00 = VMCALL_REGISTERS;
+    regs.r01 = VMCALL_MAGIC_NUMBER;
+    regs.r02 = hyperkernel_vmcall__mmap;                        // vmcall index
+    regs.r03 = addr;                                            // address hint
+    regs.r04 = size;                                            // size of the map
+    regs.r05 = perm;                                            // PROT_ permissions
+    regs.r06 = lazy;                                            // 1 to allocate pages on first touch
+
+    vmcall(&regs);
+
+    if (regs.r01 == REG_SUCCESS)
+        return regs.r03;
+
+    return REG_INVALID;
+}
+
+inline bool
+vmcall__munmap(uint64_t addr, uint64_t size)
+{
+    struct vmcall_registers_t regs = struct_init;
+
+    regs.r00 = VMCALL_REGISTERS;
+    regs.r01 = VMCALL_MAGIC_NUMBER;
+    regs.r02 = hyperkernel_vmcall__munmap;                      // vmcall index
+    regs.r03 = addr;                                            // address
+    regs.r04 = size;                                            // size of the unmap
+
+    vmcall(&regs);
+
+    return regs.r01 == REG_SUCCESS;
+}
+
+inline bool
+vmcall__mprotect(uint64_t addr, uint64_t size, uint64_t perm)
+{
+    struct vmcall_registers_t regs = struct_init;
+
+    regs.r00 = VMCALL_REGISTERS;
+    regs.r01 = VMCALL_MAGIC_NUMBER;
+    regs.r02 = hyperkernel_vmcall__mprotect;                    // vmcall index
+    regs.r03 = addr;                                            // address
+    regs.r04 = size;                                            // size of the range
+    regs.r05 = perm;                                            // PROT_ permissions
+
+    vmcall(&regs);
+
+    return regs.r01 == REG_SUCCESS;
+}
+
+inline bool
+vmcall__dump_exit_stats(uint64_t vcpuid)
+{
+    struct vmcall_registers_t regs = struct_init;
+
+    regs.r00 = VMCALL_REGISTERS;
+    regs.r01 = VMCALL_MAGIC_NUMBER;
+    regs.r02 = hyperkernel_vmcall__dump_exit_stats;             // vmcall index
+    regs.r03 = vcpuid;                                          // vcpu id (REG_CURRENT, or REG_INVALID for all)
+
+    vmcall(&regs);
+
+    return regs.r01 == REG_SUCCESS;
+}
+
+inline uint64_t
+vmcall__ipc_create_endpoint(uintptr_t buffer)
+{
+    struct vmcall_registers_t regs = struct_init;
+
+    regs.r00 = VMCALL_REGISTERS;
+    regs.r01 = VMCALL_MAGIC_NUMBER;
+    regs.r02 = hyperkernel_vmcall__ipc_create_endpoint;         // vmcall index
+    regs.r03 = buffer;                                          // virtual address of the server's buffer (or 0)
+
+    vmcall(&regs);
+
+    if (regs.r01 == REG_SUCCESS)
+        return regs.r03;
+
+    return REG_INVALID;
+}
+
+inline bool
+vmcall__ipc_delete_endpoint(uint64_t endpointid)
+{
+    struct vmcall_registers_t regs = struct_init;
+
+    regs.r00 = VMCALL_REGISTERS;
+    regs.r01 = VMCALL_MAGIC_NUMBER;
+    regs.r02 = hyperkernel_vmcall__ipc_delete_endpoint;         // vmcall index
+    regs.r03 = endpointid;                                      // endpoint id
+
+    vmcall(&regs);
+
+    return regs.r01 == REG_SUCCESS;
+}
+
+inline bool
+vmcall__ipc_call(uint64_t endpointid, struct ipc_message_t *msg, uintptr_t buffer)
+{
+    struct vmcall_registers_t regs = struct_init;
+
+    regs.r00 = VMCALL_REGISTERS;
+    regs.r01 = VMCALL_MAGIC_NUMBER;
+    regs.r02 = hyperkernel_vmcall__ipc_call;                    // vmcall index
+    regs.r03 = endpointid;                                      // endpoint id
+    regs.r04 = msg->words[0];                                   // message words
+    regs.r05 = msg->words[1];
+    regs.r06 = msg->words[2];
+    regs.r07 = msg->words[3];
+    regs.r08 = buffer;                                          // virtual address of the client's buffer (or 0)
+    regs.r09 = msg->len;                                        // number of bytes in the buffer
+
+    vmcall(&regs);
+
+    if (regs.r01 == REG_SUCCESS)
+    {
+        msg->words[0] = regs.r04;
+        msg->words[1] = regs.r05;
+        msg->words[2] = regs.r06;
+        msg->words[3] = regs.r07;
+        msg->len = regs.r09;
+    }
+
+    return regs.r01 == REG_SUCCESS;
+}
+
+inline bool
+vmcall__ipc_reply_wait(uint64_t endpointid, struct ipc_message_t *msg)
+{
+    struct vmcall_registers_t regs = struct_init;
+
+    regs.r00 = VMCALL_REGISTERS;
+    regs.r01 = VMCALL_MAGIC_NUMBER;
+    regs.r02 = hyperkernel_vmcall__ipc_reply_wait;              // vmcall index
+    regs.r03 = endpointid;                                      // endpoint id
+    regs.r04 = msg->words[0];                                   // reply words
+    regs.r05 = msg->words[1];
+    regs.r06 = msg->words[2];
+    regs.r07 = msg->words[3];
+    regs.r09 = msg->len;                                        // number of bytes in the server's buffer
 
     vmcall(&regs);
 
+    if (regs.r01 == REG_SUCCESS)
+    {
+        msg->badge = regs.r03;
+        msg->words[0] = regs.r04;
+        msg->words[1] = regs.r05;
+        msg->words[2] = regs.r06;
+        msg->words[3] = regs.r07;
+        msg->len = regs.r09;
+    }
+
     return regs.r01 == REG_SUCCESS;
 }
 
@@ -489,14 +988,46 @@ vmcall__ttys1(char val)
 }
 
 inline bool
-vmcall__register_ttys0(uintptr_t func)
+vmcall__ttys0_flush(uintptr_t ring)
+{
+    struct vmcall_registers_t regs = struct_init;
+
+    regs.r00 = VMCALL_REGISTERS;
+    regs.r01 = VMCALL_MAGIC_NUMBER;
+    regs.r02 = hyperkernel_vmcall__ttys0_flush;                 // vmcall index
+    regs.r03 = ring;                                            // virtual address of the ring
+
+    vmcall(&regs);
+
+    return regs.r01 == REG_SUCCESS;
+}
+
+inline bool
+vmcall__ttys1_write(uintptr_t buf, uint64_t len)
+{
+    struct vmcall_registers_t regs = struct_init;
+
+    regs.r00 = VMCALL_REGISTERS;
+    regs.r01 = VMCALL_MAGIC_NUMBER;
+    regs.r02 = hyperkernel_vmcall__ttys1_write;                 // vmcall index
+    regs.r03 = buf;                                             // virtual address of the bytes
+    regs.r04 = len;                                             // number of bytes
+
+    vmcall(&regs);
+
+    return regs.r01 == REG_SUCCESS;
+}
+
+inline bool
+vmcall__register_ttys0(uintptr_t func, uintptr_t buffer)
 {
     struct vmcall_registers_t regs = struct_init;
 
     regs.r00 = VMCALL_REGISTERS;
     regs.r01 = VMCALL_MAGIC_NUMBER;
-    regs.r02 = hyperkernel_vmcall__register_ttys0;
-    regs.r03 = func;
+    regs.r02 = hyperkernel_vmcall__register_ttys0;              // vmcall index
+    regs.r03 = func;                                            // driver entry point
+    regs.r04 = buffer;                                          // virtual address of the driver's buffer
 
     vmcall(&regs);
 
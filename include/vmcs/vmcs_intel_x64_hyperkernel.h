@@ -26,6 +26,7 @@
 
 #include <coreid.h>
 #include <vcpuid.h>
+#include <quantum.h>
 #include <vmcs/vmcs_intel_x64_eapis.h>
 
 class process_list;
@@ -93,6 +94,29 @@ public:
     virtual gsl::not_null<domain_intel_x64 *> get_domain() const
     { return m_domain; }
 
+    /// Set Preemption Ticks
+    ///
+    /// Sets the number of ticks the guest may execute before the
+    /// VMX-preemption timer expires. This value is used the next time the
+    /// preemption timer is reset.
+    ///
+    /// @expects ticks != 0
+    /// @ensures none
+    ///
+    /// @param ticks the number of TSC ticks in a time slice
+    ///
+    virtual void set_preemption_ticks(quantum::type ticks);
+
+    /// Reset Preemption Timer
+    ///
+    /// Rearms the VMX-preemption timer with a full time slice. Note that
+    /// this vmcs must be loaded.
+    ///
+    /// @expects none
+    /// @ensures none
+    ///
+    virtual void reset_preemption_timer();
+
 protected:
 
     void write_fields(gsl::not_null<vmcs_intel_x64_state *> host_state,
@@ -105,6 +129,8 @@ private:
     gsl::not_null<process_list *> m_proclt;
     gsl::not_null<domain_intel_x64 *> m_domain;
 
+    quantum::type m_preemption_ticks;
+
 public:
 
     friend class hyperkernel_ut;
@@ -66,6 +66,8 @@ NATIVE_OUTDIR+=%BUILD_REL%/../bin
 
 SOURCES+=domain.cpp
 SOURCES+=domain_intel_x64.cpp
+SOURCES+=page_pool.cpp
+SOURCES+=segment_cache.cpp
 SOURCES+=domain_manager.cpp
 
 INCLUDE_PATHS+=../../../include
@@ -26,7 +26,9 @@
 
 domain::domain(domainid::type id) :
     m_id(id),
-    m_is_initialized(false)
+    m_is_initialized(false),
+    m_page_pool(std::make_unique<page_pool>()),
+    m_segment_cache(std::make_unique<segment_cache>())
 {
     if ((id & domainid::reserved) != 0)
         throw std::invalid_argument("invalid domainid");
@@ -98,6 +98,14 @@ domain_intel_x64::init(user_data *data)
 void
 domain_intel_x64::fini(user_data *data)
 {
-    bfdebug << "domain fini: " << id() << '\n';
+    bfdebug << "domain fini: " << id()
+            << " [pages in use: " << pool()->pages_in_use()
+            << ", cached: " << pool()->pages_cached()
+            << ", returned: " << pool()->pages_returned() << "]\n";
+    bfdebug << "domain fini: " << id()
+            << " [segments: " << segments()->num_segments()
+            << ", pages: " << segments()->num_pages()
+            << ", hits: " << segments()->hits()
+            << ", misses: " << segments()->misses() << "]\n";
     domain::fini(data);
 }
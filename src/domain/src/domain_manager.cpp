@@ -34,61 +34,48 @@ domain_manager::instance() noexcept
 domainid::type
 domain_manager::create_domain(user_data *data)
 {
+    auto domainid = m_domains.reserve();
+
     auto ___ = gsl::on_failure([&]
-    {
-        std::lock_guard<std::mutex> guard(m_domian_mutex);
-        m_domains.erase(m_domian_next_id);
-    });
+    { m_domains.remove(domainid); });
 
-    if (auto && domain = __add_domain(m_domian_next_id, data))
+    if (auto && domain = __add_domain(domainid, data))
         domain->init(data);
 
-    return m_domian_next_id++;
+    return domainid;
 }
 
 void
 domain_manager::delete_domain(domainid::type domainid, user_data *data)
 {
     auto ___ = gsl::finally([&]
-    {
-        std::lock_guard<std::mutex> guard(m_domian_mutex);
-        m_domains.erase(domainid);
-    });
+    { m_domains.remove(domainid); });
 
-    if (auto && domain = __get_domain(domainid))
+    if (auto && domain = m_domains.get(domainid))
         domain->fini(data);
 }
 
 gsl::not_null<domain *>
 domain_manager::get_domain(domainid::type domainid)
-{ return __get_domain(domainid).get(); }
+{
+    if (auto && domain = m_domains.get(domainid))
+        return domain;
+
+    throw std::invalid_argument("unknown domain: " + std::to_string(domainid));
+}
 
 domain_manager::domain_manager() noexcept :
-    m_domian_next_id(0),
     m_domain_factory(std::make_unique<domain_factory>())
 { }
 
-std::unique_ptr<domain> &
+domain *
 domain_manager::__add_domain(domainid::type domainid, user_data *data)
 {
     if (!m_domain_factory)
         throw std::runtime_error("invalid domain factory");
 
-    if (__get_domain(domainid))
-        throw std::runtime_error("domain already exists: " + std::to_string(domainid));
-
     if (auto && domain = m_domain_factory->make_domain(domainid, data))
-    {
-        std::lock_guard<std::mutex> guard(m_domian_mutex);
-        return m_domains[domainid] = std::move(domain);
-    }
+        return m_domains.add(domainid, std::move(domain));
 
     throw std::runtime_error("make_domain returned a nullptr domain");
 }
-
-std::unique_ptr<domain> &
-domain_manager::__get_domain(domainid::type domainid)
-{
-    std::lock_guard<std::mutex> guard(m_domian_mutex);
-    return m_domains[domainid];
-}
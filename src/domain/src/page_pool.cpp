@@ -0,0 +1,171 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include <gsl/gsl>
+
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+
+#include <domain/page_pool.h>
+
+extern "C" uint64_t thread_context_cpuid(void);
+
+constexpr const auto chunk_size = page_pool::page_size * page_pool::pages_per_chunk;
+
+page_pool::page_pool(std::size_t low_watermark, std::size_t high_watermark) :
+    m_low_watermark(low_watermark),
+    m_high_watermark(high_watermark),
+    m_num_free(0),
+    m_pages_in_use(0),
+    m_pages_cached(0),
+    m_pages_returned(0)
+{
+    expects(low_watermark <= high_watermark);
+    expects(high_watermark <= pages_per_chunk);
+
+    // Reserving the caches up front means that freeing a page never has to
+    // allocate, so pages can be freed from a noexcept deleter.
+
+    for (auto &cache : m_core_caches)
+        cache.pages.reserve(high_watermark + 1);
+}
+
+page_pool::page_ptr
+page_pool::alloc_page()
+{
+    auto &&cache = m_core_caches.at(thread_context_cpuid() % max_cores);
+    char *page = nullptr;
+
+    {
+        std::lock_guard<std::mutex> guard(cache.mutex);
+
+        if (cache.pages.empty())
+            this->refill(cache.pages);
+
+        page = cache.pages.back();
+        cache.pages.pop_back();
+    }
+
+    m_pages_cached--;
+    m_pages_in_use++;
+
+    std::memset(page, 0, page_size);
+    return page_ptr(page, page_deleter{this});
+}
+
+page_pool::shared_page_ptr
+page_pool::alloc_shared_page()
+{
+    auto &&page = this->alloc_page();
+    auto &&deleter = page.get_deleter();
+
+    return shared_page_ptr(page.release(), deleter);
+}
+
+void
+page_pool::free_page(char *page) noexcept
+{
+    auto &&cache = m_core_caches.at(thread_context_cpuid() % max_cores);
+
+    m_pages_in_use--;
+    m_pages_cached++;
+
+    std::lock_guard<std::mutex> guard(cache.mutex);
+    cache.pages.push_back(page);
+
+    if (cache.pages.size() > m_high_watermark)
+        this->drain(cache.pages);
+}
+
+void
+page_pool::refill(std::vector<char *> &pages)
+{
+    std::lock_guard<std::mutex> guard(m_chunks_mutex);
+
+    while (pages.size() < m_low_watermark)
+    {
+        auto &&iter = m_chunks.begin();
+        while (iter != m_chunks.end() && iter->second.free.empty())
+            ++iter;
+
+        if (iter == m_chunks.end())
+        {
+            auto &&mem = std::make_unique<char[]>(chunk_size);
+            auto &&base = reinterpret_cast<integer_pointer>(mem.get());
+            auto &&free = std::vector<char *>();
+
+            // The pages are pushed in reverse so that they are handed out
+            // in address order. The chunk comes from the VMM's heap, so it
+            // is neither 2m aligned nor physically contiguous, and pages
+            // that are next to each other here usually are not in memory.
+
+            free.reserve(pages_per_chunk);
+            for (auto i = pages_per_chunk; i > 0; i--)
+                free.push_back(mem.get() + ((i - 1) * page_size));
+
+            iter = m_chunks.emplace(base, chunk{std::move(mem), std::move(free)}).first;
+
+            m_num_free += pages_per_chunk;
+            m_pages_cached += pages_per_chunk;
+        }
+
+        auto &&free = iter->second.free;
+        while (!free.empty() && pages.size() < m_low_watermark)
+        {
+            pages.push_back(free.back());
+            free.pop_back();
+            m_num_free--;
+        }
+    }
+
+    // The cache hands out pages from its back, so it is reversed to hand
+    // them out in the order they were taken from the chunks.
+
+    std::reverse(pages.begin(), pages.end());
+}
+
+void
+page_pool::drain(std::vector<char *> &pages) noexcept
+{
+    std::lock_guard<std::mutex> guard(m_chunks_mutex);
+
+    while (pages.size() > m_low_watermark)
+    {
+        auto page = pages.back();
+        pages.pop_back();
+
+        auto &&iter = std::prev(m_chunks.upper_bound(reinterpret_cast<integer_pointer>(page)));
+        auto &&free = iter->second.free;
+
+        free.push_back(page);
+        m_num_free++;
+
+        if (free.size() == pages_per_chunk && m_num_free >= 2 * pages_per_chunk)
+        {
+            m_num_free -= pages_per_chunk;
+            m_pages_cached -= pages_per_chunk;
+            m_pages_returned += pages_per_chunk;
+
+            m_chunks.erase(iter);
+        }
+    }
+}
@@ -0,0 +1,68 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include <gsl/gsl>
+
+#include <domain/segment_cache.h>
+
+segment_cache::segment_cache() :
+    m_num_pages(0),
+    m_hits(0),
+    m_misses(0)
+{ }
+
+segment_cache::page_list
+segment_cache::find(const key_type &key)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    auto &&iter = m_segments.find(key);
+    if (iter == m_segments.end())
+    {
+        m_misses++;
+        return {};
+    }
+
+    m_hits++;
+    return iter->second;
+}
+
+segment_cache::page_list
+segment_cache::insert(const key_type &key, page_list pages)
+{
+    expects(!pages.empty());
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    auto &&iter = m_segments.find(key);
+    if (iter != m_segments.end())
+        return iter->second;
+
+    m_num_pages += pages.size();
+    return m_segments[key] = std::move(pages);
+}
+
+uint64_t
+segment_cache::num_segments() const
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return m_segments.size();
+}
@@ -19,25 +19,90 @@
 // License along with this library; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
+#include <tuple>
+#include <string>
+#include <stdexcept>
+
+#include <epoch.h>
 #include <vcpuid.h>
+#include <quantum.h>
+#include <scheduler_data.h>
 #include <process_list_data.h>
 #include <vcpu_data_intel_x64.h>
 
 #include <domain/domain_manager.h>
 #include <domain/domain_intel_x64.h>
 
+#include <exit_handler/exit_stats.h>
+#include <process/process_intel_x64.h>
 #include <scheduler/scheduler_manager.h>
 #include <process_list/process_list_manager.h>
 
+#include <intrinsics/cpuid_x64.h>
+#include <intrinsics/msrs_x64.h>
+
+// Some of the hyperkernel's state is kept per core, in arrays that are
+// sized for a fixed number of cores, so the hyperkernel refuses to start
+// on a core past that instead of having two cores share the same state.
+
+static_assert(exit_stats::max_cores == epoch::max_cores, "exit_stats::max_cores != epoch::max_cores");
+static_assert(process_intel_x64::max_cores == epoch::max_cores, "process_intel_x64::max_cores != epoch::max_cores");
+
+static scheduler_data g_sd;
 static process_list_data g_pld;
 static vcpu_data_intel_x64 g_vd;
 
+// The TSC runs at a constant rate, which is the processor's base (i.e.
+// nominal) frequency. Newer parts report the rate directly, as a ratio of
+// the crystal clock (CPUID 0x15), or the base frequency itself (CPUID
+// 0x16). Older parts only report the base frequency as a ratio of the 100
+// MHz bus clock (MSR_PLATFORM_INFO).
+
+static quantum::type
+tsc_ticks_per_ms()
+{
+    auto &&max_leaf = std::get<0>(x64::cpuid::get(0, 0, 0, 0));
+
+    if (max_leaf >= 0x15)
+    {
+        auto &&leaf = x64::cpuid::get(0x15, 0, 0, 0);
+
+        auto &&denominator = quantum::type{std::get<0>(leaf)};
+        auto &&numerator = quantum::type{std::get<1>(leaf)};
+        auto &&crystal_hz = quantum::type{std::get<2>(leaf)};
+
+        if (denominator != 0 && numerator != 0 && crystal_hz != 0)
+            return (crystal_hz / 1000) * numerator / denominator;
+    }
+
+    if (max_leaf >= 0x16)
+    {
+        auto &&base_mhz = quantum::type{std::get<0>(x64::cpuid::get(0x16, 0, 0, 0)) & 0xFFFFU};
+
+        if (base_mhz != 0)
+            return base_mhz * 1000;
+    }
+
+    auto &&ratio = (x64::msrs::get(0xCEU) >> 8) & 0xFFU;
+
+    if (ratio != 0)
+        return ratio * 100000;
+
+    return quantum::default_ticks_per_ms;
+}
+
 user_data *
 pre_create_vcpu(vcpuid::type id)
 {
     static auto initialized = false;
 
-    g_shm->create_scheduler(id);
+    if (id >= epoch::max_cores)
+        throw std::runtime_error("pre_create_vcpu: unsupported core: " + std::to_string(id));
+
+    if (!initialized)
+        quantum::set_ticks_per_ms(tsc_ticks_per_ms());
+
+    g_shm->create_scheduler(id, &g_sd);
 
     if (!initialized)
     {
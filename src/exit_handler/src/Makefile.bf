@@ -64,7 +64,9 @@ NATIVE_OUTDIR+=%BUILD_REL%/../bin
 # Sources
 ################################################################################
 
+SOURCES+=epoch.cpp
 SOURCES+=exit_handler_intel_x64_hyperkernel.cpp
+SOURCES+=exit_stats.cpp
 
 INCLUDE_PATHS+=../../../include
 INCLUDE_PATHS+=%HYPER_ABS%/include/
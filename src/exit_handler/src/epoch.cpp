@@ -0,0 +1,74 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#include <array>
+#include <atomic>
+
+#include <epoch.h>
+
+extern "C" uint64_t thread_context_cpuid(void);
+
+// -----------------------------------------------------------------------------
+// Helpers
+// -----------------------------------------------------------------------------
+
+struct alignas(64) core_epoch
+{
+    std::atomic<uint64_t> epoch;
+};
+
+static std::atomic<uint64_t> g_epoch(1);
+static std::array<core_epoch, epoch::max_cores> g_core_epochs = {};
+
+static core_epoch &
+current_core_epoch() noexcept
+{ return g_core_epochs.at(thread_context_cpuid()); }
+
+// -----------------------------------------------------------------------------
+// Implementation
+// -----------------------------------------------------------------------------
+
+void
+epoch::enter() noexcept
+{ current_core_epoch().epoch = g_epoch.load(); }
+
+void
+epoch::leave() noexcept
+{ current_core_epoch().epoch = 0; }
+
+uint64_t
+epoch::retire() noexcept
+{ return g_epoch.fetch_add(1); }
+
+bool
+epoch::quiescent(uint64_t retired) noexcept
+{
+    for (const auto &core : g_core_epochs)
+    {
+        auto &&entered = core.epoch.load();
+
+        if (entered != 0 && entered <= retired)
+            return false;
+    }
+
+    return true;
+}
@@ -19,6 +19,12 @@
 // License along with this library; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
+#include <cstring>
+#include <algorithm>
+
+#include <epoch.h>
+#include <quantum.h>
+#include <upper_lower.h>
 #include <exit_handler/exit_handler_intel_x64_hyperkernel.h>
 
 #include <vmcs/vmcs_intel_x64_32bit_guest_state_fields.h>
@@ -38,10 +44,12 @@
 
 #include <process/process.h>
 #include <process/process_intel_x64.h>
+#include <process/page_walker_x64.h>
 
 #include <thread/thread.h>
 #include <thread/thread_intel_x64.h>
 
+#include <process_list/ipc_endpoint.h>
 #include <process_list/process_list.h>
 #include <process_list/process_list_manager.h>
 
@@ -53,10 +61,17 @@
 
 #include <intrinsics/crs_intel_x64.h>
 
+#include <memory_manager/map_ptr_x64.h>
+
 using namespace x64;
 using namespace intel_x64;
 using namespace vmcs;
 
+// Bit 1 of an EPT violation's exit qualification is set for a write (see
+// the Intel SDM, "Exit Qualification for EPT Violations").
+
+constexpr const auto ept_violation_write = 0x2UL;
+
 exit_handler_intel_x64_hyperkernel::exit_handler_intel_x64_hyperkernel(
     coreid::type coreid,
     vcpuid::type vcpuid,
@@ -67,49 +82,109 @@ exit_handler_intel_x64_hyperkernel::exit_handler_intel_x64_hyperkernel(
     m_vcpuid(vcpuid),
     m_proclt(proclt),
     m_domain(domain),
-    m_thread(nullptr)
+    m_thread(nullptr),
+    m_exit_stats(std::make_unique<exit_stats>(vcpuid))
 { }
 
 void
 exit_handler_intel_x64_hyperkernel::handle_exit(vmcs::value_type reason)
 {
+    epoch::enter();
+    m_exit_stats->begin_exit(reason);
+
     switch (reason)
     {
-        case exit_reason::basic_exit_reason::vm_entry_failure_invalid_guest_state:
         case exit_reason::basic_exit_reason::ept_violation:
+            if (!handle_ept_violation())
+                handle_guest_failure();
+            break;
+
+        case exit_reason::basic_exit_reason::vm_entry_failure_invalid_guest_state:
         case exit_reason::basic_exit_reason::triple_fault:
-        {
-            bferror << "guest exited: failure\n";
-            bferror << "----------------------------------------------------" << bfendl;
-            bferror << "- rip: "
-                    << view_as_pointer(m_state_save->rip) << bfendl;
-            bferror << "- rsp: "
-                    << view_as_pointer(m_state_save->rsp) << bfendl;
-            bferror << "- exit reason: "
-                    << view_as_pointer(vmcs::exit_reason::get()) << bfendl;
-            bferror << "- exit reason string: "
-                    << vmcs::exit_reason::basic_exit_reason::description() << bfendl;
-            bferror << "- exit qualification: "
-                    << view_as_pointer(vmcs::exit_qualification::get()) << bfendl;
-            bferror << "- exit interrupt information: "
-                    << view_as_pointer(vmcs::vm_exit_interruption_information::get()) << bfendl;
-            bferror << "- instruction length: "
-                    << view_as_pointer(vmcs::vm_exit_instruction_length::get()) << bfendl;
-            bferror << "- instruction information: "
-                    << view_as_pointer(vmcs::vm_exit_instruction_information::get()) << bfendl;
-            bferror << "- guest linear address: "
-                    << view_as_pointer(vmcs::guest_linear_address::get()) << bfendl;
-            bferror << "- guest physical address: "
-                    << view_as_pointer(vmcs::guest_physical_address::get()) << bfendl;
-
-            g_shm->get_scheduler(m_coreid)->yield();
+            handle_guest_failure();
+            break;
+
+        case exit_reason::basic_exit_reason::vmx_preemption_timer_expired:
+            handle_preemption_timer();
             break;
-        }
 
         default:
             exit_handler_intel_x64::handle_exit(reason);
             break;
     }
+
+    exit_stats::end_exit();
+    epoch::leave();
+
+    m_proclt->collect();
+}
+
+bool
+exit_handler_intel_x64_hyperkernel::handle_ept_violation()
+{
+    if (m_thread == nullptr)
+        return false;
+
+    // Memory from mmap and vm_reserve is only allocated and mapped when it
+    // is first touched, which shows up here. Resuming the guest retries the
+    // instruction, which now finds the page mapped.
+
+    // Shared pages are readable and executable, so only a write to one of
+    // them has to be copied (see handle_fault).
+
+    try
+    {
+        auto &&gpa = vmcs::guest_physical_address::get();
+        auto &&write = (vmcs::exit_qualification::get() & ept_violation_write) != 0;
+
+        return m_thread->proc()->handle_fault(bfn::upper(gpa), write);
+    }
+    catch (std::exception &e)
+    {
+        bferror << "ept violation: " << e.what() << bfendl;
+    }
+
+    return false;
+}
+
+void
+exit_handler_intel_x64_hyperkernel::handle_guest_failure()
+{
+    bferror << "guest exited: failure\n";
+    bferror << "----------------------------------------------------" << bfendl;
+    bferror << "- rip: "
+            << view_as_pointer(m_state_save->rip) << bfendl;
+    bferror << "- rsp: "
+            << view_as_pointer(m_state_save->rsp) << bfendl;
+    bferror << "- exit reason: "
+            << view_as_pointer(vmcs::exit_reason::get()) << bfendl;
+    bferror << "- exit reason string: "
+            << vmcs::exit_reason::basic_exit_reason::description() << bfendl;
+    bferror << "- exit qualification: "
+            << view_as_pointer(vmcs::exit_qualification::get()) << bfendl;
+    bferror << "- exit interrupt information: "
+            << view_as_pointer(vmcs::vm_exit_interruption_information::get()) << bfendl;
+    bferror << "- instruction length: "
+            << view_as_pointer(vmcs::vm_exit_instruction_length::get()) << bfendl;
+    bferror << "- instruction information: "
+            << view_as_pointer(vmcs::vm_exit_instruction_information::get()) << bfendl;
+    bferror << "- guest linear address: "
+            << view_as_pointer(vmcs::guest_linear_address::get()) << bfendl;
+    bferror << "- guest physical address: "
+            << view_as_pointer(vmcs::guest_physical_address::get()) << bfendl;
+
+    g_shm->get_scheduler(m_coreid)->yield();
+}
+
+void
+exit_handler_intel_x64_hyperkernel::handle_preemption_timer()
+{
+    auto &&start = quantum::now();
+
+    if (m_thread != nullptr)
+        m_thread->save_state(*m_state_save);
+
+    g_shm->get_scheduler(m_coreid)->preempt(start);
 }
 
 void
@@ -139,11 +214,7 @@ exit_handler_intel_x64_hyperkernel::create_vcpu(vmcall_registers_t &regs)
 {
     vcpu_data_intel_x64 vd;
 
-    if (regs.r03 == processlistid::current)
-        vd.m_proclt = m_proclt;
-    else
-        vd.m_proclt = g_plm->get_process_list(regs.r03).get();
-
+    vd.m_proclt = lookup_proclt(regs.r03);
     vd.m_coreid = m_coreid;
     vd.m_domain = dynamic_cast<domain_intel_x64 *>(vd.m_proclt->get_domain().get());
 
@@ -164,13 +235,8 @@ exit_handler_intel_x64_hyperkernel::delete_vcpu(vmcall_registers_t &regs)
 void
 exit_handler_intel_x64_hyperkernel::create_process(vmcall_registers_t &regs)
 {
-    process_list *proclt;
     process_data_intel_x64 pd;
-
-    if (regs.r03 == processlistid::current)
-        proclt = m_proclt;
-    else
-        proclt = g_plm->get_process_list(regs.r03).get();
+    auto &&proclt = lookup_proclt(regs.r03);
 
     pd.m_domain = m_domain;
 
@@ -180,12 +246,7 @@ exit_handler_intel_x64_hyperkernel::create_process(vmcall_registers_t &regs)
 void
 exit_handler_intel_x64_hyperkernel::delete_process(vmcall_registers_t &regs)
 {
-    process_list *proclt;
-
-    if (regs.r03 == processlistid::current)
-        proclt = m_proclt;
-    else
-        proclt = g_plm->get_process_list(regs.r03).get();
+    auto &&proclt = lookup_proclt(regs.r03);
 
     // FUTURE:
     //
@@ -206,10 +267,48 @@ exit_handler_intel_x64_hyperkernel::delete_process(vmcall_registers_t &regs)
 }
 
 void
-exit_handler_intel_x64_hyperkernel::vm_map(vmcall_registers_t &regs)
+exit_handler_intel_x64_hyperkernel::fork(vmcall_registers_t &regs)
 {
-    process_list *proclt;
+    expects(m_thread != nullptr);
+
+    process_data_intel_x64 pd;
+    pd.m_domain = m_domain;
+
+    auto &&proc = m_thread->proc();
+    auto &&childid = m_proclt->create_process(&pd);
+
+    auto ___ = gsl::on_failure([&]
+    { m_proclt->delete_process(childid); });
+
+    auto &&child = m_proclt->get_process(childid);
+    proc->fork(child);
+
+    // Only the calling thread is copied. The child's first thread resumes
+    // from the same vmcall, completed with a return value of 0, while the
+    // parent's state save is put back so that it completes the vmcall with
+    // the child's id as usual.
+
+    auto state_save = *m_state_save;
+    auto &&thrd = dynamic_cast<thread_intel_x64 *>(child->get_thread(0).get());
+
+    expects(thrd != nullptr);
 
+    regs.r03 = 0;
+    this->complete_vmcall(BF_VMCALL_SUCCESS, regs);
+
+    thrd->m_stack = m_thread->m_stack;
+    thrd->save_state(*m_state_save);
+
+    *m_state_save = state_save;
+    regs.r03 = childid;
+
+    if (child->wake_thread(thrd))
+        m_proclt->queue_process(m_vcpuid, childid);
+}
+
+void
+exit_handler_intel_x64_hyperkernel::vm_map(vmcall_registers_t &regs)
+{
     // FUTURE:
     //
     // When implementing mmap, we will need a way to identify a range that
@@ -220,20 +319,13 @@ exit_handler_intel_x64_hyperkernel::vm_map(vmcall_registers_t &regs)
     // able to assert better protections
     //
 
-    if (regs.r03 == processlistid::current)
-        proclt = m_proclt;
-    else
-        proclt = g_plm->get_process_list(regs.r03).get();
-
-    auto &&proc = proclt->get_process(regs.r04);
+    auto &&proc = lookup_process(regs.r03, regs.r04);
     proc->vm_map(regs.r05, regs.r06, regs.r07, regs.r08);
 }
 
 void
 exit_handler_intel_x64_hyperkernel::vm_map_lookup(vmcall_registers_t &regs)
 {
-    process_list *proclt;
-
     // FUTURE:
     //
     // When implementing mmap, we will need a way to identify a range that
@@ -244,22 +336,100 @@ exit_handler_intel_x64_hyperkernel::vm_map_lookup(vmcall_registers_t &regs)
     // able to assert better protections
     //
 
-    if (regs.r03 == processlistid::current)
-        proclt = m_proclt;
-    else
-        proclt = g_plm->get_process_list(regs.r03).get();
-
     auto &&cr3 = vmcs::guest_cr3::get();
-    auto &&proc = proclt->get_process(regs.r04);
+    auto &&proc = lookup_process(regs.r03, regs.r04);
 
     proc->vm_map_lookup(regs.r05, cr3, regs.r06, regs.r07, regs.r08);
 }
 
 void
-exit_handler_intel_x64_hyperkernel::set_thread_info(vmcall_registers_t &regs)
+exit_handler_intel_x64_hyperkernel::vm_reserve(vmcall_registers_t &regs)
+{
+    // The initial contents are read through the caller's CR3, which is
+    // only an identity of host physical memory for the host (i.e. bfexec),
+    // so a VM application could otherwise read any page it likes.
+
+    if (m_thread != nullptr)
+        throw std::runtime_error("vm_reserve: only the host can reserve memory");
+
+    auto &&proc = lookup_process(regs.r03, regs.r04);
+    auto &&backing = std::vector<page_pool::shared_page_ptr>();
+
+    // The initial contents, if any, are copied into pages owned by the
+    // domain now, so the caller is free to reuse its memory as soon as
+    // the vmcall returns.
+
+    if (regs.r06 != 0)
+    {
+        expects(bfn::lower(regs.r06) == 0);
+        expects(bfn::lower(regs.r07) == 0);
+
+        auto &&pool = lookup_proclt(regs.r03)->get_domain()->pool();
+        auto &&walker = page_walker_x64(vmcs::guest_cr3::get());
+        auto &&page_size = 0UL;
+
+        for (auto offset = 0UL; offset < regs.r07; offset += 0x1000)
+        {
+            auto &&page = pool->alloc_shared_page();
+            auto &&src = bfn::make_unique_map_x64<char>(walker.translate(regs.r06 + offset, page_size));
+
+            std::memcpy(page.get(), src.get(), 0x1000);
+            backing.push_back(std::move(page));
+        }
+    }
+
+    proc->reserve(regs.r05, regs.r07, regs.r08, std::move(backing));
+}
+
+void
+exit_handler_intel_x64_hyperkernel::vm_map_segment(vmcall_registers_t &regs)
 {
-    process_list *proclt;
+    // The cache is keyed by the file id and offset that the caller reports,
+    // so a process could otherwise replace the segments that every other
+    // process in the domain loads. Only the host (i.e. bfexec) is trusted.
+
+    if (m_thread != nullptr)
+        throw std::runtime_error("vm_map_segment: only the host can map cached segments");
+
+    expects(bfn::lower(regs.r05) == 0);
+    expects(bfn::lower(regs.r06) == 0);
+    expects(regs.r07 != 0);
+
+    auto &&proclt = lookup_proclt(regs.r03);
+    auto &&proc = lookup_process(regs.r03, regs.r04);
+    auto &&domain = proclt->get_domain();
+
+    auto &&size = bfn::upper(regs.r07 + 0xFFF);
+    auto &&key = segment_cache::key_type{regs.r08, regs.r09, size};
+    auto &&pages = domain->segments()->find(key);
+
+    // The first process to load a segment copies it into pages owned by
+    // the domain. Every process after that maps the same pages, and the
+    // caller's copy is never touched.
+
+    if (pages.empty())
+    {
+        auto &&walker = page_walker_x64(vmcs::guest_cr3::get());
+        auto &&page_size = 0UL;
+
+        for (auto offset = 0UL; offset < size; offset += 0x1000)
+        {
+            auto &&page = domain->pool()->alloc_shared_page();
+            auto &&src = bfn::make_unique_map_x64<char>(walker.translate(regs.r06 + offset, page_size));
 
+            std::memcpy(page.get(), src.get(), 0x1000);
+            pages.push_back(std::move(page));
+        }
+
+        pages = domain->segments()->insert(key, std::move(pages));
+    }
+
+    proc->map_shared_pages(regs.r05, pages);
+}
+
+void
+exit_handler_intel_x64_hyperkernel::set_thread_info(vmcall_registers_t &regs)
+{
     // FUTURE:
     //
     // When implementing set thread info, we should be able to run this
@@ -270,15 +440,191 @@ exit_handler_intel_x64_hyperkernel::set_thread_info(vmcall_registers_t &regs)
     // get the process id from the scheduler.
     //
 
-    if (regs.r03 == processlistid::current)
-        proclt = m_proclt;
-    else
-        proclt = g_plm->get_process_list(regs.r03).get();
-
-    auto &&proc = proclt->get_process(regs.r04);
+    auto &&proclt = lookup_proclt(regs.r03);
+    auto &&proc = lookup_process(regs.r03, regs.r04);
     auto &&thrd = proc->get_thread(regs.r05);
 
     thrd->set_info(regs.r06, regs.r07, regs.r08, regs.r09);
+
+    if (proc->wake_thread(thrd))
+        proclt->queue_process(m_vcpuid, proc->id());
+}
+
+void
+exit_handler_intel_x64_hyperkernel::create_thread(vmcall_registers_t &regs)
+{
+    auto &&proclt = lookup_proclt(regs.r03);
+    auto &&proc = lookup_process(regs.r03, regs.r04);
+
+    auto &&threadid = proc->create_thread();
+    auto &&thrd = proc->get_thread(threadid);
+
+    thrd->set_info(regs.r05, regs.r06, regs.r07, regs.r08);
+
+    if (proc->wake_thread(thrd))
+        proclt->queue_process(m_vcpuid, proc->id());
+
+    regs.r03 = threadid;
+}
+
+void
+exit_handler_intel_x64_hyperkernel::thread_exit(vmcall_registers_t &regs)
+{
+    expects(m_thread != nullptr);
+
+    auto &&proc = m_thread->proc();
+    auto &&joiner = proc->exit_thread(m_thread, regs.r03);
+
+    if (joiner != threadid::invalid)
+    {
+        if (proc->wake_thread(proc->get_thread(joiner)))
+            m_proclt->queue_process(m_vcpuid, proc->id());
+    }
+
+    m_thread = nullptr;
+    g_shm->get_scheduler(m_coreid)->yield();
+}
+
+void
+exit_handler_intel_x64_hyperkernel::thread_join(vmcall_registers_t &regs)
+{
+    expects(m_thread != nullptr);
+
+    auto &&retval = 0UL;
+    auto &&proc = m_thread->proc();
+    auto &&target = proc->get_thread(regs.r03);
+
+    // The vmcall is not completed if the thread blocks, which means that
+    // once the target exits and this thread is woken, it executes the
+    // vmcall again, which will then find the target has exited. The state
+    // must be saved before the thread blocks, as another vCPU is free to
+    // resume this thread as soon as the target exits.
+
+    m_thread->save_state(*m_state_save);
+
+    if (proc->join_thread(m_thread, target, retval))
+    {
+        proc->delete_thread(regs.r03);
+        regs.r03 = retval;
+
+        return;
+    }
+
+    g_shm->get_scheduler(m_coreid)->yield();
+}
+
+void
+exit_handler_intel_x64_hyperkernel::register_vmcall_ring(vmcall_registers_t &regs)
+{
+    // The ring is resolved with the caller's CR3, which is only an
+    // identity of host physical memory for the host (i.e. bfexec), and
+    // the ring is written to by the VMM, so a VM application could
+    // otherwise have the VMM write to any page it likes.
+
+    if (m_thread != nullptr)
+        throw std::runtime_error("register_vmcall_ring: only the host can register a vmcall ring");
+
+    auto &&proclt = lookup_proclt(regs.r03);
+    auto &&cr3 = vmcs::guest_cr3::get();
+
+    if (bfn::lower(regs.r04) != 0)
+        throw std::invalid_argument("vmcall ring must be page aligned");
+
+    proclt->set_vmcall_ring(bfn::virt_to_phys_with_cr3(regs.r04, cr3));
+}
+
+void
+exit_handler_intel_x64_hyperkernel::vmcall_ring_doorbell(vmcall_registers_t &regs)
+{
+    if (m_thread != nullptr)
+        throw std::runtime_error("vmcall_ring_doorbell: only the host can ring the doorbell");
+
+    auto &&proclt = lookup_proclt(regs.r03);
+    auto &&phys = proclt->vmcall_ring();
+
+    if (phys == 0)
+        throw std::runtime_error("process list does not have a vmcall ring");
+
+    auto &&ring = bfn::make_unique_map_x64<vmcall_ring_t>(phys);
+
+    // The ring is shared with the caller, so the head and tail are copied
+    // once, and the tail is only ever written back.
+
+    auto tail = ring->tail;
+    auto head = ring->head;
+
+    if (head - tail > VMCALL_RING_ENTRIES)
+        throw std::runtime_error("vmcall ring is corrupt");
+
+    // Later requests usually depend on earlier ones (e.g. setting up a
+    // thread in a process whose memory failed to map), so once a request
+    // fails, the rest are marked as failed without being executed.
+
+    auto &&failed = false;
+
+    for (; tail != head; ring->tail = ++tail)
+    {
+        auto &&index = gsl::narrow_cast<std::ptrdiff_t>(tail % VMCALL_RING_ENTRIES);
+        auto &&entry = gsl::at(ring->entries, index);
+
+        if (failed)
+        {
+            entry.r01 = REG_INVALID;
+            continue;
+        }
+
+        failed = !handle_vmcall_ring_entry(entry);
+    }
+}
+
+bool
+exit_handler_intel_x64_hyperkernel::handle_vmcall_ring_entry(vmcall_registers_t &entry)
+{
+    // The entry is shared with the caller, which could change it at any
+    // time, so the request is copied, and only the results are written
+    // back.
+
+    auto regs = entry;
+
+    switch (regs.r02)
+    {
+        case hyperkernel_vmcall__vm_map:
+        case hyperkernel_vmcall__vm_map_lookup:
+        case hyperkernel_vmcall__vm_reserve:
+        case hyperkernel_vmcall__vm_map_segment:
+        case hyperkernel_vmcall__set_thread_info:
+        case hyperkernel_vmcall__create_thread:
+            break;
+
+        default:
+            entry.r01 = REG_INVALID;
+            return false;
+    }
+
+    // Entries are all part of the doorbell's exit, so they are counted
+    // (and timed) separately, instead of as vmcalls of their own.
+
+    auto &&start = quantum::now();
+
+    auto ___ = gsl::finally([&]
+    { m_exit_stats->ring_entry(regs.r02, quantum::now() - start); });
+
+    try
+    {
+        dispatch_vmcall(regs);
+
+        entry.r01 = REG_SUCCESS;
+        entry.r03 = regs.r03;
+
+        return true;
+    }
+    catch (std::exception &e)
+    {
+        bferror << "vmcall ring entry failed: " << e.what() << bfendl;
+    }
+
+    entry.r01 = REG_INVALID;
+    return false;
 }
 
 void
@@ -287,7 +633,7 @@ exit_handler_intel_x64_hyperkernel::sched_yield(vmcall_registers_t &regs)
     this->complete_vmcall(BF_VMCALL_SUCCESS, regs);
 
     if (m_thread != nullptr)
-        m_thread->m_state_save = *m_state_save;
+        m_thread->save_state(*m_state_save);
 
     g_shm->get_scheduler(m_coreid)->yield();
 }
@@ -301,6 +647,44 @@ exit_handler_intel_x64_hyperkernel::sched_yield_and_remove(vmcall_registers_t &r
     sched_yield(regs);
 }
 
+void
+exit_handler_intel_x64_hyperkernel::futex_wait(vmcall_registers_t &regs)
+{
+    expects(m_thread != nullptr);
+
+    // The thread's state has to be saved (with the vmcall completed) before
+    // the thread blocks, as another vCPU is free to resume this thread as
+    // soon as it is woken. If the thread does not block, the vmcall is
+    // completed as usual, so the state save is put back the way it was.
+
+    auto state_save = *m_state_save;
+
+    this->complete_vmcall(BF_VMCALL_SUCCESS, regs);
+    m_thread->save_state(*m_state_save);
+
+    if (!m_thread->proc()->futex_wait(m_thread, regs.r03, regs.r04))
+    {
+        *m_state_save = state_save;
+        return;
+    }
+
+    g_shm->get_scheduler(m_coreid)->yield();
+}
+
+void
+exit_handler_intel_x64_hyperkernel::futex_wake(vmcall_registers_t &regs)
+{
+    expects(m_thread != nullptr);
+
+    auto &&proc = m_thread->proc();
+    auto &&ret = proc->futex_wake(regs.r03, regs.r04);
+
+    if (std::get<1>(ret))
+        m_proclt->queue_process(m_vcpuid, proc->id());
+
+    regs.r03 = std::get<0>(ret);
+}
+
 void
 exit_handler_intel_x64_hyperkernel::set_program_break(vmcall_registers_t &regs)
 {
@@ -320,15 +704,13 @@ exit_handler_intel_x64_hyperkernel::increase_program_break(vmcall_registers_t &r
 {
     expects(m_thread != nullptr);
 
-    (void) regs;
-
     // TODO
     //
     // Need to implement the foreign calls. This will have to get the proclist
     // and the process to do this
     //
 
-    m_thread->proc()->increase_program_break_4k();
+    m_thread->proc()->increase_program_break(regs.r05);
 }
 
 void
@@ -336,26 +718,43 @@ exit_handler_intel_x64_hyperkernel::decrease_program_break(vmcall_registers_t &r
 {
     expects(m_thread != nullptr);
 
-    (void) regs;
-
     // TODO
     //
     // Need to implement the foreign calls. This will have to get the proclist
     // and the process to do this
     //
 
-    m_thread->proc()->decrease_program_break_4k();
+    m_thread->proc()->decrease_program_break(regs.r05);
+}
+
+void
+exit_handler_intel_x64_hyperkernel::mmap(vmcall_registers_t &regs)
+{
+    expects(m_thread != nullptr);
+    regs.r03 = m_thread->proc()->mmap(regs.r03, regs.r04, regs.r05, regs.r06 != 0);
+}
+
+void
+exit_handler_intel_x64_hyperkernel::munmap(vmcall_registers_t &regs)
+{
+    expects(m_thread != nullptr);
+    m_thread->proc()->munmap(regs.r03, regs.r04);
+}
+
+void
+exit_handler_intel_x64_hyperkernel::mprotect(vmcall_registers_t &regs)
+{
+    expects(m_thread != nullptr);
+    m_thread->proc()->mprotect(regs.r03, regs.r04, regs.r05);
 }
 
 void
 exit_handler_intel_x64_hyperkernel::handle_ttys0(vmcall_registers_t &regs)
 {
-    if (m_ttys0.m_thread == nullptr)
-        return handle_ttys1(regs);
+    auto &&val = gsl::narrow_cast<char>(regs.r03);
 
-    this->complete_vmcall(BF_VMCALL_SUCCESS, regs);
-    m_thread->m_state_save = *m_state_save;
-    g_shm->get_scheduler(m_coreid)->schedule(m_ttys0.m_thread, m_ttys0.m_entry, regs.r03, 0);
+    if (copy_to_ttys0(&val, 1))
+        run_ttys0(regs, 1);
 }
 
 void
@@ -364,17 +763,376 @@ exit_handler_intel_x64_hyperkernel::handle_ttys1(vmcall_registers_t &regs)
     std::cout << gsl::narrow_cast<char>(regs.r03);
 }
 
+void
+exit_handler_intel_x64_hyperkernel::ttys0_flush(vmcall_registers_t &regs)
+{
+    expects(m_thread != nullptr);
+
+    if (bfn::lower(regs.r03) != 0)
+        throw std::invalid_argument("ttys ring must be page aligned");
+
+    auto len = 0UL;
+
+    // run_ttys0 does not return, so the ring's mapping and the copy of its
+    // bytes are scoped to this block, and are freed before it is called.
+
+    {
+        auto &&phys = m_thread->proc()->virt_to_phys(regs.r03);
+        auto &&ring = bfn::make_unique_map_x64<ttys_ring_t>(phys);
+
+        // The ring is shared with the caller, so the head and tail are
+        // copied once, and the tail is only ever written back. The bytes
+        // are copied out first, so that the caller cannot change them
+        // while they are being written.
+
+        auto tail = ring->tail;
+        auto head = ring->head;
+
+        if (head - tail > TTYS_RING_SIZE)
+            throw std::runtime_error("ttys ring is corrupt");
+
+        len = gsl::narrow_cast<std::size_t>(head - tail);
+        auto &&buf = std::vector<char>(len);
+
+        for (auto i = 0UL; i < len; i++)
+            buf.at(i) = gsl::at(ring->data, gsl::narrow_cast<std::ptrdiff_t>((tail + i) % TTYS_RING_SIZE));
+
+        ring->tail = head;
+
+        if (!copy_to_ttys0(buf.data(), len))
+            return;
+    }
+
+    run_ttys0(regs, len);
+}
+
+void
+exit_handler_intel_x64_hyperkernel::ttys1_write(vmcall_registers_t &regs)
+{
+    expects(m_thread != nullptr);
+
+    auto virt = regs.r03;
+    auto remaining = regs.r04;
+
+    while (remaining != 0)
+    {
+        auto &&len = std::min(remaining, 0x1000 - bfn::lower(virt));
+        auto &&page = bfn::make_unique_map_x64<char>(bfn::upper(m_thread->proc()->virt_to_phys(virt)));
+
+        std::cout.write(page.get() + bfn::lower(virt), gsl::narrow_cast<std::streamsize>(len));
+
+        virt += len;
+        remaining -= len;
+    }
+}
+
 void
 exit_handler_intel_x64_hyperkernel::register_ttys0(vmcall_registers_t &regs)
 {
+    expects(m_thread != nullptr);
+
+    if (regs.r04 == 0 || bfn::lower(regs.r04) != 0)
+        throw std::invalid_argument("ttys0 buffer must be page aligned");
+
+    // The buffer is pinned, so that it stays allocated (and is not handed
+    // to another process) even if the driver unmaps it.
+
     m_ttys0.m_entry = regs.r03;
+    m_ttys0.m_buffer = regs.r04;
+    m_ttys0.m_buffer_page = m_thread->proc()->pin_page(regs.r04);
+    m_ttys0.m_buffer_phys = m_thread->proc()->virt_to_phys(regs.r04);
     m_ttys0.m_domain = m_domain;
     m_ttys0.m_thread = m_thread;
     m_ttys0.m_proclt = m_proclt.get();
 }
 
+void
+exit_handler_intel_x64_hyperkernel::dump_exit_stats(vmcall_registers_t &regs)
+{
+    if (regs.r03 == vcpuid::current)
+        exit_stats::dump(m_vcpuid);
+    else
+        exit_stats::dump(regs.r03);
+}
+
+// IPC buffers are copied one page of the process at a time, as the pages
+// of a process's buffer do not have to be physically contiguous. The
+// endpoint's buffer is a single page.
+
+static void
+copy_from_process(gsl::not_null<process *> proc, uintptr_t virt, char *buf, uint64_t len)
+{
+    while (len != 0)
+    {
+        auto &&size = std::min(len, 0x1000 - bfn::lower(virt));
+        auto &&page = bfn::make_unique_map_x64<char>(bfn::upper(proc->virt_to_phys(virt)));
+
+        memcpy(buf, page.get() + bfn::lower(virt), size);
+
+        buf += size;
+        virt += size;
+        len -= size;
+    }
+}
+
+static void
+copy_to_process(gsl::not_null<process *> proc, uintptr_t virt, const char *buf, uint64_t len)
+{
+    while (len != 0)
+    {
+        auto &&size = std::min(len, 0x1000 - bfn::lower(virt));
+        auto &&page = bfn::make_unique_map_x64<char>(bfn::upper(proc->virt_to_phys(virt)));
+
+        memcpy(page.get() + bfn::lower(virt), buf, size);
+
+        buf += size;
+        virt += size;
+        len -= size;
+    }
+}
+
+void
+exit_handler_intel_x64_hyperkernel::ipc_create_endpoint(vmcall_registers_t &regs)
+{
+    expects(m_thread != nullptr);
+
+    auto &&proc = m_thread->proc();
+    auto &&buffer_phys = 0UL;
+    auto &&buffer_page = page_pool::shared_page_ptr{};
+
+    if (regs.r03 != 0)
+    {
+        if (bfn::lower(regs.r03) != 0)
+            throw std::invalid_argument("ipc buffer must be page aligned");
+
+        // The buffer is pinned by the endpoint, so that calls are never
+        // copied into a page that the server has unmapped, and that has
+        // since been handed to another process.
+
+        buffer_page = proc->pin_page(regs.r03);
+        buffer_phys = proc->virt_to_phys(regs.r03);
+    }
+
+    regs.r03 = m_proclt->create_endpoint(proc->id(), m_thread->id(), buffer_phys, std::move(buffer_page));
+}
+
+void
+exit_handler_intel_x64_hyperkernel::ipc_delete_endpoint(vmcall_registers_t &regs)
+{ m_proclt->delete_endpoint(m_vcpuid, regs.r03); }
+
+void
+exit_handler_intel_x64_hyperkernel::ipc_call(vmcall_registers_t &regs)
+{
+    expects(m_thread != nullptr);
+
+    auto &&proc = m_thread->proc();
+    auto &&endpoint = m_proclt->get_endpoint(regs.r03);
+
+    ipc_message msg = {};
+
+    // The vmcall is not completed when the client blocks, which means that
+    // once the server replies, and the client is woken (or switched to),
+    // the client executes the vmcall again, which then finds the reply.
+    // The reply's bytes have already been copied into the client's buffer
+    // by the server.
+
+    if (endpoint->take_reply(proc->id(), m_thread->id(), msg))
+    {
+        regs.r04 = msg.words.at(0);
+        regs.r05 = msg.words.at(1);
+        regs.r06 = msg.words.at(2);
+        regs.r07 = msg.words.at(3);
+        regs.r09 = regs.r08 != 0 ? msg.len : 0;
+
+        return;
+    }
+
+    if (endpoint->is_server(proc->id(), m_thread->id()))
+        throw std::runtime_error("an ipc server cannot call its own endpoint");
+
+    if (regs.r09 > IPC_BUFFER_SIZE)
+        throw std::invalid_argument("ipc message too large: " + std::to_string(regs.r09));
+
+    if (regs.r09 != 0 && (regs.r08 == 0 || endpoint->buffer_phys() == 0))
+        throw std::invalid_argument("ipc message has bytes, but no buffer");
+
+    // The client's buffer is checked up front, as it is not used until
+    // the client has already blocked. Once blocked, a bad buffer would
+    // leave the client blocked forever.
+
+    if (regs.r08 != 0)
+    {
+        proc->virt_to_phys(regs.r08);
+        proc->virt_to_phys(regs.r08 + IPC_BUFFER_SIZE - 1);
+    }
+
+    msg.processid = proc->id();
+    msg.threadid = m_thread->id();
+    msg.words = {{regs.r04, regs.r05, regs.r06, regs.r07}};
+    msg.buffer = regs.r08;
+    msg.len = regs.r09;
+
+    // The state must be saved before the client blocks, as the server is
+    // free to reply (and another vCPU to resume the client) as soon as the
+    // call is made.
+
+    m_thread->save_state(*m_state_save);
+
+    if (!endpoint->call(proc, m_thread, msg))
+        g_shm->get_scheduler(m_coreid)->yield();
+
+    ipc_copy_call(endpoint, msg.processid, msg.buffer, msg.len);
+    ipc_switch_to(endpoint->server_processid(), endpoint->server_threadid());
+}
+
+void
+exit_handler_intel_x64_hyperkernel::ipc_reply_wait(vmcall_registers_t &regs)
+{
+    expects(m_thread != nullptr);
+
+    auto &&proc = m_thread->proc();
+    auto &&endpoint = m_proclt->get_endpoint(regs.r03);
+
+    if (!endpoint->is_server(proc->id(), m_thread->id()))
+        throw std::runtime_error("only the ipc server can wait on an endpoint");
+
+    ipc_message msg = {};
+
+    // Like a client, a server that blocks executes the vmcall again once
+    // it is switched to (or woken), which then finds the call that was
+    // delivered to it. The reply was already sent before the server
+    // blocked, so it is not sent again.
+
+    auto &&deliver = [&]
+    {
+        regs.r03 = msg.processid;
+        regs.r04 = msg.words.at(0);
+        regs.r05 = msg.words.at(1);
+        regs.r06 = msg.words.at(2);
+        regs.r07 = msg.words.at(3);
+        regs.r09 = msg.len;
+    };
+
+    if (endpoint->take_delivery(msg))
+    {
+        deliver();
+        return;
+    }
+
+    if (regs.r09 > IPC_BUFFER_SIZE || (regs.r09 != 0 && endpoint->buffer_phys() == 0))
+        throw std::invalid_argument("invalid ipc reply length: " + std::to_string(regs.r09));
+
+    ipc_message reply = {};
+    ipc_message client = {};
+
+    reply.processid = proc->id();
+    reply.threadid = m_thread->id();
+    reply.words = {{regs.r04, regs.r05, regs.r06, regs.r07}};
+    reply.len = regs.r09;
+
+    auto &&replied = endpoint->reply(reply, client);
+
+    // Once replied to, the client is no longer known to the endpoint, so
+    // it has to be woken if anything below fails.
+
+    auto ___ = gsl::on_failure([&]
+    {
+        if (replied)
+            m_proclt->wake_thread(m_vcpuid, client.processid, client.threadid);
+    });
+
+    if (replied && client.buffer != 0 && reply.len != 0)
+    {
+        auto &&buffer = bfn::make_unique_map_x64<char>(endpoint->buffer_phys());
+        copy_to_process(m_proclt->get_process(client.processid), client.buffer, buffer.get(), reply.len);
+    }
+
+    m_thread->save_state(*m_state_save);
+
+    if (endpoint->wait(proc, m_thread, msg))
+    {
+        if (replied)
+            m_proclt->wake_thread(m_vcpuid, client.processid, client.threadid);
+
+        ipc_copy_call(endpoint, msg.processid, msg.buffer, msg.len);
+
+        deliver();
+        return;
+    }
+
+    if (replied)
+        ipc_switch_to(client.processid, client.threadid);
+
+    g_shm->get_scheduler(m_coreid)->yield();
+}
+
+void
+exit_handler_intel_x64_hyperkernel::ipc_copy_call(
+    ipc_endpoint *endpoint, processid::type processid, uintptr_t buffer, uint64_t len)
+{
+    if (len == 0)
+        return;
+
+    if (endpoint->buffer_phys() == 0)
+        throw std::runtime_error("ipc endpoint does not have a buffer");
+
+    auto &&page = bfn::make_unique_map_x64<char>(endpoint->buffer_phys());
+    copy_from_process(m_proclt->get_process(processid), buffer, page.get(), len);
+}
+
+void
+exit_handler_intel_x64_hyperkernel::ipc_switch_to(processid::type processid, threadid::type threadid)
+{
+    // The thread is handed this vCPU directly, instead of being queued and
+    // waiting for a vCPU to pick it up. If the thread cannot be handed off
+    // (e.g. its process was removed from the process list), it is woken
+    // instead, and this vCPU schedules something else.
+
+    if (auto &&thrd = m_proclt->handoff(m_vcpuid, processid, threadid))
+        g_shm->get_scheduler(m_coreid)->switch_to(thrd);
+
+    m_proclt->wake_thread(m_vcpuid, processid, threadid);
+    g_shm->get_scheduler(m_coreid)->yield();
+}
+
+bool
+exit_handler_intel_x64_hyperkernel::copy_to_ttys0(const char *buf, std::size_t len)
+{
+    expects(len <= TTYS0_BUFFER_SIZE);
+
+    if (m_ttys0.m_thread == nullptr)
+    {
+        std::cout.write(buf, gsl::narrow_cast<std::streamsize>(len));
+        return false;
+    }
+
+    // The driver is handed everything at once, in its own buffer, so
+    // there is one switch to the driver (and back) per flush, instead of
+    // one per byte.
+
+    auto &&buffer = bfn::make_unique_map_x64<char>(m_ttys0.m_buffer_phys);
+    memcpy(buffer.get(), buf, len);
+
+    return true;
+}
+
+void
+exit_handler_intel_x64_hyperkernel::run_ttys0(vmcall_registers_t &regs, std::size_t len)
+{
+    this->complete_vmcall(BF_VMCALL_SUCCESS, regs);
+    m_thread->save_state(*m_state_save);
+    g_shm->get_scheduler(m_coreid)->schedule(m_ttys0.m_thread, m_ttys0.m_entry, m_ttys0.m_buffer, len);
+}
+
 void
 exit_handler_intel_x64_hyperkernel::handle_vmcall_registers(vmcall_registers_t &regs)
+{
+    m_exit_stats->begin_vmcall(regs.r02);
+    dispatch_vmcall(regs);
+}
+
+void
+exit_handler_intel_x64_hyperkernel::dispatch_vmcall(vmcall_registers_t &regs)
 {
     switch (regs.r02)
     {
@@ -402,14 +1160,50 @@ exit_handler_intel_x64_hyperkernel::handle_vmcall_registers(vmcall_registers_t &
             delete_process(regs);
             break;
 
+        case hyperkernel_vmcall__fork:
+            fork(regs);
+            break;
+
+        case hyperkernel_vmcall__vm_map:
+            vm_map(regs);
+            break;
+
         case hyperkernel_vmcall__vm_map_lookup:
             vm_map_lookup(regs);
             break;
 
+        case hyperkernel_vmcall__vm_reserve:
+            vm_reserve(regs);
+            break;
+
+        case hyperkernel_vmcall__vm_map_segment:
+            vm_map_segment(regs);
+            break;
+
         case hyperkernel_vmcall__set_thread_info:
             set_thread_info(regs);
             break;
 
+        case hyperkernel_vmcall__create_thread:
+            create_thread(regs);
+            break;
+
+        case hyperkernel_vmcall__thread_exit:
+            thread_exit(regs);
+            break;
+
+        case hyperkernel_vmcall__thread_join:
+            thread_join(regs);
+            break;
+
+        case hyperkernel_vmcall__register_vmcall_ring:
+            register_vmcall_ring(regs);
+            break;
+
+        case hyperkernel_vmcall__vmcall_ring_doorbell:
+            vmcall_ring_doorbell(regs);
+            break;
+
         case hyperkernel_vmcall__sched_yield:
             sched_yield(regs);
             break;
@@ -418,6 +1212,14 @@ exit_handler_intel_x64_hyperkernel::handle_vmcall_registers(vmcall_registers_t &
             sched_yield_and_remove(regs);
             break;
 
+        case hyperkernel_vmcall__futex_wait:
+            futex_wait(regs);
+            break;
+
+        case hyperkernel_vmcall__futex_wake:
+            futex_wake(regs);
+            break;
+
         case hyperkernel_vmcall__set_program_break:
             set_program_break(regs);
             break;
@@ -430,6 +1232,18 @@ exit_handler_intel_x64_hyperkernel::handle_vmcall_registers(vmcall_registers_t &
             decrease_program_break(regs);
             break;
 
+        case hyperkernel_vmcall__mmap:
+            mmap(regs);
+            break;
+
+        case hyperkernel_vmcall__munmap:
+            munmap(regs);
+            break;
+
+        case hyperkernel_vmcall__mprotect:
+            mprotect(regs);
+            break;
+
         case hyperkernel_vmcall__ttys0:
             handle_ttys0(regs);
             break;
@@ -438,11 +1252,63 @@ exit_handler_intel_x64_hyperkernel::handle_vmcall_registers(vmcall_registers_t &
             handle_ttys1(regs);
             break;
 
+        case hyperkernel_vmcall__ttys0_flush:
+            ttys0_flush(regs);
+            break;
+
+        case hyperkernel_vmcall__ttys1_write:
+            ttys1_write(regs);
+            break;
+
         case hyperkernel_vmcall__register_ttys0:
             register_ttys0(regs);
             break;
 
+        case hyperkernel_vmcall__dump_exit_stats:
+            dump_exit_stats(regs);
+            break;
+
+        case hyperkernel_vmcall__ipc_create_endpoint:
+            ipc_create_endpoint(regs);
+            break;
+
+        case hyperkernel_vmcall__ipc_delete_endpoint:
+            ipc_delete_endpoint(regs);
+            break;
+
+        case hyperkernel_vmcall__ipc_call:
+            ipc_call(regs);
+            break;
+
+        case hyperkernel_vmcall__ipc_reply_wait:
+            ipc_reply_wait(regs);
+            break;
+
         default:
             throw std::runtime_error("unknown vmcall: " + std::to_string(regs.r02));
     };
 }
+
+process_list *
+exit_handler_intel_x64_hyperkernel::lookup_proclt(processlistid::type procltid)
+{
+    if (procltid == processlistid::current)
+        return m_proclt;
+
+    return g_plm->get_process_list(procltid).get();
+}
+
+process *
+exit_handler_intel_x64_hyperkernel::lookup_process(processlistid::type procltid, processid::type processid)
+{
+    if (processid == processid::current)
+    {
+        if (procltid != processlistid::current)
+            throw std::runtime_error("current process requires the current process list");
+
+        expects(m_thread != nullptr);
+        return m_thread->proc().get();
+    }
+
+    return lookup_proclt(procltid)->get_process(processid).get();
+}
@@ -0,0 +1,223 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#include <gsl/gsl>
+
+#include <map>
+#include <mutex>
+
+#include <debug.h>
+#include <exit_handler/exit_stats.h>
+
+extern "C" uint64_t thread_context_cpuid(void);
+
+// -----------------------------------------------------------------------------
+// Helpers
+// -----------------------------------------------------------------------------
+
+struct alignas(64) pending_exit
+{
+    exit_stats::counter *reason;
+    exit_stats::counter *vmcall;
+
+    uint64_t start;
+};
+
+static std::array<pending_exit, exit_stats::max_cores> g_pending_exits = {};
+
+static std::mutex g_exit_stats_mutex;
+static std::map<vcpuid::type, exit_stats *> g_exit_stats;
+
+static pending_exit &
+current_pending_exit() noexcept
+{ return g_pending_exits.at(thread_context_cpuid()); }
+
+static void
+record(exit_stats::counter *ctr, uint64_t ticks) noexcept
+{
+    auto &&bucket = 0UL;
+
+    while (bucket < exit_stats::num_buckets - 1 && (ticks >> (bucket + 1)) != 0)
+        bucket++;
+
+    ctr->total_ticks += ticks;
+    ctr->max_ticks = ticks > ctr->max_ticks ? ticks : ctr->max_ticks;
+    ctr->buckets[bucket]++;
+}
+
+static void
+dump_counter(const char *name, uint64_t key, const exit_stats::counter &ctr)
+{
+    if (ctr.count == 0)
+        return;
+
+    bfdebug << "  " << name << " " << view_as_pointer(key)
+            << ": count " << ctr.count
+            << ", avg ticks " << ctr.total_ticks / ctr.count
+            << ", max ticks " << ctr.max_ticks << '\n';
+
+    // Bucket i holds the exits that took [2^i, 2^(i + 1)) ticks, and the
+    // last bucket holds everything longer.
+
+    for (auto i = 0UL; i < exit_stats::num_buckets; i++)
+    {
+        if (ctr.buckets[i] != 0)
+            bfdebug << "    >= 2^" << i << " ticks: " << ctr.buckets[i] << '\n';
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Implementation
+// -----------------------------------------------------------------------------
+
+exit_stats::exit_stats(vcpuid::type vcpuid) :
+    m_vcpuid(vcpuid),
+    m_reasons{},
+    m_vmcalls{},
+    m_ring_entries{}
+{
+    std::lock_guard<std::mutex> guard(g_exit_stats_mutex);
+    g_exit_stats[m_vcpuid] = this;
+}
+
+exit_stats::~exit_stats()
+{
+    std::lock_guard<std::mutex> guard(g_exit_stats_mutex);
+    g_exit_stats.erase(m_vcpuid);
+
+    // An exit that never ended (e.g. the vCPU was deleted while handling
+    // it) must not be recorded into memory that no longer exists.
+
+    for (auto &pending : g_pending_exits)
+    {
+        if (pending.reason >= m_reasons.data() && pending.reason < m_reasons.data() + num_reasons)
+            pending = {};
+    }
+}
+
+void
+exit_stats::begin_exit(uint64_t reason) noexcept
+{
+    auto &&pending = current_pending_exit();
+    auto &&ctr = &m_reasons[reason < num_reasons ? reason : num_reasons - 1];
+
+    ctr->count++;
+
+    pending.reason = ctr;
+    pending.vmcall = nullptr;
+    pending.start = __builtin_ia32_rdtsc();
+}
+
+void
+exit_stats::begin_vmcall(uint64_t index) noexcept
+{
+    auto &&pending = current_pending_exit();
+    auto &&ctr = vmcall_counter(m_vmcalls, index);
+
+    ctr->count++;
+    pending.vmcall = ctr;
+}
+
+void
+exit_stats::ring_entry(uint64_t index, uint64_t ticks) noexcept
+{
+    auto &&ctr = vmcall_counter(m_ring_entries, index);
+
+    ctr->count++;
+    record(ctr, ticks);
+}
+
+void
+exit_stats::end_exit() noexcept
+{
+    auto &&pending = current_pending_exit();
+
+    if (pending.reason == nullptr)
+        return;
+
+    auto &&ticks = __builtin_ia32_rdtsc() - pending.start;
+
+    record(pending.reason, ticks);
+
+    if (pending.vmcall != nullptr)
+        record(pending.vmcall, ticks);
+
+    pending = {};
+}
+
+void
+exit_stats::dump() const
+{
+    bfdebug << "exit stats: vcpu " << view_as_pointer(m_vcpuid) << '\n';
+
+    for (auto i = 0UL; i < num_reasons; i++)
+        dump_counter("exit reason", i, m_reasons[i]);
+
+    for (const auto &ctr : m_vmcalls)
+        dump_counter("vmcall", ctr.key, ctr);
+
+    for (const auto &ctr : m_ring_entries)
+        dump_counter("ring entry", ctr.key, ctr);
+}
+
+void
+exit_stats::dump(vcpuid::type vcpuid)
+{
+    std::lock_guard<std::mutex> guard(g_exit_stats_mutex);
+
+    if (vcpuid != vcpuid::invalid)
+    {
+        auto &&iter = g_exit_stats.find(vcpuid);
+        if (iter == g_exit_stats.end())
+            throw std::invalid_argument("no exit stats for vcpu: " + std::to_string(vcpuid));
+
+        iter->second->dump();
+        return;
+    }
+
+    for (const auto &stats : g_exit_stats)
+        stats.second->dump();
+}
+
+exit_stats::counter *
+exit_stats::vmcall_counter(std::array<counter, num_vmcalls> &table, uint64_t index) noexcept
+{
+    // vmcall indexes are sparse, so they are kept in a small open
+    // addressing table. The last slot is shared by any index that does not
+    // fit, which is reported as index 0.
+
+    for (auto i = 0UL; i < num_vmcalls - 1; i++)
+    {
+        auto &&ctr = &table[(index + i) % (num_vmcalls - 1)];
+
+        if (ctr->key == index)
+            return ctr;
+
+        if (ctr->count == 0 && ctr->key == 0)
+        {
+            ctr->key = index;
+            return ctr;
+        }
+    }
+
+    return &table[num_vmcalls - 1];
+}
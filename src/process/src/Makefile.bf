@@ -66,6 +66,7 @@ NATIVE_OUTDIR+=%BUILD_REL%/../bin
 
 SOURCES+=process.cpp
 SOURCES+=process_intel_x64.cpp
+SOURCES+=page_walker_x64.cpp
 
 INCLUDE_PATHS+=../../../include
 INCLUDE_PATHS+=%HYPER_ABS%/include/
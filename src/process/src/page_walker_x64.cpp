@@ -0,0 +1,118 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include <gsl/gsl>
+#include <stdexcept>
+
+#include <process/page_walker_x64.h>
+
+// -----------------------------------------------------------------------------
+// Constants
+// -----------------------------------------------------------------------------
+
+constexpr const auto num_levels = 4UL;
+constexpr const auto entry_present = 1UL << 0;
+constexpr const auto entry_ps = 1UL << 7;
+constexpr const auto phys_mask = 0x000FFFFFFFFFF000UL;
+constexpr const auto invalid_table = 0xFFFFFFFFFFFFFFFFUL;
+
+// -----------------------------------------------------------------------------
+// Implementation
+// -----------------------------------------------------------------------------
+
+static auto
+level_shift(std::size_t level)
+{ return 39UL - (9UL * level); }
+
+page_walker_x64::page_walker_x64(integer_pointer cr3) noexcept :
+    m_cr3(cr3 & phys_mask)
+{
+    for (auto &cache : m_tables)
+        cache.phys = invalid_table;
+}
+
+uintptr_t
+page_walker_x64::entry(std::size_t level, integer_pointer table, integer_pointer virt)
+{
+    auto &&cache = m_tables.at(level);
+
+    if (cache.phys != table)
+    {
+        cache.table = bfn::make_unique_map_x64<uintptr_t>(table);
+        cache.phys = table;
+    }
+
+    auto &&index = gsl::narrow_cast<std::ptrdiff_t>((virt >> level_shift(level)) & 0x1FF);
+    return cache.table.get()[index];
+}
+
+page_walker_x64::integer_pointer
+page_walker_x64::translate(integer_pointer virt, integer_pointer &page_size)
+{
+    integer_pointer table = m_cr3;
+
+    for (auto level = 0UL; level < num_levels; level++)
+    {
+        auto &&pte = this->entry(level, table, virt);
+
+        if ((pte & entry_present) == 0)
+            throw std::runtime_error("page walk failed: virtual address not mapped");
+
+        page_size = 1UL << level_shift(level);
+
+        // Level 0 (the PML4) cannot map a page, so the PS bit is only
+        // honoured in the PDPT (1g) and the PD (2m).
+
+        if (level == num_levels - 1 || (level != 0 && (pte & entry_ps) != 0))
+            return (pte & phys_mask & ~(page_size - 1)) + (virt & (page_size - 1));
+
+        table = pte & phys_mask;
+    }
+
+    throw std::logic_error("page walk failed: unreachable");
+}
+
+page_walker_x64::extent
+page_walker_x64::next_extent(integer_pointer virt, integer_pointer size)
+{
+    expects((virt & 0xFFF) == 0);
+    expects(size != 0);
+
+    integer_pointer page_size = 0;
+
+    auto &&phys = this->translate(virt, page_size);
+    auto &&ext = extent{virt, phys, page_size - (virt & (page_size - 1))};
+
+    while (ext.size < size)
+    {
+        auto &&next = this->translate(virt + ext.size, page_size);
+
+        if (next != phys + ext.size)
+            break;
+
+        ext.size += page_size - (next & (page_size - 1));
+    }
+
+    if (ext.size > size)
+        ext.size = size;
+
+    return ext;
+}
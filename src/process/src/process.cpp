@@ -20,15 +20,45 @@
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
 #include <debug.h>
+#include <upper_lower.h>
+
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <utility>
 
 #include <process/process.h>
+#include <memory_manager/map_ptr_x64.h>
 #include <memory_manager/memory_manager_x64.h>
 
-process::process(processid::type id) :
+// -----------------------------------------------------------------------------
+// Constants
+// -----------------------------------------------------------------------------
+
+// mmap places memory between the program break (which starts just above the
+// loaded binaries) and the end of the domain's 4GB identity map.
+
+constexpr const auto mmap_base = 0x0000000040000000UL;
+constexpr const auto mmap_limit = 0x00000000C0000000UL;
+
+constexpr const auto page_size_4k = 0x1000UL;
+constexpr const auto page_size_2m = 0x200000UL;
+
+static auto
+align_up(uintptr_t addr, uintptr_t align)
+{ return (addr + align - 1) & ~(align - 1); }
+
+// -----------------------------------------------------------------------------
+// Implementation
+// -----------------------------------------------------------------------------
+
+process::process(processid::type id, gsl::not_null<page_pool *> pool) :
     m_id(id),
     m_is_initialized(false),
+    m_page_pool(pool),
     m_program_break(0),
-    m_thread_next_id(0),
+    m_is_queued(false),
     m_thread_factory(std::make_unique<thread_factory>())
 {
     if ((id & processid::reserved) != 0)
@@ -81,52 +111,318 @@ process::vm_map_lookup(uintptr_t virt,
     throw std::logic_error("vm_map not implemented!!!");
 }
 
+uint64_t
+process::read_word(uintptr_t virt)
+{
+    (void) virt;
+
+    throw std::logic_error("read_word not implemented!!!");
+}
+
+uintptr_t
+process::virt_to_phys(uintptr_t virt)
+{
+    (void) virt;
+
+    throw std::logic_error("virt_to_phys not implemented!!!");
+}
+
+void
+process::vm_unmap(uintptr_t virt, uintptr_t size)
+{
+    (void) virt;
+    (void) size;
+
+    throw std::logic_error("vm_unmap not implemented!!!");
+}
+
+void
+process::vm_sync()
+{ }
+
+void
+process::vm_share(gsl::not_null<process *> child)
+{
+    (void) child;
+
+    throw std::logic_error("vm_share not implemented!!!");
+}
+
+uintptr_t
+process::vm_shared(uintptr_t virt) const
+{
+    (void) virt;
+    return 0;
+}
+
+void
+process::vm_map_shared(uintptr_t virt, uintptr_t phys, uintptr_t size)
+{
+    (void) virt;
+    (void) phys;
+    (void) size;
+
+    throw std::logic_error("vm_map_shared not implemented!!!");
+}
+
 threadid::type
 process::create_thread(user_data *data)
 {
+    auto threadid = m_threads.reserve();
+
     auto ___ = gsl::on_failure([&]
-    {
-        std::lock_guard<std::mutex> guard(m_thread_mutex);
-        m_threads.erase(m_thread_next_id);
-    });
+    { m_threads.remove(threadid); });
 
-    if (auto && thread = __add_thread(m_thread_next_id, data))
+    if (auto && thread = __add_thread(threadid, data))
         thread->init(data);
 
-    return m_thread_next_id++;
+    return threadid;
 }
 
 void
 process::delete_thread(threadid::type threadid, user_data *data)
 {
     auto ___ = gsl::finally([&]
-    {
-        std::lock_guard<std::mutex> guard(m_thread_mutex);
-        m_threads.erase(threadid);
-    });
+    { m_threads.remove(threadid); });
 
-    if (auto && thread = __get_thread(threadid))
+    if (auto && thread = m_threads.get(threadid))
+    {
+        this->exit_thread(thread, 0);
         thread->fini(data);
+    }
 }
 
 gsl::not_null<thread *>
 process::get_thread(threadid::type threadid)
-{ return __get_thread(threadid).get(); }
+{
+    if (auto && thread = m_threads.get(threadid))
+        return thread;
+
+    throw std::invalid_argument("unknown thread: " + std::to_string(threadid));
+}
+
+thread *
+process::find_thread(threadid::type threadid)
+{ return m_threads.get(threadid); }
+
+std::pair<thread *, bool>
+process::next_thread(vcpuid::type id, bool &migrated)
+{
+    std::lock_guard<std::mutex> guard(m_run_queue_mutex);
+
+    m_is_queued = false;
+    migrated = false;
+
+    if (m_run_queue.empty())
+        return {nullptr, false};
+
+    auto &&thrd = m_run_queue.front();
+    m_run_queue.pop_front();
+
+    if (thrd->vcpuid() != id)
+    {
+        migrated = thrd->vcpuid() != vcpuid::invalid;
+        thrd->set_vcpuid(id);
+    }
+
+    thrd->set_state(thread_state::running);
+
+    if (!m_run_queue.empty())
+        m_is_queued = true;
+
+    return {thrd, m_is_queued};
+}
+
+bool
+process::requeue_thread(vcpuid::type id, gsl::not_null<thread *> thrd)
+{
+    std::lock_guard<std::mutex> guard(m_run_queue_mutex);
+
+    if (thrd->state() != thread_state::running || thrd->vcpuid() != id)
+        return false;
+
+    thrd->set_state(thread_state::runnable);
+    m_run_queue.push_back(thrd);
+
+    if (m_is_queued)
+        return false;
+
+    m_is_queued = true;
+    return true;
+}
+
+bool
+process::wake_thread(gsl::not_null<thread *> thrd)
+{
+    std::lock_guard<std::mutex> guard(m_run_queue_mutex);
+
+    if (thrd->state() != thread_state::blocked)
+        return false;
+
+    thrd->set_state(thread_state::runnable);
+    m_run_queue.push_back(thrd);
+
+    if (m_is_queued)
+        return false;
+
+    m_is_queued = true;
+    return true;
+}
+
+bool
+process::handoff_thread(vcpuid::type id, gsl::not_null<thread *> thrd)
+{
+    std::lock_guard<std::mutex> guard(m_run_queue_mutex);
+
+    if (thrd->state() != thread_state::blocked)
+        return false;
+
+    thrd->set_vcpuid(id);
+    thrd->set_state(thread_state::running);
+
+    return true;
+}
+
+void
+process::block_thread(gsl::not_null<thread *> thrd)
+{
+    std::lock_guard<std::mutex> guard(m_run_queue_mutex);
+
+    expects(thrd->state() == thread_state::running);
+    thrd->set_state(thread_state::blocked);
+}
+
+threadid::type
+process::exit_thread(gsl::not_null<thread *> thrd, uint64_t retval)
+{
+    std::lock_guard<std::mutex> guard(m_run_queue_mutex);
+
+    if (thrd->state() == thread_state::exited)
+        return threadid::invalid;
+
+    if (thrd->state() == thread_state::runnable)
+        m_run_queue.remove(thrd.get());
+
+    thrd->set_state(thread_state::exited);
+    thrd->set_retval(retval);
+
+    return thrd->joiner();
+}
+
+bool
+process::join_thread(
+    gsl::not_null<thread *> thrd, gsl::not_null<thread *> target, uint64_t &retval)
+{
+    std::lock_guard<std::mutex> guard(m_run_queue_mutex);
+
+    if (thrd == target)
+        throw std::invalid_argument("a thread cannot join itself");
+
+    if (target->joiner() != threadid::invalid && target->joiner() != thrd->id())
+        throw std::runtime_error("thread already joined: " + std::to_string(target->id()));
+
+    target->set_joiner(thrd->id());
+
+    if (target->state() == thread_state::exited)
+    {
+        retval = target->retval();
+        return true;
+    }
+
+    expects(thrd->state() == thread_state::running);
+    thrd->set_state(thread_state::blocked);
+
+    return false;
+}
+
+bool
+process::futex_wait(gsl::not_null<thread *> thrd, uintptr_t addr, uint64_t expected)
+{
+    std::lock_guard<std::mutex> guard(m_futex_mutex);
+
+    if (this->read_word(addr) != expected)
+        return false;
+
+    m_futex_queues[addr].push_back(thrd->id());
+    this->block_thread(thrd);
+
+    return true;
+}
+
+std::pair<uint64_t, bool>
+process::futex_wake(uintptr_t addr, uint64_t num)
+{
+    auto &&woken = 0UL;
+    auto &&must_queue = false;
+
+    std::lock_guard<std::mutex> guard(m_futex_mutex);
+
+    auto &&iter = m_futex_queues.find(addr);
+    if (iter == m_futex_queues.end())
+        return {0, false};
+
+    auto &&waiters = iter->second;
+
+    while (woken < num && !waiters.empty())
+    {
+        auto &&thrd = this->find_thread(waiters.front());
+        waiters.pop_front();
+
+        // The thread might have been deleted while it was blocked, in
+        // which case it does not count as woken.
+
+        if (thrd == nullptr)
+            continue;
+
+        if (this->wake_thread(thrd))
+            must_queue = true;
+
+        woken++;
+    }
+
+    if (waiters.empty())
+        m_futex_queues.erase(iter);
+
+    return {woken, must_queue};
+}
 
 void
 process::clear_set_program_break(integer_pointer pb)
 {
-    m_program_break = pb;
-    m_pages.clear();
+    auto &&freed = std::vector<heap_chunk>();
+
+    {
+        std::lock_guard<std::mutex> guard(m_vma_mutex);
+
+        for (const auto &chunk : m_heap)
+            this->vm_unmap(chunk.virt, chunk.size);
+
+        m_program_break = pb;
+        freed.swap(m_heap);
+    }
+
+    this->vm_sync();
 }
 
 void
-process::increase_program_break_4k()
+process::increase_program_break(integer_pointer num_pages)
 {
-    auto &&page = std::make_unique<char[]>(4096);
+    expects(num_pages != 0);
+
+    std::lock_guard<std::mutex> guard(m_vma_mutex);
 
-    auto &&virt = m_program_break;
-    auto &&phys = g_mm->virtptr_to_physint(page.get());
+    auto &&max_size = std::numeric_limits<integer_pointer>::max() - m_program_break;
+
+    if (num_pages > max_size / page_size_4k)
+        throw std::invalid_argument("increase_program_break: too many pages: " + std::to_string(num_pages));
+
+    auto virt = m_program_break;
+    auto &&size = num_pages * page_size_4k;
+    auto &&pages = std::vector<page_pool::shared_page_ptr>();
+
+    pages.reserve(num_pages);
+    for (auto i = 0UL; i < num_pages; i++)
+        pages.push_back(m_page_pool->alloc_shared_page());
 
     // TODO:
     //
@@ -134,40 +430,640 @@ process::increase_program_break_4k()
     // be generalized (probably use the permissions for mmap)
     //
 
-    this->vm_map(virt, phys, 0x1000, 0);
+    auto &&mapped = 0UL;
+
+    // If a map fails, only the runs before it were mapped, so only those
+    // are unmapped. This runs while the stack is unwinding, so a failure
+    // here is reported instead of thrown.
+
+    auto ___ = gsl::on_failure([&]
+    {
+        if (mapped == 0)
+            return;
+
+        try
+        {
+            this->vm_unmap(virt, mapped);
+        }
+        catch (std::exception &e)
+        {
+            bferror << "increase_program_break: failed to unmap after a failed map: " << e.what() << bfendl;
+        }
+    });
+
+    // Pages that happen to be physically contiguous are mapped as a single
+    // run, which saves vm_map calls. The pool makes no promise that they
+    // are (see page_pool::refill), so a run is rarely large enough (or
+    // aligned well enough) for vm_map to use a large page.
+
+    auto &&run_start = 0UL;
+    auto &&run_phys = g_mm->virtptr_to_physint(pages.front().get());
+
+    for (auto i = 1UL; i < num_pages; i++)
+    {
+        auto &&offset = i * page_size_4k;
+        auto &&phys = g_mm->virtptr_to_physint(pages.at(i).get());
+
+        if (phys == run_phys + (offset - run_start))
+            continue;
+
+        this->vm_map(virt + run_start, run_phys, offset - run_start, 0);
+
+        mapped = offset;
+        run_start = offset;
+        run_phys = phys;
+    }
+
+    this->vm_map(virt + run_start, run_phys, size - run_start, 0);
 
-    m_program_break += 0x1000;
-    m_pages.push_back(std::move(page));
+    m_heap.push_back({virt, size, std::move(pages)});
+    m_program_break += size;
 }
 
 void
-process::decrease_program_break_4k()
+process::decrease_program_break(integer_pointer num_pages)
+{
+    expects(num_pages != 0);
+
+    auto &&freed = std::vector<heap_chunk>();
+
+    {
+        std::lock_guard<std::mutex> guard(m_vma_mutex);
+
+        // Every chunk starts at the program break it was added at, so the
+        // first chunk (if any) starts at the bottom of the heap.
+
+        auto &&heap_size = m_heap.empty() ? 0 : m_program_break - m_heap.front().virt;
+
+        if (num_pages > heap_size / page_size_4k)
+            throw std::invalid_argument("decrease_program_break: too many pages: " + std::to_string(num_pages));
+
+        // An increase can be mapped with large pages, which cannot be
+        // partially unmapped, so the program break can only drop back to
+        // where an earlier increase started.
+
+        auto &&pb = m_program_break - (num_pages * page_size_4k);
+
+        auto &&boundary = std::any_of(m_heap.begin(), m_heap.end(), [&](const auto & chunk)
+        { return chunk.virt == pb; });
+
+        if (!boundary)
+            throw std::invalid_argument("decrease_program_break: not the start of an increase: " + std::to_string(num_pages));
+
+        m_program_break = pb;
+
+        while (!m_heap.empty() && m_heap.back().virt >= m_program_break)
+        {
+            this->vm_unmap(m_heap.back().virt, m_heap.back().size);
+
+            freed.push_back(std::move(m_heap.back()));
+            m_heap.pop_back();
+        }
+    }
+
+    // The pages are only freed once no core can still be using a stale
+    // translation to them, which is waited for without holding the lock.
+
+    this->vm_sync();
+}
+
+process::integer_pointer
+process::mmap(
+    integer_pointer addr, integer_pointer size, integer_pointer perm, bool lazy)
 {
-    m_program_break -= 0x1000;
-    m_pages.pop_back();
+    expects(size != 0);
+
+    if (size > mmap_limit - mmap_base)
+        throw std::runtime_error("mmap: out of virtual address space");
+
+    size = align_up(size, page_size_4k);
+
+    std::lock_guard<std::mutex> guard(m_vma_mutex);
+
+    auto &&virt = __find_free_range(bfn::upper(addr), size);
+    auto &&area = vma{size, perm, {}, {}};
+
+    area.pages.resize(size / page_size_4k);
+
+    if (!lazy)
+    {
+        for (auto &page : area.pages)
+            page = m_page_pool->alloc_shared_page();
+
+        __map_vma(virt, area);
+    }
+
+    m_vmas[virt] = std::move(area);
+    return virt;
 }
 
-std::unique_ptr<thread> &
+void
+process::reserve(
+    integer_pointer virt, integer_pointer size, integer_pointer perm,
+    std::vector<page_pool::shared_page_ptr> backing)
+{
+    expects(bfn::lower(virt) == 0);
+    expects(size != 0);
+
+    size = align_up(size, page_size_4k);
+    expects(backing.empty() || backing.size() == size / page_size_4k);
+
+    std::lock_guard<std::mutex> guard(m_vma_mutex);
+
+    auto &&iter = m_vmas.lower_bound(virt + size);
+    if (iter != m_vmas.begin() && std::prev(iter)->first + std::prev(iter)->second.size > virt)
+        throw std::invalid_argument("reserve: range is already in use");
+
+    auto &&area = vma{size, perm, {}, std::move(backing)};
+    area.pages.resize(size / page_size_4k);
+
+    m_vmas[virt] = std::move(area);
+}
+
+bool
+process::handle_fault(integer_pointer virt, bool write)
+{
+    auto &&stale = page_pool::shared_page_ptr();
+
+    {
+        std::lock_guard<std::mutex> guard(m_vma_mutex);
+
+        // Shared pages are mapped read / execute, so only a write has to be
+        // copied. Any other access raced with the page being remapped (e.g.
+        // copied by another thread), and simply has to be retried.
+
+        auto &&phys = this->vm_shared(virt);
+
+        if (phys == 0)
+            return __fault_in(virt);
+
+        if (!write)
+            return true;
+
+        stale = __copy_on_write(virt, phys);
+    }
+
+    // Other cores running this process can still read the shared page
+    // through a stale translation. Until they have dropped it, the other
+    // process must not become the page's only owner (and write to it, or
+    // free it), so this process keeps its reference until vm_sync returns.
+
+    this->vm_sync();
+    return true;
+}
+
+uint64_t
+process::resident_pages() const
+{
+    auto &&num = 0UL;
+
+    std::lock_guard<std::mutex> guard(m_vma_mutex);
+
+    for (const auto &chunk : m_heap)
+        num += chunk.size / page_size_4k;
+
+    for (const auto &area : m_vmas)
+    {
+        for (const auto &page : area.second.pages)
+            num += page ? 1 : 0;
+    }
+
+    return num;
+}
+
+uint64_t
+process::reserved_pages() const
+{
+    auto &&num = 0UL;
+
+    std::lock_guard<std::mutex> guard(m_vma_mutex);
+
+    for (const auto &chunk : m_heap)
+        num += chunk.size / page_size_4k;
+
+    for (const auto &area : m_vmas)
+        num += area.second.size / page_size_4k;
+
+    return num;
+}
+
+void
+process::munmap(integer_pointer addr, integer_pointer size)
+{
+    expects(bfn::lower(addr) == 0);
+
+    size = align_up(size, page_size_4k);
+
+    auto &&freed = std::vector<vma>();
+
+    {
+        std::lock_guard<std::mutex> guard(m_vma_mutex);
+
+        __split_vma(addr);
+        __split_vma(addr + size);
+
+        auto &&iter = m_vmas.lower_bound(addr);
+        while (iter != m_vmas.end() && iter->first < addr + size)
+        {
+            if (iter->second.perm != 0)
+                __unmap_vma(iter->first, iter->second, iter->second.pages.size());
+
+            freed.push_back(std::move(iter->second));
+            iter = m_vmas.erase(iter);
+        }
+    }
+
+    // Like decrease_program_break, the pages are only freed once no core
+    // can still be using a stale translation to them.
+
+    this->vm_sync();
+}
+
+void
+process::mprotect(integer_pointer addr, integer_pointer size, integer_pointer perm)
+{
+    expects(bfn::lower(addr) == 0);
+
+    size = align_up(size, page_size_4k);
+
+    {
+        std::lock_guard<std::mutex> guard(m_vma_mutex);
+
+        for (auto next = addr; next < addr + size;)
+        {
+            auto &&iter = m_vmas.upper_bound(next);
+            if (iter == m_vmas.begin())
+                throw std::invalid_argument("mprotect: range is not mapped");
+
+            --iter;
+
+            if (next - iter->first >= iter->second.size)
+                throw std::invalid_argument("mprotect: range is not mapped");
+
+            next = iter->first + iter->second.size;
+        }
+
+        __split_vma(addr);
+        __split_vma(addr + size);
+
+        // TODO:
+        //
+        // The EPT does not enforce the read / write / execute permissions yet
+        // (see vm_map_page), so the only permission change that has an effect
+        // is to and from PROT_NONE.
+        //
+
+        for (auto iter = m_vmas.find(addr); iter != m_vmas.end() && iter->first < addr + size; ++iter)
+        {
+            auto &&area = iter->second;
+            auto old_perm = area.perm;
+
+            auto ___ = gsl::on_failure([&]
+            {
+                area.perm = old_perm;
+            });
+
+            area.perm = perm;
+
+            if (old_perm != 0 && perm == 0)
+                __unmap_vma(iter->first, area, area.pages.size());
+
+            if (old_perm == 0 && perm != 0)
+                __map_vma(iter->first, area);
+        }
+    }
+
+    // Like munmap, memory that was made PROT_NONE is only inaccessible once
+    // no core can still be using a stale translation to it.
+
+    this->vm_sync();
+}
+
+void
+process::map_shared_pages(
+    integer_pointer virt, const std::vector<page_pool::shared_page_ptr> &pages)
+{
+    expects(bfn::lower(virt) == 0);
+
+    std::lock_guard<std::mutex> guard(m_vma_mutex);
+
+    for (const auto &page : pages)
+    {
+        auto &&phys = g_mm->virtptr_to_physint(page.get());
+        this->vm_map_shared(virt, phys, page_size_4k);
+
+        m_mapped_pages[virt] = page;
+        virt += page_size_4k;
+    }
+}
+
+page_pool::shared_page_ptr
+process::pin_page(integer_pointer virt)
+{
+    expects(bfn::lower(virt) == 0);
+
+    std::lock_guard<std::mutex> guard(m_vma_mutex);
+
+    if (auto &&slot = __find_page(virt))
+        return *slot;
+
+    return nullptr;
+}
+
+void
+process::fork(gsl::not_null<process *> child)
+{
+    {
+        std::lock(m_vma_mutex, child->m_vma_mutex);
+
+        std::lock_guard<std::mutex> guard1(m_vma_mutex, std::adopt_lock);
+        std::lock_guard<std::mutex> guard2(child->m_vma_mutex, std::adopt_lock);
+
+        // The child takes a reference to each of this process's pages, so
+        // a page that is later copied by one process stays alive for the
+        // other. Pages of a lazy range that were never touched are simply
+        // faulted in separately by each process.
+
+        child->m_program_break = m_program_break;
+        child->m_heap = m_heap;
+        child->m_vmas = m_vmas;
+        child->m_mapped_pages = m_mapped_pages;
+
+        this->vm_share(child);
+    }
+
+    // Until every core running this process has dropped its writable
+    // translations, a write from one of its other threads would be seen
+    // by the child, so the fork is not complete until then.
+
+    this->vm_sync();
+}
+
+page_pool::shared_page_ptr *
+process::__find_page(integer_pointer virt)
+{
+    auto &&iter = m_vmas.upper_bound(virt);
+    if (iter != m_vmas.begin())
+    {
+        --iter;
+
+        if (virt - iter->first < iter->second.size)
+            return &iter->second.pages.at((virt - iter->first) / page_size_4k);
+    }
+
+    for (auto &chunk : m_heap)
+    {
+        if (virt - chunk.virt < chunk.size)
+            return &chunk.pages.at((virt - chunk.virt) / page_size_4k);
+    }
+
+    auto &&page = m_mapped_pages.find(virt);
+    if (page != m_mapped_pages.end())
+        return &page->second;
+
+    return nullptr;
+}
+
+page_pool::shared_page_ptr
+process::__copy_on_write(integer_pointer virt, integer_pointer phys)
+{
+    auto &&slot = __find_page(virt);
+
+    // If the other process has already copied the page (or exited), this
+    // process is the only owner left, and can simply write to it.
+
+    if (slot != nullptr && *slot && slot->use_count() == 1)
+    {
+        this->vm_unmap(virt, page_size_4k);
+        this->vm_map(virt, phys, page_size_4k, 0);
+
+        return nullptr;
+    }
+
+    // Memory that the process does not own (e.g. ELF segments mapped with
+    // vm_map_lookup) is never written to, so the copy is kept with the
+    // process's other mapped pages instead.
+
+    auto &&page = m_page_pool->alloc_shared_page();
+    auto &&src = bfn::make_unique_map_x64<char>(phys);
+
+    std::memcpy(page.get(), src.get(), page_size_4k);
+
+    this->vm_unmap(virt, page_size_4k);
+    this->vm_map(virt, g_mm->virtptr_to_physint(page.get()), page_size_4k, 0);
+
+    if (slot != nullptr && *slot)
+        return std::exchange(*slot, std::move(page));
+
+    m_mapped_pages[virt] = std::move(page);
+    return nullptr;
+}
+
+bool
+process::__fault_in(integer_pointer virt)
+{
+    auto &&iter = m_vmas.upper_bound(virt);
+    if (iter == m_vmas.begin())
+        return false;
+
+    --iter;
+
+    auto &&area = iter->second;
+    auto &&offset = bfn::upper(virt - iter->first);
+
+    if (offset >= area.size || area.perm == 0)
+        return false;
+
+    auto &&index = offset / page_size_4k;
+    auto &&page = area.pages.at(index);
+
+    // Two threads can fault on the same page at the same time, in which
+    // case the second one finds it already mapped.
+
+    if (page)
+        return true;
+
+    auto &&new_page = page_pool::shared_page_ptr();
+
+    // A forked process shares the initial contents, so they are only used
+    // in place by the last process to touch the page, and copied by the
+    // others.
+
+    if (!area.backing.empty())
+    {
+        auto &&src = std::move(area.backing.at(index));
+
+        if (src.use_count() == 1)
+        {
+            new_page = std::move(src);
+        }
+        else
+        {
+            new_page = m_page_pool->alloc_shared_page();
+            std::memcpy(new_page.get(), src.get(), page_size_4k);
+        }
+    }
+    else
+    {
+        new_page = m_page_pool->alloc_shared_page();
+    }
+
+    auto &&phys = g_mm->virtptr_to_physint(new_page.get());
+    this->vm_map(iter->first + offset, phys, page_size_4k, area.perm);
+
+    page = std::move(new_page);
+    return true;
+}
+
+thread *
 process::__add_thread(threadid::type threadid, user_data *data)
 {
     if (!m_thread_factory)
         throw std::runtime_error("invalid thread factory");
 
-    if (__get_thread(threadid))
-        throw std::runtime_error("thread already exists: " + std::to_string(threadid));
-
     if (auto && thread = m_thread_factory->make_thread(threadid, this, data))
+        return m_threads.add(threadid, std::move(thread));
+
+    throw std::runtime_error("make_thread returned a nullptr thread");
+}
+
+process::integer_pointer
+process::__find_free_range(integer_pointer addr, integer_pointer size) const
+{
+    auto &&align = size >= page_size_2m ? page_size_2m : page_size_4k;
+
+    if (size > mmap_limit - mmap_base)
+        throw std::runtime_error("mmap: out of virtual address space");
+
+    auto is_free = [&](integer_pointer virt)
+    {
+        if (virt < mmap_base || virt > mmap_limit || size > mmap_limit - virt)
+            return false;
+
+        auto &&iter = m_vmas.lower_bound(virt + size);
+        if (iter == m_vmas.begin())
+            return true;
+
+        --iter;
+        return iter->first + iter->second.size <= virt;
+    };
+
+    if (addr != 0 && is_free(addr))
+        return addr;
+
+    auto &&virt = align_up(mmap_base, align);
+    for (const auto &area : m_vmas)
     {
-        std::lock_guard<std::mutex> guard(m_thread_mutex);
-        return m_threads[threadid] = std::move(thread);
+        if (area.first >= virt + size)
+            break;
+
+        if (area.first + area.second.size > virt)
+            virt = align_up(area.first + area.second.size, align);
     }
 
-    throw std::runtime_error("make_thread returned a nullptr thread");
+    if (virt > mmap_limit || size > mmap_limit - virt)
+        throw std::runtime_error("mmap: out of virtual address space");
+
+    return virt;
 }
 
-std::unique_ptr<thread> &
-process::__get_thread(threadid::type threadid)
+void
+process::__split_vma(integer_pointer addr)
 {
-    std::lock_guard<std::mutex> guard(m_thread_mutex);
-    return m_threads[threadid];
+    auto &&iter = m_vmas.upper_bound(addr);
+    if (iter == m_vmas.begin())
+        return;
+
+    --iter;
+
+    auto &&start = iter->first;
+    auto &&area = iter->second;
+
+    if (addr == start || addr - start >= area.size)
+        return;
+
+    auto &&first = std::next(area.pages.begin(), gsl::narrow_cast<std::ptrdiff_t>((addr - start) / page_size_4k));
+    auto &&tail = vma{start + area.size - addr, area.perm, {}, {}};
+
+    tail.pages.assign(std::make_move_iterator(first), std::make_move_iterator(area.pages.end()));
+    area.pages.erase(first, area.pages.end());
+
+    if (!area.backing.empty())
+    {
+        auto &&backing = std::next(area.backing.begin(), gsl::narrow_cast<std::ptrdiff_t>(area.pages.size()));
+
+        tail.backing.assign(std::make_move_iterator(backing), std::make_move_iterator(area.backing.end()));
+        area.backing.erase(backing, area.backing.end());
+    }
+
+    area.size = addr - start;
+
+    m_vmas[addr] = std::move(tail);
+}
+
+void
+process::__map_vma(integer_pointer addr, const vma &area)
+{
+    if (area.perm == 0)
+        return;
+
+    auto &&mapped = 0UL;
+
+    // If a map fails, only the pages before it were mapped, so only those
+    // are unmapped. This runs while the stack is unwinding, so a failure
+    // here is reported instead of thrown.
+
+    auto ___ = gsl::on_failure([&]
+    {
+        try
+        {
+            __unmap_vma(addr, area, mapped);
+        }
+        catch (std::exception &e)
+        {
+            bferror << "map_vma: failed to unmap after a failed map: " << e.what() << bfendl;
+        }
+    });
+
+    for (; mapped < area.pages.size(); mapped++)
+    {
+        const auto &page = area.pages.at(mapped);
+
+        if (!page)
+            continue;
+
+        auto &&virt = addr + (mapped * page_size_4k);
+        auto &&phys = g_mm->virtptr_to_physint(page.get());
+
+        // A page that another process still references (e.g. after a fork)
+        // has to stay read / execute, so that a write to it is still copied
+        // (see handle_fault) instead of landing in the other process.
+
+        if (page.use_count() > 1)
+            this->vm_map_shared(virt, phys, page_size_4k);
+        else
+            this->vm_map(virt, phys, page_size_4k, area.perm);
+    }
+}
+
+void
+process::__unmap_vma(integer_pointer addr, const vma &area, std::size_t num)
+{
+    // Pages of a lazy range that were never touched were never mapped, so
+    // only the runs of pages that are present are unmapped.
+
+    for (auto i = 0UL; i < num;)
+    {
+        if (!area.pages.at(i))
+        {
+            i++;
+            continue;
+        }
+
+        auto start = i;
+        while (i < num && area.pages.at(i))
+            i++;
+
+        this->vm_unmap(addr + (start * page_size_4k), (i - start) * page_size_4k);
+    }
 }
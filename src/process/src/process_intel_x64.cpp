@@ -23,41 +23,89 @@
 #include <upper_lower.h>
 
 #include <domain/domain_intel_x64.h>
+#include <process/page_walker_x64.h>
 #include <process/process_intel_x64.h>
 
+#include <intrinsics/msrs_x64.h>
+#include <intrinsics/vmx_intel_x64.h>
 #include <memory_manager/map_ptr_x64.h>
 #include <memory_manager/memory_manager_x64.h>
 
 using namespace x64;
 using namespace intel_x64;
 
+extern "C" uint64_t thread_context_cpuid(void);
+
+// IA32_VMX_EPT_VPID_CAP reports which large EPT pages the CPU supports.
+
+constexpr const auto ia32_vmx_ept_vpid_cap = 0x0000048CU;
+constexpr const auto ept_vpid_cap_2m_pages = 1ULL << 16;
+constexpr const auto ept_vpid_cap_1g_pages = 1ULL << 17;
+
+// The EPTP of the process that each core is executing (or has just
+// executed, if it is handling one of its exits), or 0 if the core is
+// executing the host. A core that is not executing a process cannot use
+// that process's cached translations, so only the cores that are have to
+// be waited for when the process's EPT changes (see vm_sync).
+
+static std::array<std::atomic<uint64_t>, process_intel_x64::max_cores> g_core_eptp{};
+
+static auto
+core_index()
+{
+    auto &&core = thread_context_cpuid();
+
+    expects(core < process_intel_x64::max_cores);
+    return core;
+}
+
+static auto
+can_map(uintptr_t virt, uintptr_t phys, uintptr_t size, uintptr_t page_size)
+{ return ((virt | phys) & (page_size - 1)) == 0 && size >= page_size; }
+
 process_intel_x64::process_intel_x64(
     processid::type id,
     gsl::not_null<domain_intel_x64 *> domain) :
 
-    process(id),
+    process(id, domain->pool()),
 
     m_domain(domain),
-    m_root_ept(std::make_unique<root_ept_intel_x64>())
+    m_root_ept(std::make_unique<root_ept_intel_x64>()),
+
+    m_num_4k_pages(0),
+    m_num_2m_pages(0),
+    m_num_1g_pages(0),
+
+    m_ept_generation(1),
+    m_ept_synced{}
 { }
 
 void
 process_intel_x64::init(user_data *data)
 {
-    m_root_ept->map_4k(m_domain->tss_base_virt(), m_domain->tss_base_phys(), ept::memory_attr::rw_wb);
-    m_root_ept->map_4k(m_domain->gdt_base_virt(), m_domain->gdt_base_phys(), ept::memory_attr::ro_wb);
-    m_root_ept->map_4k(m_domain->idt_base_virt(), m_domain->idt_base_phys(), ept::memory_attr::ro_wb);
+    this->map_4k(m_domain->tss_base_virt(), m_domain->tss_base_phys(), ept::memory_attr::rw_wb);
+    this->map_4k(m_domain->gdt_base_virt(), m_domain->gdt_base_phys(), ept::memory_attr::ro_wb);
+    this->map_4k(m_domain->idt_base_virt(), m_domain->idt_base_phys(), ept::memory_attr::ro_wb);
 
     auto &&list = m_domain->cr3_mdl();
     for (auto md : list)
-        m_root_ept->map_4k(md.phys, md.phys, ept::memory_attr::rw_wb);
+        this->map_4k(md.phys, md.phys, ept::memory_attr::rw_wb);
 
     process::init(data);
 }
 
 void
 process_intel_x64::fini(user_data *data)
-{ process::fini(data); }
+{
+    bfdebug << "process fini: " << id()
+            << " [4k: " << num_4k_pages()
+            << ", 2m: " << num_2m_pages()
+            << ", 1g: " << num_1g_pages()
+            << ", resident: " << resident_pages()
+            << ", reserved: " << reserved_pages() << "]\n";
+
+    process::fini(data);
+}
 
 void
 process_intel_x64::vm_map(
@@ -79,9 +127,12 @@ process_intel_x64::vm_map(
     // TODO: Remove me
     //
     size += bfn::lower(virt);
+    size = bfn::upper(size + ept::pt::size_bytes - 1);
+
+    if (size == 0)
+        return;
 
-    for (auto page = 0UL; page < size; page += ept::pt::size_bytes)
-        this->vm_map_page(virt + page, phys + page, perm);
+    this->vm_map_range(bfn::upper(virt), bfn::upper(phys), size, perm);
 }
 
 void
@@ -106,11 +157,26 @@ process_intel_x64::vm_map_lookup(
     // TODO: Remove me
     //
     size += bfn::lower(virt);
+    size = bfn::upper(size + ept::pt::size_bytes - 1);
+
+    if (size == 0)
+        return;
 
-    for (auto page = 0UL; page < size; page += ept::pt::size_bytes)
+    virt = bfn::upper(virt);
+    addr = bfn::upper(addr);
+
+    // The caller's memory is only virtually contiguous, so the range is
+    // split into physically contiguous extents, each of which is mapped
+    // with the largest pages it allows.
+
+    page_walker_x64 walker(rtpt);
+
+    for (auto offset = 0UL; offset < size;)
     {
-        auto &&phys = bfn::virt_to_phys_with_cr3(addr + page, rtpt);
-        this->vm_map_page(virt + page, phys, perm);
+        auto &&ext = walker.next_extent(addr + offset, size - offset);
+
+        this->vm_map_range(virt + offset, ext.phys, ext.size, perm);
+        offset += ext.size;
     }
 }
 
@@ -125,5 +191,349 @@ process_intel_x64::vm_map_page(
 
     (void) perm;
 
-    m_root_ept->map_4k(virt, phys, ept::memory_attr::pt_wb);
+    this->map_4k(virt, phys, ept::memory_attr::pt_wb);
+    m_num_4k_pages++;
+}
+
+void
+process_intel_x64::vm_unmap(uintptr_t virt, uintptr_t size)
+{
+    expects(bfn::lower(virt) == 0);
+    expects(bfn::lower(size) == 0);
+
+    {
+        std::lock_guard<std::mutex> guard(m_maps_mutex);
+
+        this->split_mapping(virt);
+        this->split_mapping(virt + size);
+
+        auto &&iter = m_maps.lower_bound(virt);
+        while (iter != m_maps.end() && iter->first < virt + size)
+            iter = m_maps.erase(iter);
+    }
+
+    this->unmap_entries(virt, size);
+
+    // Other cores that are running a thread from this process right now
+    // keep the old translations until they invalidate them (see sync_ept),
+    // so the memory has to stay allocated until vm_sync returns.
+
+    this->flush_ept();
+}
+
+void
+process_intel_x64::vm_share(gsl::not_null<process *> child)
+{
+    auto &&dst = dynamic_cast<process_intel_x64 *>(child.get());
+    expects(dst != nullptr);
+
+    std::lock(m_maps_mutex, dst->m_maps_mutex);
+
+    std::lock_guard<std::mutex> guard1(m_maps_mutex, std::adopt_lock);
+    std::lock_guard<std::mutex> guard2(dst->m_maps_mutex, std::adopt_lock);
+
+    expects(dst->m_maps.empty());
+
+    // Both processes end up with read / execute 4k entries for every page,
+    // so that a write by either one exits with an EPT violation on exactly
+    // the page that has to be copied.
+
+    for (auto &&entry : m_maps)
+    {
+        auto &&virt = entry.first;
+        auto &&map = entry.second;
+
+        for (auto offset = 0UL; offset < map.size; offset += ept::pt::size_bytes)
+            dst->map_4k(virt + offset, map.phys + offset, ept::memory_attr::re_wb);
+
+        dst->m_num_4k_pages += map.size / ept::pt::size_bytes;
+        dst->m_maps[virt] = {map.phys, map.size, true};
+
+        if (!map.shared)
+            this->write_protect(virt, map.phys, map.size);
+
+        map.shared = true;
+    }
+
+    // Like vm_unmap, other threads of this process that are running on
+    // another core right now could still write to a page through a stale
+    // translation, so the caller has to wait for vm_sync before either
+    // process can rely on the pages being read-only.
+
+    this->flush_ept();
+}
+
+void
+process_intel_x64::flush_ept()
+{
+    auto &&generation = ++m_ept_generation;
+
+    vmx::invept_single_context(this->eptp());
+    m_ept_synced[core_index()] = generation;
+}
+
+void
+process_intel_x64::sync_ept()
+{
+    // The core is marked as executing this process before the generation
+    // is read, so a core that changes the EPT after the generation is read
+    // is guaranteed to see that it has to wait for this one.
+
+    g_core_eptp[core_index()] = this->eptp();
+    this->invalidate_stale_ept();
+}
+
+void
+process_intel_x64::unload_ept()
+{ g_core_eptp[core_index()] = 0; }
+
+void
+process_intel_x64::vm_sync()
+{
+    auto &&eptp = this->eptp();
+    auto &&generation = m_ept_generation.load();
+
+    // A core that is waiting here might be the one that another core is
+    // waiting for, so each core keeps its own translations up to date
+    // while it waits. A thread executing on another core is interrupted
+    // by the VMX-preemption timer, which bounds how long this takes.
+
+    for (auto core = 0UL; core < max_cores; core++)
+    {
+        while (m_ept_synced[core].load() < generation && g_core_eptp[core].load() == eptp)
+            this->invalidate_stale_ept();
+    }
+}
+
+void
+process_intel_x64::invalidate_stale_ept()
+{
+    auto &&synced = m_ept_synced[core_index()];
+    auto &&generation = m_ept_generation.load();
+
+    if (synced.load() >= generation)
+        return;
+
+    vmx::invept_single_context(this->eptp());
+    synced = generation;
+}
+
+uintptr_t
+process_intel_x64::vm_shared(uintptr_t virt) const
+{
+    std::lock_guard<std::mutex> guard(m_maps_mutex);
+
+    auto &&iter = m_maps.upper_bound(virt);
+    if (iter == m_maps.begin())
+        return 0;
+
+    --iter;
+
+    if (virt - iter->first >= iter->second.size || !iter->second.shared)
+        return 0;
+
+    return iter->second.phys + (virt - iter->first);
+}
+
+void
+process_intel_x64::vm_map_shared(uintptr_t virt, uintptr_t phys, uintptr_t size)
+{
+    expects(bfn::lower(virt) == 0);
+    expects(bfn::lower(phys) == 0);
+    expects(bfn::lower(size) == 0);
+
+    for (auto offset = 0UL; offset < size; offset += ept::pt::size_bytes)
+        this->map_4k(virt + offset, phys + offset, ept::memory_attr::re_wb);
+
+    m_num_4k_pages += size / ept::pt::size_bytes;
+
+    std::lock_guard<std::mutex> guard(m_maps_mutex);
+    m_maps[virt] = {phys, size, true};
+}
+
+void
+process_intel_x64::split_mapping(uintptr_t virt)
+{
+    auto &&iter = m_maps.upper_bound(virt);
+    if (iter == m_maps.begin())
+        return;
+
+    --iter;
+
+    auto &&start = iter->first;
+    auto &&map = iter->second;
+
+    if (virt == start || virt - start >= map.size)
+        return;
+
+    m_maps[virt] = {map.phys + (virt - start), map.size - (virt - start), map.shared};
+    map.size = virt - start;
+}
+
+void
+process_intel_x64::unmap_entries(uintptr_t virt, uintptr_t size)
+{
+    // A large page is removed by a single EPT entry, so the range is
+    // walked one EPT entry at a time instead of one 4k page at a time.
+
+    for (auto offset = 0UL; offset < size;)
+    {
+        auto &&entry_size = this->page_size(virt + offset);
+
+        m_root_ept->unmap(virt + offset);
+        offset += entry_size;
+    }
+
+    std::lock_guard<std::mutex> guard(m_large_pages_mutex);
+
+    auto &&iter = m_large_pages.lower_bound(virt);
+    while (iter != m_large_pages.end() && iter->first < virt + size)
+        iter = m_large_pages.erase(iter);
+}
+
+void
+process_intel_x64::write_protect(uintptr_t virt, uintptr_t phys, uintptr_t size)
+{
+    this->unmap_entries(virt, size);
+
+    for (auto offset = 0UL; offset < size; offset += ept::pt::size_bytes)
+        this->map_4k(virt + offset, phys + offset, ept::memory_attr::re_wb);
+
+    m_num_4k_pages += size / ept::pt::size_bytes;
+}
+
+void
+process_intel_x64::vm_map_range(
+    uintptr_t virt,
+    uintptr_t phys,
+    uintptr_t size,
+    uintptr_t perm)
+{
+    {
+        std::lock_guard<std::mutex> guard(m_maps_mutex);
+        m_maps[virt] = {phys, size, false};
+    }
+
+    auto &&caps = x64::msrs::get(ia32_vmx_ept_vpid_cap);
+
+    auto &&has_2m = (caps & ept_vpid_cap_2m_pages) != 0;
+    auto &&has_1g = (caps & ept_vpid_cap_1g_pages) != 0;
+
+    while (size != 0)
+    {
+        uintptr_t page_size = ept::pt::size_bytes;
+
+        if (has_1g && can_map(virt, phys, size, ept::pdpt::size_bytes) &&
+            this->can_map_large(virt, ept::pdpt::size_bytes))
+        {
+            page_size = ept::pdpt::size_bytes;
+
+            m_root_ept->map_1g(virt, phys, ept::memory_attr::pt_wb);
+            m_num_1g_pages++;
+        }
+        else if (has_2m && can_map(virt, phys, size, ept::pd::size_bytes) &&
+                 this->can_map_large(virt, ept::pd::size_bytes))
+        {
+            page_size = ept::pd::size_bytes;
+
+            m_root_ept->map_2m(virt, phys, ept::memory_attr::pt_wb);
+            m_num_2m_pages++;
+        }
+        else
+        {
+            this->vm_map_page(virt, phys, perm);
+        }
+
+        if (page_size != ept::pt::size_bytes)
+        {
+            std::lock_guard<std::mutex> guard(m_large_pages_mutex);
+            m_large_pages[virt] = page_size;
+        }
+
+        virt += page_size;
+        phys += page_size;
+        size -= page_size;
+    }
+}
+
+uint64_t
+process_intel_x64::read_word(uintptr_t virt)
+{
+    expects((virt & (sizeof(uint64_t) - 1)) == 0);
+
+    auto &&page = bfn::make_unique_map_x64<uint64_t>(bfn::upper(this->virt_to_phys(virt)));
+    return page.get()[bfn::lower(virt) / sizeof(uint64_t)];
+}
+
+uintptr_t
+process_intel_x64::virt_to_phys(uintptr_t virt)
+{
+    // The domain's page tables identity map the process, so the virtual
+    // address is also the guest physical address that the EPT translates.
+
+    // A large EPT entry only holds the base of the page, so the offset
+    // into the page is added back in.
+
+    auto &&base = virt & ~(this->page_size(virt) - 1);
+    return m_root_ept->gpa_to_epte(base).phys_addr() + (virt - base);
+}
+
+void
+process_intel_x64::map_4k(uintptr_t virt, uintptr_t phys, root_ept_intel_x64::attr_type attr)
+{
+    if (this->page_size(virt) != ept::pt::size_bytes)
+        throw std::runtime_error("4k page overlaps a large page");
+
+    {
+        std::lock_guard<std::mutex> guard(m_large_pages_mutex);
+        m_4k_tables.insert(virt & ~(ept::pd::size_bytes - 1));
+    }
+
+    m_root_ept->map_4k(virt, phys, attr);
+}
+
+bool
+process_intel_x64::can_map_large(uintptr_t virt, uintptr_t size) const
+{
+    std::lock_guard<std::mutex> guard(m_large_pages_mutex);
+
+    // A large page can replace a large page of the same size, but not one
+    // that it is part of, or smaller ones that are part of it.
+
+    auto &&iter = m_large_pages.upper_bound(virt);
+
+    if (iter != m_large_pages.end() && iter->first < virt + size)
+        return false;
+
+    if (iter != m_large_pages.begin())
+    {
+        --iter;
+
+        if (virt - iter->first < iter->second && (iter->first != virt || iter->second != size))
+            return false;
+    }
+
+    // The EPT tables that hold 4k entries are not removed when the entries
+    // are unmapped, so a range that has ever had a 4k entry in it is only
+    // ever mapped with 4k pages.
+
+    auto &&table = m_4k_tables.lower_bound(virt);
+    return table == m_4k_tables.end() || *table >= virt + size;
+}
+
+uintptr_t
+process_intel_x64::page_size(uintptr_t virt) const
+{
+    std::lock_guard<std::mutex> guard(m_large_pages_mutex);
+
+    auto &&iter = m_large_pages.upper_bound(virt);
+    if (iter == m_large_pages.begin())
+        return ept::pt::size_bytes;
+
+    --iter;
+
+    if (virt - iter->first < iter->second)
+        return iter->second;
+
+    return ept::pt::size_bytes;
 }
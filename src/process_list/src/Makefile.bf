@@ -64,6 +64,7 @@ NATIVE_OUTDIR+=%BUILD_REL%/../bin
 # Sources
 ################################################################################
 
+SOURCES+=ipc_endpoint.cpp
 SOURCES+=process_list.cpp
 SOURCES+=process_list_manager.cpp
 
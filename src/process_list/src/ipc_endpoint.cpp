@@ -0,0 +1,166 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include <gsl/gsl>
+
+#include <process/process.h>
+#include <process_list/ipc_endpoint.h>
+
+ipc_endpoint::ipc_endpoint(
+    endpointid::type id,
+    processid::type processid,
+    threadid::type threadid,
+    uintptr_t buffer_phys,
+    page_pool::shared_page_ptr buffer_page) :
+
+    m_id(id),
+    m_processid(processid),
+    m_threadid(threadid),
+    m_buffer_phys(buffer_phys),
+    m_buffer_page(std::move(buffer_page)),
+    m_closed(false),
+    m_state(endpoint_state::idle),
+    m_current{}
+{
+    if ((id & endpointid::reserved) != 0)
+        throw std::invalid_argument("invalid endpointid: " + std::to_string(id));
+}
+
+bool
+ipc_endpoint::call(
+    gsl::not_null<process *> proc, gsl::not_null<thread *> client, const ipc_message &msg)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    if (m_closed)
+        throw std::runtime_error("endpoint closed: " + std::to_string(m_id));
+
+    proc->block_thread(client);
+
+    if (m_state == endpoint_state::waiting)
+    {
+        m_current = msg;
+        m_state = endpoint_state::delivered;
+
+        return true;
+    }
+
+    m_callers.push_back(msg);
+    return false;
+}
+
+bool
+ipc_endpoint::take_reply(processid::type processid, threadid::type threadid, ipc_message &reply)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    auto &&iter = m_replies.find({processid, threadid});
+    if (iter == m_replies.end())
+        return false;
+
+    reply = iter->second;
+    m_replies.erase(iter);
+
+    return true;
+}
+
+bool
+ipc_endpoint::take_delivery(ipc_message &msg)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    if (m_state != endpoint_state::delivered)
+        return false;
+
+    msg = m_current;
+    m_state = endpoint_state::serving;
+
+    return true;
+}
+
+bool
+ipc_endpoint::reply(const ipc_message &reply, ipc_message &client)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    if (m_state != endpoint_state::serving)
+        return false;
+
+    client = m_current;
+    m_replies[{client.processid, client.threadid}] = reply;
+
+    m_state = endpoint_state::idle;
+    return true;
+}
+
+bool
+ipc_endpoint::wait(
+    gsl::not_null<process *> proc, gsl::not_null<thread *> server, ipc_message &msg)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    if (m_closed)
+        throw std::runtime_error("endpoint closed: " + std::to_string(m_id));
+
+    expects(m_state == endpoint_state::idle);
+
+    if (!m_callers.empty())
+    {
+        msg = m_callers.front();
+        m_callers.pop_front();
+
+        m_current = msg;
+        m_state = endpoint_state::serving;
+
+        return true;
+    }
+
+    proc->block_thread(server);
+    m_state = endpoint_state::waiting;
+
+    return false;
+}
+
+std::vector<std::pair<processid::type, threadid::type>>
+ipc_endpoint::close()
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    std::vector<std::pair<processid::type, threadid::type>> blocked;
+
+    for (const auto &msg : m_callers)
+        blocked.push_back({msg.processid, msg.threadid});
+
+    if (m_state == endpoint_state::delivered || m_state == endpoint_state::serving)
+        blocked.push_back({m_current.processid, m_current.threadid});
+
+    // A server that a call was just delivered to might not have been
+    // switched to yet. Waking a thread that is not blocked does nothing.
+
+    if (m_state == endpoint_state::waiting || m_state == endpoint_state::delivered)
+        blocked.push_back({m_processid, m_threadid});
+
+    m_closed = true;
+    m_callers.clear();
+    m_replies.clear();
+
+    return blocked;
+}
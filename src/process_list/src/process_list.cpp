@@ -23,6 +23,7 @@
 #include <exception.h>
 
 #include <vcpu/vcpu_manager.h>
+#include <thread/thread.h>
 #include <process_list/process_list.h>
 
 process_list::process_list(
@@ -32,11 +33,20 @@ process_list::process_list(
     m_id(id),
     m_domain(domain),
     m_is_initialized(false),
-    m_process_next_id(0),
+    m_num_jobs(0),
+    m_migrations(0),
+    m_vmcall_ring(0),
     m_process_factory(std::make_unique<process_factory>())
 {
     if ((id & processlistid::reserved) != 0)
         throw std::invalid_argument("invalid processlistid");
+
+    for (auto &&rq : m_run_queues)
+    {
+        rq.owner = vcpuid::invalid;
+        rq.current = processid::invalid;
+        rq.current_thread = threadid::invalid;
+    }
 }
 
 process_list::~process_list()
@@ -65,7 +75,19 @@ void
 process_list::add_vcpu(vcpuid::type id)
 {
     std::lock_guard<std::mutex> guard(m_vcpu_mutex);
-    m_vcpuids.insert(id);
+
+    for (auto &&rq : m_run_queues)
+    {
+        if (rq.owner != vcpuid::invalid)
+            continue;
+
+        rq.owner = id;
+        m_vcpuids.insert(id);
+
+        return;
+    }
+
+    throw std::runtime_error("process list has too many vcpus");
 }
 
 void
@@ -79,6 +101,22 @@ process_list::remove_vcpu(vcpuid::type id)
     //
 
     std::lock_guard<std::mutex> guard(m_vcpu_mutex);
+
+    if (auto rq = __get_run_queue(id))
+    {
+        if (auto proc = __get_listed_process(rq->current))
+        {
+            auto &&thrd = proc->find_thread(rq->current_thread);
+
+            if (thrd != nullptr && proc->requeue_thread(id, thrd))
+                this->queue_process(vcpuid::invalid, rq->current);
+        }
+
+        rq->current = processid::invalid;
+        rq->current_thread = threadid::invalid;
+        rq->owner = vcpuid::invalid;
+    }
+
     m_vcpuids.erase(id);
 }
 
@@ -89,16 +127,22 @@ process_list::vcpu_count() const
 processid::type
 process_list::create_process(user_data *data)
 {
+    auto processid = m_processes.reserve();
+
     auto ___ = gsl::on_failure([&]
     {
+        this->remove_process(processid);
+
         std::lock_guard<std::mutex> guard(m_process_mutex);
-        m_processes.erase(m_process_next_id);
+
+        m_new_jobs.remove(processid);
+        m_processes.remove(processid);
     });
 
-    if (auto && process = __add_process(m_process_next_id, data))
+    if (auto && process = __add_process(processid, data))
         process->init(data);
 
-    return m_process_next_id++;
+    return processid;
 }
 
 void
@@ -106,71 +150,268 @@ process_list::delete_process(processid::type processid, user_data *data)
 {
     auto ___ = gsl::finally([&]
     {
+        this->remove_process(processid);
+
         std::lock_guard<std::mutex> guard(m_process_mutex);
 
-        m_process_list.remove(m_process_next_id);
-        m_processes.erase(processid);
+        m_new_jobs.remove(processid);
+        m_processes.remove(processid);
     });
 
-    if (auto && process = __get_process(processid))
+    if (auto && process = m_processes.get(processid))
         process->fini(data);
 }
 
 gsl::not_null<process *>
 process_list::get_process(processid::type processid)
-{ return __get_process(processid).get(); }
+{
+    if (auto && process = m_processes.get(processid))
+        return process;
+
+    throw std::invalid_argument("unknown process: " + std::to_string(processid));
+}
 
 void
 process_list::remove_process(processid::type processid)
-{ m_process_list.remove(processid); }
+{
+    std::lock_guard<std::mutex> guard(m_process_mutex);
+
+    if (m_processes.tag(processid) == process_listed)
+    {
+        m_processes.set_tag(processid, 0);
+        m_num_jobs--;
+    }
+}
+
+void
+process_list::queue_process(vcpuid::type id, processid::type processid)
+{
+    if (auto rq = __get_run_queue(id))
+    {
+        rq->jobs.push(processid);
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(m_process_mutex);
+    m_new_jobs.push_back(processid);
+}
 
 std::pair<thread *, process *>
-process_list::next_job()
+process_list::next_job(vcpuid::type id)
 {
-    // TODO:
-    //
-    // - We need to implement a real algorithm for determining the next job
-    // - We need to figure out which thread to execute and not just #0
-    //
+    auto &&rq = __get_run_queue(id);
 
-    if (m_process_list.empty())
+    if (rq == nullptr)
         return {};
 
-    auto && proc = m_processes.at(m_process_list.front()).get();
-    auto && thrd = proc->get_thread(0);
+    if (auto proc = __get_listed_process(rq->current))
+    {
+        auto &&thrd = proc->find_thread(rq->current_thread);
+
+        if (thrd != nullptr && proc->requeue_thread(id, thrd))
+            rq->jobs.push(rq->current);
+    }
+
+    rq->current = processid::invalid;
+    rq->current_thread = threadid::invalid;
 
-    if (m_process_list.size() > 1)
+    processid::type processid;
+
+    while (rq->jobs.steal(processid) || __next_new_job(processid) || __steal_job(rq, processid))
     {
-        m_process_list.push_back(m_process_list.front());
-        m_process_list.pop_front();
+        auto &&proc = __get_listed_process(processid);
+
+        if (proc == nullptr)
+            continue;
+
+        auto &&migrated = false;
+        auto &&next = proc->next_thread(id, migrated);
+        auto &&thrd = std::get<0>(next);
+
+        if (std::get<1>(next))
+            rq->jobs.push(processid);
+
+        if (thrd == nullptr)
+            continue;
+
+        if (migrated)
+            ++m_migrations;
+
+        rq->current = processid;
+        rq->current_thread = thrd->id();
+
+        return {thrd, proc};
     }
 
-    return {thrd, proc};
+    return {};
+}
+
+void
+process_list::set_vmcall_ring(uintptr_t phys)
+{
+    expects((phys & 0xFFF) == 0);
+    m_vmcall_ring = phys;
+}
+
+thread *
+process_list::handoff(vcpuid::type id, processid::type processid, threadid::type threadid)
+{
+    auto &&rq = __get_run_queue(id);
+
+    if (rq == nullptr)
+        return nullptr;
+
+    auto &&proc = __get_listed_process(processid);
+
+    if (proc == nullptr)
+        return nullptr;
+
+    auto &&thrd = proc->find_thread(threadid);
+
+    if (thrd == nullptr || !proc->handoff_thread(id, thrd))
+        return nullptr;
+
+    rq->current = processid;
+    rq->current_thread = threadid;
+
+    return thrd;
+}
+
+void
+process_list::wake_thread(vcpuid::type id, processid::type processid, threadid::type threadid)
+{
+    auto &&proc = m_processes.get(processid);
+
+    if (proc == nullptr)
+        return;
+
+    auto &&thrd = proc->find_thread(threadid);
+
+    if (thrd != nullptr && proc->wake_thread(thrd))
+        this->queue_process(id, processid);
+}
+
+endpointid::type
+process_list::create_endpoint(
+    processid::type processid,
+    threadid::type threadid,
+    uintptr_t buffer_phys,
+    page_pool::shared_page_ptr buffer_page)
+{
+    auto endpointid = m_endpoints.reserve();
+
+    auto ___ = gsl::on_failure([&]
+    { m_endpoints.remove(endpointid); });
+
+    auto &&endpoint =
+        std::make_unique<ipc_endpoint>(
+            endpointid, processid, threadid, buffer_phys, std::move(buffer_page));
+
+    m_endpoints.add(endpointid, std::move(endpoint));
+
+    return endpointid;
+}
+
+void
+process_list::delete_endpoint(vcpuid::type id, endpointid::type endpointid)
+{
+    auto &&endpoint = this->get_endpoint(endpointid);
+    auto blocked = endpoint->close();
+
+    m_endpoints.remove(endpointid);
+
+    for (const auto &ids : blocked)
+        this->wake_thread(id, ids.first, ids.second);
+}
+
+gsl::not_null<ipc_endpoint *>
+process_list::get_endpoint(endpointid::type endpointid)
+{
+    if (auto && endpoint = m_endpoints.get(endpointid))
+        return endpoint;
+
+    throw std::invalid_argument("unknown endpoint: " + std::to_string(endpointid));
 }
 
-std::unique_ptr<process> &
+void
+process_list::collect()
+{
+    m_processes.collect();
+    m_endpoints.collect();
+}
+
+process *
 process_list::__add_process(processid::type processid, user_data *data)
 {
     if (!m_process_factory)
         throw std::runtime_error("invalid process factory");
 
-    if (__get_process(processid))
-        throw std::runtime_error("process already exists: " + std::to_string(processid));
-
     if (auto && process = m_process_factory->make_process(processid, data))
     {
         std::lock_guard<std::mutex> guard(m_process_mutex);
 
-        m_process_list.push_back(processid);
-        return m_processes[processid] = std::move(process);
+        auto &&proc = m_processes.add(processid, std::move(process), process_listed);
+        m_num_jobs++;
+
+        return proc;
     }
 
     throw std::runtime_error("make_process returned a nullptr process");
 }
 
-std::unique_ptr<process> &
-process_list::__get_process(processid::type processid)
+process *
+process_list::__get_listed_process(processid::type processid)
+{
+    if (processid == processid::invalid)
+        return nullptr;
+
+    if (m_processes.tag(processid) != process_listed)
+        return nullptr;
+
+    return m_processes.get(processid);
+}
+
+process_list::vcpu_run_queue *
+process_list::__get_run_queue(vcpuid::type id)
+{
+    if (id == vcpuid::invalid)
+        return nullptr;
+
+    for (auto &&rq : m_run_queues)
+    {
+        if (rq.owner == id)
+            return &rq;
+    }
+
+    return nullptr;
+}
+
+bool
+process_list::__next_new_job(processid::type &processid)
 {
     std::lock_guard<std::mutex> guard(m_process_mutex);
-    return m_processes[processid];
+
+    if (m_new_jobs.empty())
+        return false;
+
+    processid = m_new_jobs.front();
+    m_new_jobs.pop_front();
+
+    return true;
+}
+
+bool
+process_list::__steal_job(vcpu_run_queue *thief, processid::type &processid)
+{
+    auto &&first = gsl::narrow_cast<std::size_t>(thief - m_run_queues.data());
+
+    for (auto i = 1UL; i < max_vcpus; i++)
+    {
+        auto &&victim = m_run_queues.at((first + i) % max_vcpus);
+
+        if (victim.jobs.steal(processid))
+            return true;
+    }
+
+    return false;
 }
@@ -39,61 +39,48 @@ process_list_manager::instance() noexcept
 processlistid::type
 process_list_manager::create_process_list(user_data *data)
 {
+    auto processlistid = m_process_lists.reserve();
+
     auto ___ = gsl::on_failure([&]
-    {
-        std::lock_guard<std::mutex> guard(m_process_list_mutex);
-        m_process_lists.erase(m_process_list_next_id);
-    });
+    { m_process_lists.remove(processlistid); });
 
-    if (auto && process_list = __add_process_list(m_process_list_next_id, data))
+    if (auto && process_list = __add_process_list(processlistid, data))
         process_list->init(data);
 
-    return m_process_list_next_id++;
+    return processlistid;
 }
 
 void
 process_list_manager::delete_process_list(processlistid::type processlistid, user_data *data)
 {
     auto ___ = gsl::finally([&]
-    {
-        std::lock_guard<std::mutex> guard(m_process_list_mutex);
-        m_process_lists.erase(processlistid);
-    });
+    { m_process_lists.remove(processlistid); });
 
-    if (auto && process_list = __get_process_list(processlistid))
+    if (auto && process_list = m_process_lists.get(processlistid))
         process_list->fini(data);
 }
 
 gsl::not_null<process_list *>
 process_list_manager::get_process_list(processlistid::type processlistid)
-{ return __get_process_list(processlistid).get(); }
+{
+    if (auto && process_list = m_process_lists.get(processlistid))
+        return process_list;
+
+    throw std::invalid_argument("unknown process_list: " + std::to_string(processlistid));
+}
 
 process_list_manager::process_list_manager() noexcept :
-    m_process_list_next_id(0),
     m_process_list_factory(std::make_unique<process_list_factory>())
 { }
 
-std::unique_ptr<process_list> &
+process_list *
 process_list_manager::__add_process_list(processlistid::type processlistid, user_data *data)
 {
     if (!m_process_list_factory)
         throw std::runtime_error("invalid process_list factory");
 
-    if (__get_process_list(processlistid))
-        throw std::runtime_error("process_list already exists: " + std::to_string(processlistid));
-
     if (auto && process_list = m_process_list_factory->make_process_list(processlistid, data))
-    {
-        std::lock_guard<std::mutex> guard(m_process_list_mutex);
-        return m_process_lists[processlistid] = std::move(process_list);
-    }
+        return m_process_lists.add(processlistid, std::move(process_list));
 
     throw std::runtime_error("make_process_list returned a nullptr process_list");
 }
-
-std::unique_ptr<process_list> &
-process_list_manager::__get_process_list(processlistid::type processlistid)
-{
-    std::lock_guard<std::mutex> guard(m_process_list_mutex);
-    return m_process_lists[processlistid];
-}
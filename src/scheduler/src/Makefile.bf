@@ -64,8 +64,10 @@ NATIVE_OUTDIR+=%BUILD_REL%/../bin
 # Sources
 ################################################################################
 
+SOURCES+=quantum.cpp
 SOURCES+=scheduler.cpp
 SOURCES+=scheduler_manager.cpp
+SOURCES+=scheduler_mlfq.cpp
 
 INCLUDE_PATHS+=../../../include
 INCLUDE_PATHS+=%HYPER_ABS%/include/
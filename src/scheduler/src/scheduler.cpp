@@ -23,7 +23,11 @@
 #include <scheduler/scheduler.h>
 
 scheduler::scheduler(schedulerid::type id) :
-    m_id(id)
+    m_id(id),
+    m_current(nullptr),
+    m_preemptions(0),
+    m_preemption_ticks(0),
+    m_preemption_start(0)
 { }
 
 void
@@ -43,6 +47,9 @@ scheduler::remove_task(gsl::not_null<task *> tk)
 {
     auto &&iter = find(m_tasks.begin(), m_tasks.end(), tk.get());
     m_tasks.erase(iter);
+
+    if (m_current == tk.get())
+        m_current = nullptr;
 }
 
 void
@@ -52,9 +59,7 @@ scheduler::yield()
     //
     // This needs to be updated in several ways:
     //
-    // - We need to setup the preemption timer so that we can preempt a task
-    //   and move onto another
-    // - We need a better algorithm than FCFS
+    // - We need a better algorithm than FCFS (see scheduler_mlfq)
     // - We will need to be able to handle tasks sleeping
     // - We will need to be able to handle task total time, vs thread total
     //   time. Tasks should get 100ms, while a thread should only get 1-10ms.
@@ -63,22 +68,65 @@ scheduler::yield()
     if (m_tasks.empty())
         throw std::runtime_error("scheduler is empty");
 
-    if (m_tasks.size() > 1 && m_tasks.front()->num_jobs() == 0)
+    for (auto i = 0UL; i < m_tasks.size(); i++)
     {
+        if (m_tasks.front()->num_jobs() != 0)
+        {
+            this->set_current(m_tasks.front());
+            this->account_preemption();
+            m_tasks.front()->schedule();
+        }
+
         m_tasks.push_back(m_tasks.front());
         m_tasks.pop_front();
     }
 
-    m_tasks.front()->schedule();
+    for (const auto &tk : m_tasks)
+    {
+        if (tk->num_jobs() == 0)
+        {
+            this->set_current(tk);
+            this->account_preemption();
+            tk->schedule();
+        }
+    }
+
+    throw std::runtime_error("scheduler has nothing to schedule");
 }
 
 void
 scheduler::schedule(thread *thrd, uintptr_t entry, uintptr_t arg1, uintptr_t arg2)
 {
-    // TODO
-    //
-    // Need to know what task we should be executing.
-    //
+    if (m_current == nullptr)
+        throw std::runtime_error("scheduler has no current task");
+
+    m_current->schedule(thrd, entry, arg1, arg2);
+}
+
+void
+scheduler::switch_to(thread *thrd)
+{
+    if (m_current == nullptr)
+        throw std::runtime_error("scheduler has no current task");
+
+    m_current->switch_to(thrd);
+}
+
+void
+scheduler::preempt(quantum::type start)
+{
+    m_preemptions++;
+    m_preemption_start = start;
+
+    this->yield();
+}
+
+void
+scheduler::account_preemption() noexcept
+{
+    if (m_preemption_start == 0)
+        return;
 
-    m_tasks.front()->schedule(thrd, entry, arg1, arg2);
+    m_preemption_ticks += quantum::now() - m_preemption_start;
+    m_preemption_start = 0;
 }
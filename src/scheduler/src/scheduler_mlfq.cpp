@@ -0,0 +1,180 @@
+//
+// Bareflank Hypervisor
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#include <algorithm>
+#include <scheduler/scheduler_mlfq.h>
+
+scheduler_mlfq::scheduler_mlfq(schedulerid::type id) :
+    scheduler(id),
+    m_dispatched(0),
+    m_last_boost(0),
+    m_dispatches(0)
+{ }
+
+void
+scheduler_mlfq::add_task(gsl::not_null<task *> tk)
+{ m_levels.front().push_back({tk.get(), 0}); }
+
+void
+scheduler_mlfq::remove_task(gsl::not_null<task *> tk)
+{
+    for (auto &&level : m_levels)
+    {
+        level.remove_if([&](const auto & mt)
+        { return mt.tk == tk.get(); });
+    }
+
+    if (this->current() == tk.get())
+        this->set_current(nullptr);
+}
+
+void
+scheduler_mlfq::yield()
+{
+    // TODO:
+    //
+    // We still need to be able to handle tasks sleeping. For now, a task
+    // with no jobs is treated as idle, and is only scheduled when no other
+    // task on this core has work to do.
+    //
+
+    auto &&empty = std::all_of(m_levels.begin(), m_levels.end(), [](const auto & level)
+    { return level.empty(); });
+
+    if (empty)
+        throw std::runtime_error("scheduler is empty");
+
+    auto &&now = this->now();
+    auto &&keep = this->account(now);
+
+    if (now - m_last_boost >= quantum::boost())
+        this->boost(now);
+
+    if (keep)
+        this->dispatch(this->current(), now);
+
+    for (auto &&level : m_levels)
+    {
+        for (auto i = level.size(); i > 0; i--)
+        {
+            auto tk = level.front().tk;
+            level.splice(level.end(), level, level.begin());
+
+            if (tk->num_jobs() != 0)
+                this->dispatch(tk, now);
+        }
+    }
+
+    for (auto &&level : m_levels)
+    {
+        for (const auto &mt : level)
+        {
+            if (mt.tk->num_jobs() == 0)
+                this->dispatch(mt.tk, now);
+        }
+    }
+
+    throw std::runtime_error("scheduler has nothing to schedule");
+}
+
+std::size_t
+scheduler_mlfq::level(gsl::not_null<task *> tk) const
+{
+    for (auto i = 0UL; i < num_levels; i++)
+    {
+        const auto &level = m_levels.at(i);
+
+        auto &&iter = std::find_if(level.begin(), level.end(), [&](const auto & mt)
+        { return mt.tk == tk.get(); });
+
+        if (iter != level.end())
+            return i;
+    }
+
+    throw std::runtime_error("task not found");
+}
+
+quantum::type
+scheduler_mlfq::level_quantum(gsl::not_null<task *> tk, std::size_t level) const
+{
+    expects(level < num_levels);
+    return tk->task_quantum() >> (num_levels - 1 - level);
+}
+
+bool
+scheduler_mlfq::account(quantum::type now)
+{
+    auto &&current = this->current();
+
+    if (current == nullptr)
+        return false;
+
+    for (auto i = 0UL; i < num_levels; i++)
+    {
+        auto &level = m_levels.at(i);
+
+        auto &&iter = std::find_if(level.begin(), level.end(), [&](const auto & mt)
+        { return mt.tk == current; });
+
+        if (iter == level.end())
+            continue;
+
+        iter->used += now - m_dispatched;
+
+        if (iter->used < this->level_quantum(current, i))
+            return current->num_jobs() != 0;
+
+        iter->used = 0;
+
+        auto &next = m_levels.at(std::min(i + 1, num_levels - 1));
+        next.splice(next.end(), level, iter);
+
+        return false;
+    }
+
+    return false;
+}
+
+void
+scheduler_mlfq::boost(quantum::type now)
+{
+    auto &top = m_levels.front();
+
+    for (auto i = 1UL; i < num_levels; i++)
+        top.splice(top.end(), m_levels.at(i));
+
+    for (auto &&mt : top)
+        mt.used = 0;
+
+    m_last_boost = now;
+}
+
+void
+scheduler_mlfq::dispatch(gsl::not_null<task *> tk, quantum::type now)
+{
+    m_dispatched = now;
+    m_dispatches++;
+
+    this->set_current(tk);
+    this->account_preemption();
+    tk->schedule();
+}
@@ -50,6 +50,7 @@ NATIVE_OUTDIR+=%BUILD_REL%/../bin
 ################################################################################
 
 SOURCES+=test.cpp
+SOURCES+=test_scheduler_mlfq.cpp
 
 INCLUDE_PATHS+=./
 INCLUDE_PATHS+=../../../include
@@ -57,6 +58,12 @@ INCLUDE_PATHS+=%HYPER_ABS%/include/
 INCLUDE_PATHS+=%HYPER_ABS%/bfvmm/include/
 INCLUDE_PATHS+=%HYPER_ABS%/extended_apis/include/
 
+LIBS+=scheduler
+LIBS+=task
+
+LIBRARY_PATHS+=%BUILD_REL%/../bin/native
+LIBRARY_PATHS+=%BUILD_REL%/../../task/bin/native
+
 ################################################################################
 # Environment Specific
 ################################################################################
@@ -40,6 +40,10 @@ hyperkernel_ut::fini()
 bool
 hyperkernel_ut::list()
 {
+    this->test_scheduler_mlfq_fairness_equal_bursts();
+    this->test_scheduler_mlfq_fairness_mixed_bursts();
+    this->test_scheduler_mlfq_boost();
+
     return true;
 }
 
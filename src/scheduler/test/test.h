@@ -37,6 +37,12 @@ protected:
     bool fini() override;
     bool list() override;
 
+private:
+
+    void test_scheduler_mlfq_fairness_equal_bursts();
+    void test_scheduler_mlfq_fairness_mixed_bursts();
+    void test_scheduler_mlfq_boost();
+
 public:
 
     hyperkernel_ut(hyperkernel_ut &&) = default;
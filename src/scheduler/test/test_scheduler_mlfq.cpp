@@ -0,0 +1,276 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#include <test.h>
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include <domain/domain.h>
+#include <process_list/process_list.h>
+#include <scheduler/scheduler_mlfq.h>
+#include <scheduler/scheduler_manager.h>
+
+// The scheduler is driven by a synthetic clock. When a task is dispatched,
+// it advances the clock by its burst (how long it executes before it
+// yields, or is preempted), and then unwinds back to the test, as
+// dispatching a real task never returns.
+
+struct dispatched
+{ };
+
+class test_scheduler_mlfq : public scheduler_mlfq
+{
+public:
+
+    test_scheduler_mlfq(const quantum::type *clock) :
+        scheduler_mlfq(0),
+        m_clock(clock)
+    { }
+
+protected:
+
+    quantum::type now() const override
+    { return *m_clock; }
+
+private:
+
+    const quantum::type *m_clock;
+};
+
+class test_task : public task
+{
+public:
+
+    test_task(
+        gsl::not_null<process_list *> proclt,
+        gsl::not_null<domain *> domain,
+        quantum::type *clock,
+        quantum::type burst) :
+
+        task(0, 0, proclt, domain),
+        m_clock(clock),
+        m_burst(burst),
+        m_ran(0),
+        m_stopped(0)
+    { }
+
+    void schedule() override
+    {
+        m_latencies.push_back(*m_clock - m_stopped);
+
+        *m_clock += m_burst;
+
+        m_ran += m_burst;
+        m_stopped = *m_clock;
+
+        throw dispatched();
+    }
+
+    void schedule(thread *thrd, uintptr_t entry, uintptr_t arg1, uintptr_t arg2) override
+    { (void) thrd; (void) entry; (void) arg1; (void) arg2; }
+
+    void switch_to(thread *thrd) override
+    { (void) thrd; }
+
+    size_t num_jobs() override
+    { return 1; }
+
+    quantum::type ran() const
+    { return m_ran; }
+
+    quantum::type p99_latency() const
+    {
+        auto latencies = m_latencies;
+        std::sort(latencies.begin(), latencies.end());
+
+        return latencies.at((latencies.size() * 99) / 100);
+    }
+
+private:
+
+    quantum::type *m_clock;
+    quantum::type m_burst;
+    quantum::type m_ran;
+    quantum::type m_stopped;
+
+    std::vector<quantum::type> m_latencies;
+};
+
+static void
+setup_mocks(MockRepository &mocks, process_list *proclt, scheduler_manager *shm)
+{
+    mocks.OnCallFunc(scheduler_manager::instance).Return(shm);
+    mocks.OnCall(shm, scheduler_manager::add_task);
+    mocks.OnCall(shm, scheduler_manager::remove_task);
+
+    mocks.OnCall(proclt, process_list::add_vcpu);
+    mocks.OnCall(proclt, process_list::remove_vcpu);
+}
+
+static void
+run_for(scheduler &schd, const quantum::type &clock, quantum::type ticks)
+{
+    auto &&end = clock + ticks;
+
+    while (clock < end)
+    {
+        try
+        { schd.yield(); }
+        catch (dispatched &)
+        { }
+    }
+}
+
+// Each task should get an equal share of the core (within 10%), and no
+// task should wait longer than it takes every other task to use a full
+// quantum (plus the burst that crosses the end of it), 99% of the time.
+
+static bool
+is_fair(const std::vector<std::unique_ptr<test_task>> &tasks)
+{
+    auto &&total = 0UL;
+
+    for (const auto &tk : tasks)
+        total += tk->ran();
+
+    for (const auto &tk : tasks)
+    {
+        auto &&share = tk->ran() * tasks.size();
+
+        if (share < total - total / 10 || share > total + total / 10)
+            return false;
+    }
+
+    return true;
+}
+
+static bool
+is_responsive(const std::vector<std::unique_ptr<test_task>> &tasks, quantum::type max_burst)
+{
+    auto &&bound = (tasks.size() - 1) * (quantum::task() + max_burst);
+
+    for (const auto &tk : tasks)
+    {
+        if (tk->p99_latency() > bound)
+            return false;
+    }
+
+    return true;
+}
+
+void
+hyperkernel_ut::test_scheduler_mlfq_fairness_equal_bursts()
+{
+    MockRepository mocks;
+    auto &&proclt = mocks.Mock<process_list>();
+    auto &&dom = mocks.Mock<domain>();
+    auto &&shm = mocks.Mock<scheduler_manager>();
+
+    setup_mocks(mocks, proclt, shm);
+
+    RUN_UNITTEST_WITH_MOCKS(mocks, [&]
+    {
+        auto &&clock = quantum::type{0};
+        auto &&schd = test_scheduler_mlfq(&clock);
+
+        std::vector<std::unique_ptr<test_task>> tasks;
+
+        for (auto i = 0; i < 3; i++)
+        {
+            tasks.push_back(std::make_unique<test_task>(proclt, dom, &clock, quantum::thread()));
+            schd.add_task(tasks.back().get());
+        }
+
+        run_for(schd, clock, 10 * quantum::boost());
+
+        this->expect_true(is_fair(tasks));
+        this->expect_true(is_responsive(tasks, quantum::thread()));
+    });
+}
+
+void
+hyperkernel_ut::test_scheduler_mlfq_fairness_mixed_bursts()
+{
+    MockRepository mocks;
+    auto &&proclt = mocks.Mock<process_list>();
+    auto &&dom = mocks.Mock<domain>();
+    auto &&shm = mocks.Mock<scheduler_manager>();
+
+    setup_mocks(mocks, proclt, shm);
+
+    RUN_UNITTEST_WITH_MOCKS(mocks, [&]
+    {
+        auto &&clock = quantum::type{0};
+        auto &&schd = test_scheduler_mlfq(&clock);
+
+        // Time is charged by how long a task ran, not by how many times it
+        // was dispatched, so a task that yields often does not get more
+        // (or less) of the core than one that is always preempted.
+
+        std::vector<std::unique_ptr<test_task>> tasks;
+
+        tasks.push_back(std::make_unique<test_task>(proclt, dom, &clock, quantum::ticks_per_ms() / 10));
+        tasks.push_back(std::make_unique<test_task>(proclt, dom, &clock, quantum::ticks_per_ms()));
+        tasks.push_back(std::make_unique<test_task>(proclt, dom, &clock, quantum::thread()));
+
+        for (const auto &tk : tasks)
+            schd.add_task(tk.get());
+
+        run_for(schd, clock, 10 * quantum::boost());
+
+        this->expect_true(is_fair(tasks));
+        this->expect_true(is_responsive(tasks, quantum::thread()));
+    });
+}
+
+void
+hyperkernel_ut::test_scheduler_mlfq_boost()
+{
+    MockRepository mocks;
+    auto &&proclt = mocks.Mock<process_list>();
+    auto &&dom = mocks.Mock<domain>();
+    auto &&shm = mocks.Mock<scheduler_manager>();
+
+    setup_mocks(mocks, proclt, shm);
+
+    RUN_UNITTEST_WITH_MOCKS(mocks, [&]
+    {
+        auto &&clock = quantum::type{0};
+        auto &&schd = test_scheduler_mlfq(&clock);
+
+        auto &&cpu_bound = std::make_unique<test_task>(proclt, dom, &clock, quantum::thread());
+        schd.add_task(cpu_bound.get());
+
+        // A task that uses its quantum at every level ends up at the
+        // lowest level, and is moved back to the highest level by the next
+        // boost.
+
+        run_for(schd, clock, quantum::task() * 2);
+        this->expect_true(schd.level(cpu_bound.get()) == scheduler_mlfq::num_levels - 1);
+
+        run_for(schd, clock, quantum::boost() - clock);
+        run_for(schd, clock, 1);
+        this->expect_true(schd.level(cpu_bound.get()) == 0);
+    });
+}
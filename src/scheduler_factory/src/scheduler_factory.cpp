@@ -19,12 +19,25 @@
 // License along with this library; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
+#include <scheduler_data.h>
 #include <scheduler/scheduler.h>
+#include <scheduler/scheduler_mlfq.h>
 #include <scheduler/scheduler_factory.h>
 
 std::unique_ptr<scheduler>
 scheduler_factory::make_scheduler(schedulerid::type schedulerid, user_data *data)
 {
-    (void) data;
+    if (auto &&sd = dynamic_cast<scheduler_data *>(data))
+    {
+        switch (sd->m_policy)
+        {
+            case scheduler_policy::mlfq:
+                return std::make_unique<scheduler_mlfq>(schedulerid);
+
+            default:
+                break;
+        }
+    }
+
     return std::make_unique<scheduler>(schedulerid);
 }
@@ -32,7 +32,9 @@ task::task(
     m_coreid(coreid),
     m_vcpuid(vcpuid),
     m_proclt(proclt),
-    m_domain(domain)
+    m_domain(domain),
+    m_task_quantum(quantum::task()),
+    m_thread_quantum(quantum::thread())
 {
     // TODO:
     //
@@ -58,3 +60,17 @@ task::~task()
 
 size_t task::num_jobs()
 { return m_proclt->num_jobs(); }
+
+void
+task::set_task_quantum(quantum::type ticks)
+{
+    expects(ticks != 0);
+    m_task_quantum = ticks;
+}
+
+void
+task::set_thread_quantum(quantum::type ticks)
+{
+    expects(ticks != 0);
+    m_thread_quantum = ticks;
+}
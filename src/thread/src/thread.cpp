@@ -25,6 +25,10 @@
 thread::thread(threadid::type id, gsl::not_null<process *> proc) :
     m_id(id),
     m_proc(proc),
+    m_vcpuid(vcpuid::invalid),
+    m_state(thread_state::blocked),
+    m_retval(0),
+    m_joiner(threadid::invalid),
     m_is_running(false),
     m_is_initialized(false)
 {
@@ -19,13 +19,45 @@
 // License along with this library; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
+#include <cstddef>
+#include <cstring>
+
 #include <debug.h>
 #include <thread/thread_intel_x64.h>
 
+// -----------------------------------------------------------------------------
+// Helpers
+// -----------------------------------------------------------------------------
+
+// The state save's layout is Bareflank's. The VMM's fields (which
+// Bareflank's exit handler entry uses to find the vCPU) are expected to be
+// together, between the guest's general purpose registers and the guest's
+// extended state, so that neither copy has to skip over them.
+
+constexpr const auto vmm_state_begin = offsetof(state_save_intel_x64, vcpuid);
+constexpr const auto vmm_state_end = offsetof(state_save_intel_x64, exit_handler_ptr) + sizeof(uint64_t);
+
+static_assert(offsetof(state_save_intel_x64, vmxon_ptr) > vmm_state_begin, "unexpected state save layout");
+static_assert(offsetof(state_save_intel_x64, vmcs_ptr) > vmm_state_begin, "unexpected state save layout");
+static_assert(vmm_state_end - vmm_state_begin == 4 * sizeof(uint64_t), "unexpected state save layout");
+static_assert(offsetof(state_save_intel_x64, rip) < vmm_state_begin, "unexpected state save layout");
+static_assert(offsetof(state_save_intel_x64, rsp) < vmm_state_begin, "unexpected state save layout");
+
+static void
+copy_state(state_save_intel_x64 &dst, const state_save_intel_x64 &src, std::size_t begin, std::size_t end)
+{
+    memcpy(reinterpret_cast<char *>(&dst) + begin, reinterpret_cast<const char *>(&src) + begin, end - begin);
+}
+
+// -----------------------------------------------------------------------------
+// Implementation
+// -----------------------------------------------------------------------------
+
 thread_intel_x64::thread_intel_x64(threadid::type id, gsl::not_null<process *> proc) :
     thread(id, proc),
     m_stack{},
-    m_state_save{}
+    m_state_save{},
+    m_extended_state_owner(nullptr)
 { }
 
 void
@@ -42,3 +74,24 @@ thread_intel_x64::set_info(
 
     m_stack = stack;
 }
+
+void
+thread_intel_x64::save_state(const state_save_intel_x64 &state_save)
+{
+    copy_state(m_state_save, state_save, 0, vmm_state_begin);
+    copy_state(m_state_save, state_save, vmm_state_end, sizeof(state_save_intel_x64));
+
+    m_extended_state_owner = &state_save;
+}
+
+void
+thread_intel_x64::load_state(state_save_intel_x64 &state_save, bool resumed)
+{
+    copy_state(state_save, m_state_save, 0, vmm_state_begin);
+
+    if (resumed && m_extended_state_owner == &state_save)
+        return;
+
+    copy_state(state_save, m_state_save, vmm_state_end, sizeof(state_save_intel_x64));
+    m_extended_state_owner = &state_save;
+}
@@ -21,9 +21,12 @@
 
 #include <gsl/gsl>
 
+#include <epoch.h>
+
 #include <vcpu/vcpu_intel_x64_hyperkernel.h>
 #include <vmcs/vmcs_intel_x64_hyperkernel.h>
 #include <vmcs/vmcs_intel_x64_guest_vm_state.h>
+#include <exit_handler/exit_stats.h>
 #include <exit_handler/exit_handler_intel_x64_hyperkernel.h>
 
 #include <domain/domain_intel_x64.h>
@@ -70,7 +73,9 @@ vcpu_intel_x64_hyperkernel::vcpu_intel_x64_hyperkernel(
     m_proclt(proclt),
     m_domain(domain),
     m_vmcs_hyperkernel(dynamic_cast<vmcs_intel_x64_hyperkernel *>(m_vmcs.get())),
-    m_exit_handler_hyperkernel(dynamic_cast<exit_handler_intel_x64_hyperkernel *>(m_exit_handler.get()))
+    m_exit_handler_hyperkernel(dynamic_cast<exit_handler_intel_x64_hyperkernel *>(m_exit_handler.get())),
+    m_loaded_thread(nullptr),
+    m_loaded_eptp(0)
 { }
 
 void
@@ -92,11 +97,19 @@ vcpu_intel_x64_hyperkernel::hlt(user_data *data)
 void
 vcpu_intel_x64_hyperkernel::schedule()
 {
-    auto &&pair = m_proclt->next_job();
+    auto &&pair = m_proclt->next_job(this->id());
 
     auto &&thrd = dynamic_cast<thread_intel_x64 *>(std::get<0>(pair));
     auto &&proc = dynamic_cast<process_intel_x64 *>(std::get<1>(pair));
 
+    if (thrd == nullptr)
+    {
+        if (this->is_host_vcpu())
+            schedule(nullptr, nullptr, nullptr);
+
+        return;
+    }
+
     schedule(proc, thrd, &thrd->m_state_save);
 }
 
@@ -117,35 +130,93 @@ vcpu_intel_x64_hyperkernel::schedule(thread *thrd, uintptr_t entry, uintptr_t ar
 }
 
 void
-vcpu_intel_x64_hyperkernel::schedule(process_intel_x64 *proc, thread_intel_x64 *thrd, state_save_intel_x64 *state_save)
+vcpu_intel_x64_hyperkernel::switch_to(thread *thrd)
 {
-    // TODO:
-    //
-    // In v1.2, we need to break up the state save so that we are only copying
-    // the bits that we need to.
-    //
+    auto &&_thrd = dynamic_cast<thread_intel_x64 *>(thrd);
+    auto &&_proc = dynamic_cast<process_intel_x64 *>(thrd->proc().get());
 
+    schedule(_proc, _thrd, &_thrd->m_state_save, true);
+}
+
+void
+vcpu_intel_x64_hyperkernel::schedule(
+    process_intel_x64 *proc, thread_intel_x64 *thrd, state_save_intel_x64 *state_save, bool donate)
+{
     if (thrd != nullptr)
     {
-        auto old_vcpuid = m_state_save->vcpuid;
-        auto old_vmxon_ptr = m_state_save->vmxon_ptr;
-        auto old_vmcs_ptr = m_state_save->vmcs_ptr;
-        auto old_exit_handler_ptr = m_state_save->exit_handler_ptr;
+        // A thread's extended state is only copied if this vCPU's state
+        // save does not already hold it (see thread_intel_x64::load_state),
+        // which saves a copy every time a thread is resumed by the vCPU it
+        // last ran on. Upcalls use a state save of their own, which
+        // replaces the thread's state without being saved.
+
+        if (state_save == &thrd->m_state_save)
+        {
+            thrd->load_state(*m_state_save, thrd == m_loaded_thread);
+            m_loaded_thread = thrd;
+        }
+        else
+        {
+            auto old_vcpuid = m_state_save->vcpuid;
+            auto old_vmxon_ptr = m_state_save->vmxon_ptr;
+            auto old_vmcs_ptr = m_state_save->vmcs_ptr;
+            auto old_exit_handler_ptr = m_state_save->exit_handler_ptr;
+
+            *m_state_save = *state_save;
 
-        *m_state_save = *state_save;
+            m_state_save->vcpuid = old_vcpuid;
+            m_state_save->vmxon_ptr = old_vmxon_ptr;
+            m_state_save->vmcs_ptr = old_vmcs_ptr;
+            m_state_save->exit_handler_ptr = old_exit_handler_ptr;
 
-        m_state_save->vcpuid = old_vcpuid;
-        m_state_save->vmxon_ptr = old_vmxon_ptr;
-        m_state_save->vmcs_ptr = old_vmcs_ptr;
-        m_state_save->exit_handler_ptr = old_exit_handler_ptr;
+            m_loaded_thread = nullptr;
+        }
+
+        m_vmcs_hyperkernel->set_preemption_ticks(this->thread_quantum());
+
+        // Cached translations are tagged with the EPTP (and this vCPU's
+        // VPID), so switching processes does not have to invalidate them.
+        // They only have to be invalidated if the process's EPT changed
+        // since this core last executed it. Threads from the same process
+        // share an EPTP, so the VMCS is only written when it changes.
+
+        auto &&eptp = proc->eptp();
+        proc->sync_ept();
 
         if (this->is_running())
-            m_vmcs_hyperkernel->set_eptp(proc->eptp());
+        {
+            if (eptp != m_loaded_eptp)
+                m_vmcs_hyperkernel->set_eptp(eptp);
+
+            // The preemption timer's value is saved on each VM exit, so not
+            // resetting it hands the rest of the time slice to the thread.
+
+            if (!donate)
+                m_vmcs_hyperkernel->reset_preemption_timer();
+        }
         else
-            m_state_save->user1 = proc->eptp();
+        {
+            m_state_save->user1 = eptp;
+        }
+
+        m_loaded_eptp = eptp;
     }
+    else
+    {
+        process_intel_x64::unload_ept();
+        m_loaded_thread = nullptr;
+    }
+
+    // The exit that led to this thread being scheduled ends here, as run()
+    // does not return to the exit handler.
+
+    exit_stats::end_exit();
 
     m_exit_handler_hyperkernel->set_current_thread(thrd);
+
+    epoch::leave();
+    m_proclt->collect();
+
     run();
 }
 
@@ -22,6 +22,9 @@
 #include <vmcs/vmcs_intel_x64_hyperkernel.h>
 #include <vmcs/vmcs_intel_x64_guest_vm_state.h>
 #include <vmcs/vmcs_intel_x64_32bit_control_fields.h>
+#include <vmcs/vmcs_intel_x64_32bit_guest_state_fields.h>
+
+#include <intrinsics/msrs_intel_x64.h>
 
 using namespace x64;
 using namespace intel_x64;
@@ -36,7 +39,8 @@ vmcs_intel_x64_hyperkernel::vmcs_intel_x64_hyperkernel(
     m_coreid(coreid),
     m_vcpuid(vcpuid),
     m_proclt(proclt),
-    m_domain(domain)
+    m_domain(domain),
+    m_preemption_ticks(quantum::thread())
 { }
 
 void
@@ -59,5 +63,34 @@ vmcs_intel_x64_hyperkernel::write_fields(
 
         this->enable_ept();
         this->set_eptp(m_state_save->user1);
+
+        pin_based_vm_execution_controls::activate_vmx_preemption_timer::enable();
+        vm_exit_controls::save_vmx_preemption_timer_value::enable();
+
+        this->reset_preemption_timer();
     }
 }
+
+void
+vmcs_intel_x64_hyperkernel::set_preemption_ticks(quantum::type ticks)
+{
+    expects(ticks != 0);
+    m_preemption_ticks = ticks;
+}
+
+void
+vmcs_intel_x64_hyperkernel::reset_preemption_timer()
+{
+    // The VMX-preemption timer counts down at the TSC rate divided by
+    // 2^N, where N is reported by IA32_VMX_MISC. Since the timer value is
+    // saved on each VM exit, a thread that exits often (e.g. vmcalls) still
+    // only gets a single time slice until the timer is reset.
+
+    auto &&rate = msrs::ia32_vmx_misc::preemption_timer_decrement::get();
+    auto &&value = m_preemption_ticks >> rate;
+
+    if (value > 0xFFFFFFFFUL)
+        value = 0xFFFFFFFFUL;
+
+    vmx_preemption_timer_value::set(value);
+}
@@ -26,6 +26,15 @@
 PARENT_SUBDIRS += basic_c
 PARENT_SUBDIRS += basic_cxx
 PARENT_SUBDIRS += basic_driver
+PARENT_SUBDIRS += fork_benchmark
+PARENT_SUBDIRS += ipc_benchmark
+PARENT_SUBDIRS += lock_contention
+PARENT_SUBDIRS += map_benchmark
+PARENT_SUBDIRS += run_queue_benchmark
+PARENT_SUBDIRS += startup_benchmark
+PARENT_SUBDIRS += switch_benchmark
+PARENT_SUBDIRS += thread_scaling
+PARENT_SUBDIRS += ttys_benchmark
 
 ################################################################################
 # Common
@@ -24,10 +24,12 @@
 #include <iostream>
 #include <vmcall_hyperkernel_interface.h>
 
+alignas(0x1000) char g_ttys0_buffer[TTYS0_BUFFER_SIZE] = {};
+
 void
-handle_ttys0(char val)
+handle_ttys0(const char *buf, uint64_t len)
 {
-    vmcall__ttys1(val);
+    vmcall__ttys1_write(reinterpret_cast<uintptr_t>(buf), len);
     vmcall__sched_yield();
 }
 
@@ -37,11 +39,12 @@ main(int argc, const char *argv[])
     (void) argc;
     (void) argv;
 
-    vmcall__register_ttys0(reinterpret_cast<uintptr_t>(handle_ttys0));
+    vmcall__register_ttys0(
+        reinterpret_cast<uintptr_t>(handle_ttys0),
+        reinterpret_cast<uintptr_t>(g_ttys0_buffer));
 
     auto msg = gsl::ensure_z("registered: ttys0\n");
-    for (auto c : msg)
-        vmcall__ttys1(c);
+    vmcall__ttys1_write(reinterpret_cast<uintptr_t>(msg.data()), static_cast<uint64_t>(msg.size()));
 
     vmcall__sched_yield_and_remove();
     return 0;
@@ -0,0 +1,101 @@
+/*
+ * Bareflank Hyperkernel
+ *
+ * Copyright (C) 2015 Assured Information Security, Inc.
+ * Author: Rian Quinn        <quinnr@ainfosec.com>
+ * Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <vector>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+
+#include <unistd.h>
+
+constexpr const auto num_forks = 64UL;
+constexpr const auto heap_size = 16UL << 20;
+constexpr const auto page_size = 0x1000UL;
+
+uint64_t
+fork_ticks()
+{
+    auto &&start = __builtin_ia32_rdtsc();
+    auto &&pid = fork();
+    auto &&ticks = __builtin_ia32_rdtsc() - start;
+
+    if (pid < 0)
+        throw std::runtime_error("fork failed");
+
+    // The child does nothing but exit, so all that is measured is how
+    // long it takes to create a copy of this process that is ready to run.
+
+    if (pid == 0)
+        _exit(0);
+
+    return ticks;
+}
+
+uint64_t
+touch_ticks(std::vector<char> &heap)
+{
+    auto &&start = __builtin_ia32_rdtsc();
+
+    for (auto i = 0UL; i < heap.size(); i += page_size)
+        heap.at(i)++;
+
+    return __builtin_ia32_rdtsc() - start;
+}
+
+int
+main(int argc, const char *argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    std::vector<char> heap(heap_size, 1);
+
+    auto &&total = 0UL;
+    auto &&fastest = ~0UL;
+
+    for (auto i = 0UL; i < num_forks; i++)
+    {
+        auto &&ticks = fork_ticks();
+
+        total += ticks;
+        fastest = ticks < fastest ? ticks : fastest;
+    }
+
+    std::cout << "forks: " << num_forks
+              << ", avg ticks: " << total / num_forks
+              << ", min ticks: " << fastest << '\n';
+
+    // The first write to each page after a fork copies it, the second
+    // write does not, which gives the cost of copy-on-write per page.
+
+    fork_ticks();
+
+    auto &&copy = touch_ticks(heap);
+    auto &&no_copy = touch_ticks(heap);
+    auto &&num_pages = heap_size / page_size;
+
+    std::cout << "pages: " << num_pages
+              << ", first write ticks/page: " << copy / num_pages
+              << ", second write ticks/page: " << no_copy / num_pages << '\n';
+
+    return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * Bareflank Hyperkernel
+ *
+ * Copyright (C) 2015 Assured Information Security, Inc.
+ * Author: Rian Quinn        <quinnr@ainfosec.com>
+ * Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <pthread.h>
+
+#include <vmcall_hyperkernel_interface.h>
+
+constexpr const auto num_calls = 100000UL;
+constexpr const auto quit = 0xDEADUL;
+
+alignas(IPC_BUFFER_SIZE) char g_server_buffer[IPC_BUFFER_SIZE];
+alignas(IPC_BUFFER_SIZE) char g_client_buffer[IPC_BUFFER_SIZE];
+
+volatile bool g_ready = false;
+volatile uint64_t g_endpointid = REG_INVALID;
+
+void *
+server(void *arg)
+{
+    (void) arg;
+
+    // The buffers are touched before they are handed to the hyperkernel,
+    // as their pages have to be mapped before they can be used for IPC.
+
+    memset(g_server_buffer, 0, IPC_BUFFER_SIZE);
+    g_endpointid = vmcall__ipc_create_endpoint(reinterpret_cast<uintptr_t>(g_server_buffer));
+    g_ready = true;
+
+    if (g_endpointid == REG_INVALID)
+        return nullptr;
+
+    // Each call is echoed back, with the first word incremented. The bytes
+    // of the call are already in the server's buffer, so replying with the
+    // same length echoes them as well.
+
+    ipc_message_t msg = {};
+
+    while (vmcall__ipc_reply_wait(g_endpointid, &msg))
+    {
+        if (msg.words[0] == quit)
+            break;
+
+        msg.words[0]++;
+    }
+
+    // Deleting the endpoint fails the call that asked the server to quit,
+    // which wakes the client.
+
+    vmcall__ipc_delete_endpoint(g_endpointid);
+    return nullptr;
+}
+
+uint64_t
+round_trip_ticks(uint64_t len)
+{
+    ipc_message_t msg = {};
+    auto &&start = __builtin_ia32_rdtsc();
+
+    for (auto i = 0UL; i < num_calls; i++)
+    {
+        msg.words[0] = i;
+        msg.len = len;
+
+        if (!vmcall__ipc_call(g_endpointid, &msg, reinterpret_cast<uintptr_t>(g_client_buffer)))
+            throw std::runtime_error("vmcall__ipc_call failed");
+
+        if (msg.words[0] != i + 1 || msg.len != len)
+            throw std::runtime_error("ipc reply is corrupt");
+    }
+
+    return __builtin_ia32_rdtsc() - start;
+}
+
+int
+main(int argc, const char *argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    pthread_t thread;
+
+    memset(g_client_buffer, 0, IPC_BUFFER_SIZE);
+
+    if (pthread_create(&thread, nullptr, server, nullptr) != 0)
+        throw std::runtime_error("pthread_create failed");
+
+    while (!g_ready)
+        vmcall__sched_yield();
+
+    if (g_endpointid == REG_INVALID)
+        throw std::runtime_error("vmcall__ipc_create_endpoint failed");
+
+    // Every round trip blocks the client and switches to the server, and
+    // then blocks the server and switches back, without a pass through
+    // the scheduler. The second run also copies a full buffer each way.
+
+    std::cout << "ipc round trip (words): ticks/call: "
+              << round_trip_ticks(0) / num_calls << '\n';
+
+    std::cout << "ipc round trip (4 KiB): ticks/call: "
+              << round_trip_ticks(IPC_BUFFER_SIZE) / num_calls << '\n';
+
+    ipc_message_t msg = {};
+    msg.words[0] = quit;
+
+    vmcall__ipc_call(g_endpointid, &msg, 0);
+    pthread_join(thread, nullptr);
+
+    return 0;
+}
@@ -0,0 +1,185 @@
+/*
+ * Bareflank Hyperkernel
+ *
+ * Copyright (C) 2015 Assured Information Security, Inc.
+ * Author: Rian Quinn        <quinnr@ainfosec.com>
+ * Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+
+#include <pthread.h>
+
+constexpr const auto num_threads = 4UL;
+constexpr const auto num_iterations = 100000UL;
+constexpr const auto calibration_ticks = 100000000UL;
+
+struct spinlock
+{
+    int64_t value;
+
+    void lock()
+    { while (__sync_lock_test_and_set(&value, 1)) { while (value); } }
+
+    void unlock()
+    { __sync_lock_release(&value); }
+};
+
+struct mutex
+{
+    pthread_mutex_t value;
+
+    void lock()
+    { pthread_mutex_lock(&value); }
+
+    void unlock()
+    { pthread_mutex_unlock(&value); }
+};
+
+template<typename L>
+struct shared
+{
+    L lock;
+
+    uint64_t counter;
+    uint64_t handoffs;
+    uint64_t last_owner;
+
+    volatile bool done;
+    uint64_t background;
+};
+
+template<typename L>
+void *
+contend(void *arg)
+{
+    auto &&s = static_cast<std::pair<shared<L> *, uint64_t> *>(arg);
+    auto &&data = s->first;
+
+    for (auto i = 0UL; i < num_iterations; i++)
+    {
+        data->lock.lock();
+
+        if (data->last_owner != s->second)
+        {
+            data->last_owner = s->second;
+            data->handoffs++;
+        }
+
+        data->counter++;
+        data->lock.unlock();
+    }
+
+    return nullptr;
+}
+
+uint64_t
+work(volatile bool *done, uint64_t deadline)
+{
+    auto &&iterations = 0UL;
+
+    while (!*done)
+    {
+        if ((++iterations & 0xFFF) == 0 && __builtin_ia32_rdtsc() >= deadline)
+            break;
+    }
+
+    return iterations;
+}
+
+template<typename L>
+void *
+background(void *arg)
+{
+    auto &&data = static_cast<shared<L> *>(arg);
+
+    data->background = work(&data->done, UINT64_MAX);
+    return nullptr;
+}
+
+double
+background_rate()
+{
+    volatile bool done = false;
+
+    auto &&start = __builtin_ia32_rdtsc();
+    auto &&iterations = work(&done, start + calibration_ticks);
+
+    return static_cast<double>(iterations) / static_cast<double>(__builtin_ia32_rdtsc() - start);
+}
+
+template<typename L>
+void
+run(const char *name, double rate)
+{
+    shared<L> data = {};
+    std::array<pthread_t, num_threads> threads = {};
+    std::array<std::pair<shared<L> *, uint64_t>, num_threads> args = {};
+
+    pthread_t bg;
+    if (pthread_create(&bg, nullptr, background<L>, &data) != 0)
+        throw std::runtime_error("pthread_create failed");
+
+    auto &&start = __builtin_ia32_rdtsc();
+
+    for (auto i = 0UL; i < num_threads; i++)
+    {
+        args.at(i) = {&data, i + 1};
+
+        if (pthread_create(&threads.at(i), nullptr, contend<L>, &args.at(i)) != 0)
+            throw std::runtime_error("pthread_create failed");
+    }
+
+    for (auto &&thread : threads)
+        pthread_join(thread, nullptr);
+
+    auto &&ticks = __builtin_ia32_rdtsc() - start;
+
+    data.done = true;
+    pthread_join(bg, nullptr);
+
+    // With a single vCPU serving the process, every tick that was not given
+    // to the background thread was burned by the contending threads, either
+    // in their critical sections or waiting for the lock.
+
+    auto &&background_ticks = static_cast<uint64_t>(static_cast<double>(data.background) / rate);
+    auto &&burned = ticks > background_ticks ? ticks - background_ticks : 0;
+
+    std::cout << name
+              << ": handoffs: " << data.handoffs
+              << ", ticks/handoff: " << ticks / (data.handoffs + 1)
+              << ", cpu ticks burned/handoff: " << burned / (data.handoffs + 1)
+              << (data.counter == num_threads * num_iterations ? "" : " [count mismatch]") << '\n';
+}
+
+int
+main(int argc, const char *argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    auto &&rate = background_rate();
+
+    run<spinlock>("spinlock", rate);
+    run<mutex>("pthread_mutex", rate);
+
+    return 0;
+}
@@ -0,0 +1,117 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+#include <vmcall_hyperkernel_interface.h>
+
+// -----------------------------------------------------------------------------
+// Configuration
+// -----------------------------------------------------------------------------
+
+// The processes created by this benchmark are never run, so the physical
+// memory they map is never touched. Each layout maps 1GB, and offsets the
+// virtual and physical addresses so that only the page size being measured
+// is possible.
+
+constexpr const auto map_size = 0x40000000UL;
+constexpr const auto map_phys = 0x40000000UL;
+constexpr const auto map_virt = 0x40000000UL;
+constexpr const auto num_passes = 8UL;
+
+struct layout
+{
+    const char *name;
+    uint64_t virt_offset;
+    uint64_t phys_offset;
+};
+
+constexpr const layout layouts[] =
+{
+    {"1g pages", 0x0UL, 0x0UL},
+    {"2m pages", 0x200000UL, 0x200000UL},
+    {"4k pages", 0x0UL, 0x1000UL},
+};
+
+// -----------------------------------------------------------------------------
+// Benchmark
+// -----------------------------------------------------------------------------
+
+double
+time_map(uint64_t procltid, const layout &l)
+{
+    auto &&processid = vmcall__create_foreign_process(procltid);
+    if (processid == REG_INVALID)
+        throw std::runtime_error("vmcall__create_foreign_process failed");
+
+    auto &&start = std::chrono::high_resolution_clock::now();
+    auto &&ret = vmcall__vm_map_foreign(procltid, processid, map_virt + l.virt_offset, map_phys + l.phys_offset, map_size, 0);
+    auto &&end = std::chrono::high_resolution_clock::now();
+
+    if (!vmcall__delete_foreign_process(procltid, processid))
+        throw std::runtime_error("vmcall__delete_foreign_process failed");
+
+    if (!ret)
+        throw std::runtime_error("vmcall__vm_map_foreign failed");
+
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int
+main()
+{
+    auto &&procltid = vmcall__create_process_list();
+    if (procltid == REG_INVALID)
+    {
+        std::cerr << "vmcall__create_process_list failed" << '\n';
+        return EXIT_FAILURE;
+    }
+
+    auto &&ret = EXIT_SUCCESS;
+
+    try
+    {
+        for (const auto &l : layouts)
+        {
+            auto &&total = 0.0;
+
+            for (auto pass = 0UL; pass < num_passes; pass++)
+                total += time_map(procltid, l);
+
+            std::cout << l.name << ": " << std::fixed << std::setprecision(3)
+                      << total / num_passes << " ms per 1GB map" << '\n';
+        }
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << e.what() << '\n';
+        ret = EXIT_FAILURE;
+    }
+
+    vmcall__delete_process_list(procltid);
+    return ret;
+}
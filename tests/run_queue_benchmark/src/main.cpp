@@ -0,0 +1,188 @@
+//
+// Bareflank Hyperkernel
+//
+// Copyright (C) 2015 Assured Information Security, Inc.
+// Author: Rian Quinn        <quinnr@ainfosec.com>
+// Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <process_list/run_queue.h>
+
+// -----------------------------------------------------------------------------
+// Configuration
+// -----------------------------------------------------------------------------
+
+// This benchmark is run natively, and simulates the hyperkernel's per-vCPU
+// run queues using one thread per vCPU. Each app is independent, and is
+// made up of a number of quanta of busy work. A vCPU takes its next app
+// from its own run queue, runs one quantum, and pushes it back if it has
+// more to do. A vCPU whose run queue is empty steals from the others. All
+// of the apps start on the first vCPU's run queue, so that every other
+// vCPU only gets work by stealing.
+
+constexpr const auto num_apps = 256UL;
+constexpr const auto quanta_per_app = 64UL;
+constexpr const auto work_per_quantum = 20000UL;
+constexpr const auto num_passes = 4UL;
+
+using queue_type = run_queue<uint64_t>;
+
+// -----------------------------------------------------------------------------
+// Benchmark
+// -----------------------------------------------------------------------------
+
+struct app
+{
+    std::atomic<uint64_t> remaining;
+    uint64_t result;
+};
+
+uint64_t
+run_quantum(uint64_t seed)
+{
+    volatile auto value = seed;
+
+    for (auto i = 0UL; i < work_per_quantum; i++)
+        value = value * 6364136223846793005UL + 1442695040888963407UL;
+
+    return value;
+}
+
+void
+vcpu(uint64_t id, std::vector<std::unique_ptr<queue_type>> &queues,
+     std::vector<app> &apps, std::atomic<uint64_t> &running, std::atomic<bool> &go)
+{
+    while (!go.load())
+        std::this_thread::yield();
+
+    auto &&queue = *queues.at(id);
+
+    while (running.load() != 0)
+    {
+        uint64_t appid = 0;
+
+        if (!queue.steal(appid))
+        {
+            auto &&found = false;
+
+            for (auto i = 1UL; i < queues.size() && !found; i++)
+                found = queues.at((id + i) % queues.size())->steal(appid);
+
+            if (!found)
+                continue;
+        }
+
+        auto &&a = apps.at(appid);
+        a.result = run_quantum(a.result);
+
+        if (--a.remaining == 0)
+        {
+            running--;
+            continue;
+        }
+
+        queue.push(appid);
+    }
+}
+
+double
+time_vcpus(uint64_t num_vcpus)
+{
+    std::vector<std::unique_ptr<queue_type>> queues;
+    for (auto i = 0UL; i < num_vcpus; i++)
+        queues.push_back(std::make_unique<queue_type>());
+
+    std::vector<app> apps(num_apps);
+    for (auto i = 0UL; i < num_apps; i++)
+    {
+        apps.at(i).remaining = quanta_per_app;
+        apps.at(i).result = i;
+
+        queues.front()->push(i);
+    }
+
+    std::atomic<uint64_t> running(num_apps);
+    std::atomic<bool> go(false);
+
+    std::vector<std::thread> threads;
+    for (auto i = 0UL; i < num_vcpus; i++)
+        threads.emplace_back(vcpu, i, std::ref(queues), std::ref(apps), std::ref(running), std::ref(go));
+
+    auto &&start = std::chrono::high_resolution_clock::now();
+    go = true;
+
+    for (auto &&thread : threads)
+        thread.join();
+
+    auto &&end = std::chrono::high_resolution_clock::now();
+
+    for (const auto &a : apps)
+    {
+        if (a.remaining != 0)
+            throw std::runtime_error("app did not finish");
+    }
+
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int
+main()
+{
+    auto max_vcpus = std::max(std::thread::hardware_concurrency(), 1U);
+
+    try
+    {
+        auto &&base = 0.0;
+
+        for (auto num_vcpus = 1UL; num_vcpus <= max_vcpus; num_vcpus *= 2)
+        {
+            auto &&total = 0.0;
+
+            for (auto pass = 0UL; pass < num_passes; pass++)
+                total += time_vcpus(num_vcpus);
+
+            auto &&ms = total / num_passes;
+            auto &&throughput = (num_apps * quanta_per_app) / ms;
+
+            if (num_vcpus == 1)
+                base = throughput;
+
+            std::cout << num_vcpus << " vcpus: " << std::fixed << std::setprecision(3)
+                      << ms << " ms, " << throughput << " quanta per ms, "
+                      << throughput / base << "x speedup" << '\n';
+        }
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
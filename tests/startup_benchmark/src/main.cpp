@@ -0,0 +1,62 @@
+/*
+ * Bareflank Hyperkernel
+ *
+ * Copyright (C) 2015 Assured Information Security, Inc.
+ * Author: Rian Quinn        <quinnr@ainfosec.com>
+ * Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <cstdint>
+#include <iostream>
+
+// The tables are initialized with something other than zero so that they
+// are stored in the file, which makes this a multi-MB binary: the const
+// table ends up in a read-only segment, and the other in a writable one.
+
+constexpr const auto rodata_size = 32UL << 20;
+constexpr const auto data_size = 4UL << 20;
+constexpr const auto page_size = 0x1000UL;
+
+extern const char g_rodata[rodata_size];
+const char g_rodata[rodata_size] = {1};
+
+char g_data[data_size] = {1};
+
+int
+main(int argc, const char *argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    auto &&start = __builtin_ia32_rdtsc();
+    auto &&sum = 0UL;
+
+    for (auto i = 0UL; i < rodata_size; i += page_size)
+        sum += static_cast<uint64_t>(g_rodata[i]);
+
+    for (auto i = 0UL; i < data_size; i += page_size)
+        sum += static_cast<uint64_t>(g_data[i]);
+
+    auto &&ticks = __builtin_ia32_rdtsc() - start;
+
+    std::cout << "rodata: " << (rodata_size >> 20) << "MB"
+              << ", data: " << (data_size >> 20) << "MB"
+              << ", first touch ticks: " << ticks
+              << ", sum: " << sum << '\n';
+
+    return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * Bareflank Hyperkernel
+ *
+ * Copyright (C) 2015 Assured Information Security, Inc.
+ * Author: Rian Quinn        <quinnr@ainfosec.com>
+ * Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+
+#include <pthread.h>
+
+#include <vmcall_hyperkernel_interface.h>
+
+constexpr const auto num_switches = 100000UL;
+
+struct ping_pong
+{
+    volatile uint64_t turn;
+    bool futex;
+};
+
+void
+wait_turn(ping_pong *pp, uint64_t me)
+{
+    while (true)
+    {
+        auto &&turn = pp->turn;
+
+        if (turn == me)
+            return;
+
+        if (pp->futex)
+            vmcall__futex_wait(reinterpret_cast<uint64_t>(&pp->turn), turn);
+        else
+            vmcall__sched_yield();
+    }
+}
+
+void
+give_turn(ping_pong *pp, uint64_t next)
+{
+    pp->turn = next;
+
+    if (pp->futex)
+        vmcall__futex_wake(reinterpret_cast<uint64_t>(&pp->turn), 1);
+}
+
+void *
+player(void *arg)
+{
+    auto &&pp = static_cast<ping_pong *>(arg);
+
+    for (auto i = 0UL; i < num_switches / 2; i++)
+    {
+        wait_turn(pp, 1);
+        give_turn(pp, 0);
+    }
+
+    return nullptr;
+}
+
+uint64_t
+self_yield_ticks()
+{
+    auto &&start = __builtin_ia32_rdtsc();
+
+    for (auto i = 0UL; i < num_switches; i++)
+        vmcall__sched_yield();
+
+    return __builtin_ia32_rdtsc() - start;
+}
+
+uint64_t
+ping_pong_ticks(bool futex)
+{
+    ping_pong pp = {0, futex};
+    pthread_t thread;
+
+    if (pthread_create(&thread, nullptr, player, &pp) != 0)
+        throw std::runtime_error("pthread_create failed");
+
+    auto &&start = __builtin_ia32_rdtsc();
+
+    for (auto i = 0UL; i < num_switches / 2; i++)
+    {
+        give_turn(&pp, 1);
+        wait_turn(&pp, 0);
+    }
+
+    auto &&ticks = __builtin_ia32_rdtsc() - start;
+
+    pthread_join(thread, nullptr);
+    return ticks;
+}
+
+int
+main(int argc, const char *argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    // A yield with no other thread to run resumes the same thread, which
+    // is the cheapest switch there is. The ping pongs switch between two
+    // threads of the same process on every turn (as long as there is only
+    // one vCPU), either by yielding, or by blocking on a futex.
+
+    std::cout << "yield (same thread): ticks/switch: "
+              << self_yield_ticks() / num_switches << '\n';
+
+    std::cout << "ping pong (yield): ticks/switch: "
+              << ping_pong_ticks(false) / num_switches << '\n';
+
+    std::cout << "ping pong (futex): ticks/switch: "
+              << ping_pong_ticks(true) / num_switches << '\n';
+
+    return 0;
+}
@@ -0,0 +1,118 @@
+/*
+ * Bareflank Hyperkernel
+ *
+ * Copyright (C) 2015 Assured Information Security, Inc.
+ * Author: Rian Quinn        <quinnr@ainfosec.com>
+ * Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+
+#include <pthread.h>
+
+constexpr const auto num_elements = 1UL << 20;
+constexpr const auto num_passes = 16UL;
+constexpr const auto max_threads = 8UL;
+
+struct job
+{
+    const uint64_t *begin;
+    const uint64_t *end;
+    uint64_t sum;
+};
+
+void *
+sum(void *arg)
+{
+    auto &&j = static_cast<job *>(arg);
+    auto &&total = 0UL;
+
+    for (auto pass = 0UL; pass < num_passes; pass++)
+    {
+        for (auto iter = j->begin; iter != j->end; ++iter)
+            total += *iter;
+    }
+
+    j->sum = total;
+    return nullptr;
+}
+
+uint64_t
+parallel_sum(const std::vector<uint64_t> &numbers, uint64_t num_threads)
+{
+    std::array<job, max_threads> jobs = {};
+    std::array<pthread_t, max_threads> threads = {};
+
+    auto &&chunk = numbers.size() / num_threads;
+
+    for (auto i = 0UL; i < num_threads; i++)
+    {
+        jobs.at(i).begin = numbers.data() + i * chunk;
+        jobs.at(i).end = numbers.data() + (i + 1) * chunk;
+
+        if (pthread_create(&threads.at(i), nullptr, sum, &jobs.at(i)) != 0)
+            throw std::runtime_error("pthread_create failed");
+    }
+
+    auto &&total = 0UL;
+
+    for (auto i = 0UL; i < num_threads; i++)
+    {
+        if (pthread_join(threads.at(i), nullptr) != 0)
+            throw std::runtime_error("pthread_join failed");
+
+        total += jobs.at(i).sum;
+    }
+
+    return total;
+}
+
+int
+main(int argc, const char *argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    std::vector<uint64_t> numbers(num_elements);
+
+    for (auto i = 0UL; i < num_elements; i++)
+        numbers.at(i) = i;
+
+    auto &&expected = num_passes * (num_elements * (num_elements - 1) / 2);
+    auto &&baseline = 0UL;
+
+    for (auto num_threads = 1UL; num_threads <= max_threads; num_threads <<= 1)
+    {
+        auto &&start = __builtin_ia32_rdtsc();
+        auto &&total = parallel_sum(numbers, num_threads);
+        auto &&ticks = __builtin_ia32_rdtsc() - start;
+
+        if (num_threads == 1)
+            baseline = ticks;
+
+        std::cout << "threads: " << num_threads
+                  << ", ticks: " << ticks
+                  << ", speedup: " << (baseline * 100 / ticks) << "%"
+                  << (total == expected ? "" : " [sum mismatch]") << '\n';
+    }
+
+    return 0;
+}
@@ -0,0 +1,110 @@
+/*
+ * Bareflank Hyperkernel
+ *
+ * Copyright (C) 2015 Assured Information Security, Inc.
+ * Author: Rian Quinn        <quinnr@ainfosec.com>
+ * Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include <cpuid.h>
+
+#include <vmcall_hyperkernel_interface.h>
+
+constexpr const auto num_lines = 1000UL;
+constexpr const auto line = "ttys_benchmark: the quick brown fox jumps over the lazy dog 0123\n";
+
+uint64_t
+tsc_mhz()
+{
+    // CPUID leaf 0x16 reports the base frequency (which the TSC runs at)
+    // on newer CPUs, and zero (or nothing) on older ones.
+
+    auto &&eax = 0U;
+    auto &&ebx = 0U;
+    auto &&ecx = 0U;
+    auto &&edx = 0U;
+
+    if (__get_cpuid(0x16, &eax, &ebx, &ecx, &edx) == 0)
+        return 0;
+
+    return eax & 0xFFFF;
+}
+
+uint64_t
+printf_ticks()
+{
+    auto &&start = __builtin_ia32_rdtsc();
+
+    for (auto i = 0UL; i < num_lines; i++)
+        printf("%s", line);
+
+    fflush(stdout);
+    return __builtin_ia32_rdtsc() - start;
+}
+
+uint64_t
+per_byte_ticks()
+{
+    auto &&len = strlen(line);
+    auto &&start = __builtin_ia32_rdtsc();
+
+    for (auto i = 0UL; i < num_lines; i++)
+    {
+        for (auto j = 0UL; j < len; j++)
+            vmcall__ttys0(line[j]);
+    }
+
+    return __builtin_ia32_rdtsc() - start;
+}
+
+void
+report(const char *name, uint64_t ticks)
+{
+    auto &&bytes = num_lines * strlen(line);
+    auto &&mhz = tsc_mhz();
+
+    std::cout << name << ": " << bytes << " bytes"
+              << ", ticks/byte: " << ticks / bytes;
+
+    if (mhz != 0)
+        std::cout << ", bytes/sec: " << (bytes * mhz * 1000000) / ticks;
+
+    std::cout << '\n';
+}
+
+int
+main(int argc, const char *argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    // The output of each run is written first, and the results after, so
+    // that the results are not lost in the output.
+
+    auto &&buffered = printf_ticks();
+    auto &&per_byte = per_byte_ticks();
+
+    report("printf (ttys ring)", buffered);
+    report("vmcall per byte", per_byte);
+
+    return 0;
+}